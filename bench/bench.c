@@ -0,0 +1,1138 @@
+/*
+ * bench.c - benchmark of line breaking with synthetic corpora.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+/*
+ * Usage: bench [options]
+ *   -n CHARS   size of each corpus in characters (default 262144).
+ *   -t SECONDS minimum time of each measurement (default 0.2).
+ *   -s SEED    seed of corpus generator (default 1).
+ *   -c NAMES   comma-separated corpora to measure (default all).
+ *   -O NAMES   comma-separated option sets to measure (default all).
+ *   -f NAMES   comma-separated functions to measure (default all).
+ *   -d DIR     write corpora as UTF-8 files into DIR then exit.
+ *   -l         list names of corpora, option sets and functions then exit.
+ *   -C         counter mode (see below).
+ *   -b FILE    in counter mode, compare counters with baseline FILE.
+ *   -T RATIO   in counter mode, tolerance of counters (default 0.05).
+ *   -G RATIO   in counter mode, limit of growth (default 2.5).
+ *
+ * Results are written to standard output as tab-separated values, one
+ * measurement per line, preceded by comment lines beginning with "#".
+ * Numbers of allocations per line and per cluster are written only when
+ * configured with --enable-malloc-debug; otherwise they are "-".
+ * Corpora are generated from the property tables of the library, so they
+ * are identical for the same seed, size and Unicode version.
+ *
+ * The "edit" function makes layout of corpus by linebreak_layout_new(),
+ * then types 64 characters at middle of it and deletes them one by one.
+ *
+ * In counter mode, wall time is not measured.  Instead, for each case
+ * (by default, "default" and "uribreak" option sets, break, partial and
+ * edit functions and size of 16384), counters of linebreak_get_stats() and
+ * number of allocations per cluster are written.  For the edit function,
+ * counters of typing only are written per edit, and the "paragraph"
+ * corpus is skipped.  These do not depend on machine load, so that they
+ * may be compared with baseline.  Output of this mode may be used as
+ * baseline.  Additionally, growth of characters scanned and moved, bytes
+ * and allocations per cluster when size of input is quadrupled is
+ * checked: it is about 1.0 unless processing is quadratic, or unless cost
+ * of an edit depends on size of text.  The "paragraph" corpus, a single
+ * paragraph, catches processing quadratic in length of paragraph.  Growth
+ * of work, i.e. instructions counted by perf_event_open(2), is also
+ * checked if the counter is available; otherwise it is reported as
+ * skipped.
+ */
+
+#include <stdio.h>
+#include "sombok.h"
+#include "sombok_constants.h"
+#include "perfcount.h"
+
+#define PARTIAL_CHUNK (4096)
+#define EDIT_KEYS (64)
+
+/***
+ *** Deterministic pseudo-random numbers.
+ ***/
+
+static unsigned long rngstate;
+
+static
+unsigned long rnd(unsigned long n)
+{
+    rngstate = rngstate * 1103515245UL + 12345UL;
+    rngstate &= 0xFFFFFFFFUL;
+    return (rngstate >> 8) % n;
+}
+
+/***
+ *** Corpus generation.
+ ***/
+
+typedef struct {
+    unichar_t *str;
+    size_t len;
+    size_t siz;
+    size_t max;
+} buffer_t;
+
+static linebreak_t *proplb;
+
+static
+void put(buffer_t * buf, unichar_t c)
+{
+    if (buf->max <= buf->len)
+	return;
+    if (buf->siz <= buf->len) {
+	buf->siz = buf->siz ? buf->siz * 2 : 4096;
+	if ((buf->str = realloc(buf->str, sizeof(unichar_t) * buf->siz))
+	    == NULL) {
+	    perror("realloc");
+	    exit(errno);
+	}
+    }
+    buf->str[buf->len++] = c;
+}
+
+static
+void puts_ascii(buffer_t * buf, const char *s)
+{
+    while (*s)
+	put(buf, (unichar_t) (unsigned char) *s++);
+}
+
+/*
+ * Put a character in range [lo, hi] of which line breaking class is lbc1 or
+ * lbc2.  The range should contain such characters.  If lbc1 is
+ * PROP_UNKNOWN, any character is put.
+ */
+static
+void pick(buffer_t * buf, unichar_t lo, unichar_t hi, propval_t lbc1,
+	  propval_t lbc2)
+{
+    unichar_t c;
+    propval_t lbc;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+	c = lo + (unichar_t) rnd(hi - lo + 1);
+	if (lbc1 == PROP_UNKNOWN)
+	    break;
+	linebreak_charprop(proplb, c, &lbc, NULL, NULL, NULL);
+	if (lbc == lbc1 || lbc == lbc2)
+	    break;
+    }
+    put(buf, c);
+}
+
+static
+void latin_word(buffer_t * buf, size_t min, size_t max)
+{
+    size_t i, n = min + rnd(max - min + 1);
+
+    for (i = 0; i < n; i++)
+	pick(buf, 'a', 'z', LB_AL, PROP_UNKNOWN);
+}
+
+static
+void gen_english(buffer_t * buf)
+{
+    size_t w, n;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 40 + rnd(80); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    latin_word(buf, 1, 10);
+	    if (rnd(8) == 0)
+		put(buf, rnd(2) ? ',' : '.');
+	}
+	put(buf, '\n');
+    }
+}
+
+/* One paragraph without newlines. */
+static
+void gen_paragraph(buffer_t * buf)
+{
+    while (buf->len < buf->max) {
+	latin_word(buf, 1, 10);
+	if (rnd(8) == 0)
+	    put(buf, rnd(2) ? ',' : '.');
+	put(buf, ' ');
+    }
+}
+
+static
+void gen_cjk(buffer_t * buf)
+{
+    size_t w, n;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 100 + rnd(200); w < n; w++) {
+	    if (rnd(3))
+		pick(buf, 0x4E00, 0x9FFF, LB_ID, PROP_UNKNOWN);
+	    else
+		pick(buf, 0x3041, 0x30FF, LB_ID, LB_NS);
+	    if (rnd(20) == 0)
+		pick(buf, 0x3001, 0x3002, LB_CL, PROP_UNKNOWN);
+	    else if (rnd(40) == 0) {
+		put(buf, 0x300C);
+		pick(buf, 0x4E00, 0x9FFF, LB_ID, PROP_UNKNOWN);
+		put(buf, 0x300D);
+	    }
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_thai(buffer_t * buf)
+{
+    size_t w, i, n, m;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 20 + rnd(40); w < n; w++) {
+	    for (i = 0, m = 4 + rnd(20); i < m; i++)
+		pick(buf, 0x0E01, 0x0E4E, LB_SA, PROP_UNKNOWN);
+	    put(buf, ' ');
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_hangul(buffer_t * buf)
+{
+    size_t w, i, n, m;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 40 + rnd(80); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    for (i = 0, m = 1 + rnd(5); i < m; i++) {
+		if (rnd(16))
+		    pick(buf, 0xAC00, 0xD7A3, LB_H2, LB_H3);
+		else {
+		    /* conjoining jamo */
+		    pick(buf, 0x1100, 0x1112, LB_JL, PROP_UNKNOWN);
+		    pick(buf, 0x1161, 0x1175, LB_JV, PROP_UNKNOWN);
+		    if (rnd(2))
+			pick(buf, 0x11A8, 0x11C2, LB_JT, PROP_UNKNOWN);
+		}
+	    }
+	    if (rnd(10) == 0)
+		put(buf, '.');
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_devanagari(buffer_t * buf)
+{
+    size_t w, i, n, m;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 30 + rnd(60); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    for (i = 0, m = 1 + rnd(4); i < m; i++) {
+		pick(buf, 0x0915, 0x0939, LB_AL, PROP_UNKNOWN);
+		if (rnd(4) == 0) {
+		    put(buf, 0x094D);	/* virama */
+		    pick(buf, 0x0915, 0x0939, LB_AL, PROP_UNKNOWN);
+		}
+		if (rnd(2))
+		    pick(buf, 0x093E, 0x094C, LB_CM, PROP_UNKNOWN);
+	    }
+	    if (rnd(12) == 0)
+		put(buf, 0x0964);	/* danda */
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_emoji(buffer_t * buf)
+{
+    size_t w, n;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 30 + rnd(60); w < n; w++) {
+	    switch (rnd(6)) {
+	    case 0:
+		/* flag */
+		pick(buf, 0x1F1E6, 0x1F1FF, LB_RI, PROP_UNKNOWN);
+		pick(buf, 0x1F1E6, 0x1F1FF, LB_RI, PROP_UNKNOWN);
+		break;
+	    case 1:
+		/* with emoji modifier */
+		pick(buf, 0x1F466, 0x1F469, PROP_UNKNOWN, PROP_UNKNOWN);
+		pick(buf, 0x1F3FB, 0x1F3FF, PROP_UNKNOWN, PROP_UNKNOWN);
+		break;
+	    case 2:
+		/* with variation selector */
+		pick(buf, 0x2600, 0x26FF, LB_ID, LB_AL);
+		put(buf, 0xFE0F);
+		break;
+	    case 3:
+		put(buf, ' ');
+		latin_word(buf, 1, 8);
+		put(buf, ' ');
+		break;
+	    default:
+		pick(buf, 0x1F300, 0x1F64F, LB_ID, PROP_UNKNOWN);
+		break;
+	    }
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_url(buffer_t * buf)
+{
+    size_t w, i, n, m;
+    char num[32];
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 20 + rnd(40); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    if (rnd(3)) {
+		latin_word(buf, 1, 10);
+		continue;
+	    }
+	    puts_ascii(buf, rnd(2) ? "https://www." : "http://");
+	    latin_word(buf, 3, 12);
+	    puts_ascii(buf, rnd(2) ? ".com" : ".example.org");
+	    for (i = 0, m = 1 + rnd(5); i < m; i++) {
+		put(buf, '/');
+		latin_word(buf, 1, 10);
+		if (rnd(3) == 0) {
+		    put(buf, rnd(2) ? '-' : '_');
+		    latin_word(buf, 1, 8);
+		}
+	    }
+	    if (rnd(2)) {
+		sprintf(num, "?id=%lu&p=%lu", rnd(100000), rnd(100));
+		puts_ascii(buf, num);
+	    }
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_numeric(buffer_t * buf)
+{
+    size_t w, n;
+    char num[64];
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 30 + rnd(60); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    switch (rnd(7)) {
+	    case 0:
+		sprintf(num, "$%lu,%03lu.%02lu", rnd(1000), rnd(1000),
+			rnd(100));
+		break;
+	    case 1:
+		sprintf(num, "(%lu.%lu%%)", rnd(100), rnd(10));
+		break;
+	    case 2:
+		sprintf(num, "-%lu", rnd(100000));
+		break;
+	    case 3:
+		sprintf(num, "%lu/%lu", rnd(100), 1 + rnd(100));
+		break;
+	    case 4:
+		sprintf(num, "%lu:%02lu", rnd(24), rnd(60));
+		break;
+	    case 5:
+		sprintf(num, "%lu.%lu.%lu", rnd(256), rnd(256), rnd(256));
+		break;
+	    default:
+		latin_word(buf, 1, 8);
+		continue;
+	    }
+	    puts_ascii(buf, num);
+	    if (rnd(5) == 0)
+		put(buf, 0x20AC);	/* EURO SIGN: PR */
+	}
+	put(buf, '\n');
+    }
+}
+
+static
+void gen_longtoken(buffer_t * buf)
+{
+    size_t w, n;
+
+    while (buf->len < buf->max) {
+	for (w = 0, n = 4 + rnd(8); w < n; w++) {
+	    if (w)
+		put(buf, ' ');
+	    if (rnd(2))
+		latin_word(buf, 100, 5000);
+	    else
+		latin_word(buf, 1, 10);
+	}
+	put(buf, '\n');
+    }
+}
+
+static struct {
+    const char *name;
+    void (*gen) (buffer_t *);
+    /* Whole corpus is one paragraph, so that an edit breaks all of it. */
+    int onepara;
+} corpora[] = {
+    {"english", gen_english, 0},
+    {"paragraph", gen_paragraph, 1},
+    {"cjk", gen_cjk, 0},
+    {"thai", gen_thai, 0},
+    {"hangul", gen_hangul, 0},
+    {"devanagari", gen_devanagari, 0},
+    {"emoji", gen_emoji, 0},
+    {"url", gen_url, 0},
+    {"numeric", gen_numeric, 0},
+    {"longtoken", gen_longtoken, 0},
+    {NULL, NULL, 0}
+};
+
+/***
+ *** Option sets.
+ ***/
+
+static struct {
+    const char *name;
+    int options;
+    double colmax;
+    size_t charmax;
+    int format;
+    int uribreak;
+} optsets[] = {
+    /* name, options, colmax, charmax, format/sizing/urgent, uribreak */
+    {"default", 0, 76.0, 998, 1, 0},
+    {"eastasian", LINEBREAK_OPTION_EASTASIAN_CONTEXT, 76.0, 998, 1, 0},
+    {"complex", LINEBREAK_OPTION_COMPLEX_BREAKING |
+     LINEBREAK_OPTION_VIRAMA_AS_JOINER, 76.0, 998, 1, 0},
+    {"uribreak", 0, 76.0, 998, 1, 1},
+    {"nowrap", 0, 0.0, 0, 0, 0},
+    {NULL, 0, 0.0, 0, 0, 0}
+};
+
+static
+linebreak_t *make_lbobj(int n)
+{
+    linebreak_t *lbobj;
+
+    if ((lbobj = linebreak_new(NULL)) == NULL) {
+	perror("linebreak_new");
+	exit(errno);
+    }
+    lbobj->options = optsets[n].options;
+    lbobj->colmax = optsets[n].colmax;
+    lbobj->charmax = optsets[n].charmax;
+    if (optsets[n].format) {
+	linebreak_set_format(lbobj, linebreak_format_SIMPLE, NULL);
+	linebreak_set_sizing(lbobj, linebreak_sizing_UAX11, NULL);
+	linebreak_set_urgent(lbobj, linebreak_urgent_FORCE, NULL);
+    }
+    if (optsets[n].uribreak)
+	linebreak_add_prep(lbobj, linebreak_prep_URIBREAK, "");
+    return lbobj;
+}
+
+/***
+ *** Measured functions.  Each returns number of lines, or -1 on error.
+ ***/
+
+typedef struct {
+    unistr_t *ustr;
+    char *utf8;
+    size_t utf8len;
+} input_t;
+
+static
+long count_result(linebreak_t * lbobj, gcstring_t ** lines)
+{
+    long n;
+
+    if (lines == NULL)
+	return -1;
+    for (n = 0; lines[n] != NULL; n++);
+    linebreak_free_result(lines, 1);
+    return lbobj->errnum ? -1 : n;
+}
+
+static
+long run_break(linebreak_t * lbobj, input_t * in)
+{
+    return count_result(lbobj, linebreak_break(lbobj, in->ustr));
+}
+
+static
+long run_break_fast(linebreak_t * lbobj, input_t * in)
+{
+    return count_result(lbobj, linebreak_break_fast(lbobj, in->ustr));
+}
+
+static
+long run_partial(linebreak_t * lbobj, input_t * in)
+{
+    unistr_t chunk;
+    size_t pos;
+    long n, lines = 0;
+
+    for (pos = 0; pos < in->ustr->len; pos += chunk.len) {
+	chunk.str = in->ustr->str + pos;
+	chunk.len = in->ustr->len - pos;
+	if (PARTIAL_CHUNK < chunk.len)
+	    chunk.len = PARTIAL_CHUNK;
+	if ((n = count_result(lbobj, linebreak_break_partial(lbobj, &chunk)))
+	    < 0)
+	    return -1;
+	lines += n;
+    }
+    if ((n = count_result(lbobj, linebreak_break_partial(lbobj, NULL))) < 0)
+	return -1;
+    return lines + n;
+}
+
+static
+long run_from_utf8(linebreak_t * lbobj, input_t * in)
+{
+    gcstring_t *gcstr;
+
+    if ((gcstr = gcstring_new_from_utf8(in->utf8, in->utf8len,
+					SOMBOK_UTF8_CHECK_NONE,
+					lbobj)) == NULL)
+	return -1;
+    gcstring_destroy(gcstr);
+    return 0;
+}
+
+/*
+ * Type EDIT_KEYS characters at middle of layout one by one, then delete
+ * them one by one, as an editor does.  Text of layout is restored.
+ */
+static
+int type_keys(linebreak_t * lbobj, linebreak_layout_t * layout,
+	      unistr_t * keys)
+{
+    unistr_t key;
+    size_t pos = linebreak_layout_length(layout) / 2, i;
+
+    key.len = 1;
+    for (i = 0; i < EDIT_KEYS; i++) {
+	key.str = keys->str + i % keys->len;
+	if (linebreak_layout_edit(lbobj, layout, pos + i, 0, &key) != 0)
+	    return -1;
+    }
+    for (i = EDIT_KEYS; 0 < i; i--)
+	if (linebreak_layout_edit(lbobj, layout, pos + i - 1, 1, NULL) != 0)
+	    return -1;
+    return 0;
+}
+
+static
+long run_edit(linebreak_t * lbobj, input_t * in)
+{
+    linebreak_layout_t *layout;
+    long n = -1;
+
+    if (in->ustr->len == 0)
+	return 0;
+    if ((layout = linebreak_layout_new(lbobj, in->ustr)) == NULL)
+	return -1;
+    if (type_keys(lbobj, layout, in->ustr) == 0)
+	n = (long) linebreak_layout_nlines(layout);
+    linebreak_layout_destroy(layout);
+    return n;
+}
+
+static struct {
+    const char *name;
+    long (*run) (linebreak_t *, input_t *);
+    /* Measured per edit by counter mode.  See sample_edit(). */
+    int edit;
+} funcs[] = {
+    {"break", run_break, 0},
+    {"break_fast", run_break_fast, 0},
+    {"partial", run_partial, 0},
+    {"from_utf8", run_from_utf8, 0},
+    {"edit", run_edit, 1},
+    {NULL, NULL, 0}
+};
+
+/***
+ *** Main.
+ ***/
+
+/* Number of calls to allocator so far, or -1 if it is not available. */
+static
+double alloc_count(void)
+{
+#ifdef MALLOC_DEBUG
+    mymalloc_stats_t ms;
+
+    MYgetstats(&ms);
+    return (double) (ms.allocs + ms.reallocs);
+#else
+    return -1.0;
+#endif				/* MALLOC_DEBUG */
+}
+
+/* Is name an element of comma-separated list?  NULL list matches all. */
+static
+int selected(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    if (list == NULL)
+	return 1;
+    for (p = list; *p; p++) {
+	if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')
+	    && (p == list || p[-1] == ','))
+	    return 1;
+    }
+    return 0;
+}
+
+static
+void generate(int c, size_t size, unsigned long seed, unistr_t * ustr)
+{
+    buffer_t buf = { NULL, 0, 0, 0 };
+
+    rngstate = seed;
+    buf.max = size;
+    (*corpora[c].gen) (&buf);
+    ustr->str = buf.str;
+    ustr->len = buf.len;
+}
+
+static
+void dump(const char *dir, int c, unistr_t * ustr)
+{
+    char *path, *utf8;
+    size_t len;
+    FILE *fp;
+
+    if ((path = malloc(strlen(dir) + strlen(corpora[c].name) + 6)) == NULL
+	|| (utf8 = sombok_encode_utf8(NULL, &len, 0, ustr)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    sprintf(path, "%s/%s.txt", dir, corpora[c].name);
+    if ((fp = fopen(path, "wb")) == NULL) {
+	perror(path);
+	exit(errno);
+    }
+    fwrite(utf8, 1, len, fp);
+    fclose(fp);
+    free(utf8);
+    free(path);
+}
+
+/***
+ *** Counter mode.
+ ***/
+
+static const char *counter_names[] = {
+    "lines", "gcstrings", "calls_format", "calls_sizing", "calls_urgent",
+    "calls_prep", "map_lookups", "allocs", "scanned", "moved", NULL
+};
+
+#define NCOUNTERS (10)
+
+typedef struct {
+    /* Number of clusters, or number of edits by sample_edit(). */
+    double clusters;
+    /* per cluster, or -1 if not available. */
+    double counters[NCOUNTERS];
+    double bytes, allocs, work;
+} sample_t;
+
+typedef struct {
+    char name[128];
+    char counter[32];
+    double value;
+} baseline_t;
+
+static baseline_t *baseline = NULL;
+static size_t baselinelen = 0;
+
+static
+void load_baseline(const char *path)
+{
+    FILE *fp;
+    char line[256];
+    baseline_t *b;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(errno);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (line[0] == '#' || line[0] == '\n')
+	    continue;
+	if ((b = realloc(baseline, sizeof(baseline_t) * (baselinelen + 1)))
+	    == NULL) {
+	    perror("realloc");
+	    exit(errno);
+	}
+	baseline = b;
+	b += baselinelen;
+	if (sscanf(line, "%127s %31s %lf", b->name, b->counter, &b->value)
+	    == 3)
+	    baselinelen++;
+    }
+    fclose(fp);
+}
+
+static
+baseline_t *find_baseline(const char *name, const char *counter)
+{
+    size_t i;
+
+    for (i = 0; i < baselinelen; i++)
+	if (strcmp(baseline[i].name, name) == 0 &&
+	    strcmp(baseline[i].counter, counter) == 0)
+	    return baseline + i;
+    return NULL;
+}
+
+/* Store counters of lbobj divided by smp->clusters into smp. */
+static
+void store_counters(linebreak_t * lbobj, double lines, double allocs,
+		    sample_t * smp)
+{
+    linebreak_stats_t st;
+    int i;
+
+    linebreak_get_stats(lbobj, &st);
+    smp->counters[0] = lines;
+    smp->counters[1] = (double) st.gcstrings;
+    smp->counters[2] = (double) st.calls_format;
+    smp->counters[3] = (double) st.calls_sizing;
+    smp->counters[4] = (double) st.calls_urgent;
+    smp->counters[5] = (double) st.calls_prep;
+    smp->counters[6] = (double) st.map_lookups;
+    smp->counters[7] = allocs;
+    smp->counters[8] = (double) st.scanned;
+    smp->counters[9] = (double) st.moved;
+    for (i = 0; i < NCOUNTERS; i++)
+	if (0.0 <= smp->counters[i])
+	    smp->counters[i] /= smp->clusters;
+    smp->bytes = (double) st.gcstring_bytes / smp->clusters;
+    smp->allocs = (0.0 <= allocs) ? allocs / smp->clusters : -1.0;
+}
+
+static
+void sample(int c, int o, int f, size_t size, unsigned long seed,
+	    int instfd, sample_t * smp)
+{
+    unistr_t ustr;
+    input_t in;
+    linebreak_t *lbobj;
+    gcstring_t *gcstr;
+    double a, w;
+    long lines;
+    int i;
+
+    generate(c, size, seed, &ustr);
+    in.ustr = &ustr;
+    if ((in.utf8 = sombok_encode_utf8(NULL, &in.utf8len, 0, &ustr)) == NULL
+	|| (lbobj = make_lbobj(o)) == NULL
+	|| (gcstr = gcstring_newcopy(&ustr, lbobj)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    smp->clusters = gcstr->gclen ? (double) gcstr->gclen : 1.0;
+    gcstring_destroy(gcstr);
+
+    linebreak_set_stats(lbobj, 1);
+    a = alloc_count();
+    lines = (*funcs[f].run) (lbobj, &in);
+    if (0.0 <= a)
+	a = alloc_count() - a;
+    if (lines < 0) {
+	errno = lbobj->errnum ? lbobj->errnum : errno;
+	fprintf(stderr, "%s/%s/%s: %s\n", corpora[c].name, optsets[o].name,
+		funcs[f].name, strerror(errno));
+	exit(1);
+    }
+    linebreak_reset(lbobj);
+    store_counters(lbobj, (double) lines, a, smp);
+
+    /* least instructions of 5 runs, if counted. */
+    linebreak_set_stats(lbobj, 0);
+    smp->work = -1.0;
+    for (i = 0; 0.0 <= perfcount_read(instfd) && i < 5; i++) {
+	w = perfcount_read(instfd);
+	(*funcs[f].run) (lbobj, &in);
+	w = perfcount_read(instfd) - w;
+	linebreak_reset(lbobj);
+	if (smp->work < 0.0 || w < smp->work)
+	    smp->work = w;
+    }
+    if (0.0 <= smp->work)
+	smp->work /= smp->clusters;
+
+    linebreak_destroy(lbobj);
+    free(in.utf8);
+    free(ustr.str);
+}
+
+/*
+ * Sample counters of editing layout of corpus c by type_keys().  The
+ * cursor is put at middle of text in advance.  Counters are per edit, so
+ * that they are about constant unless cost of edit depends on size of
+ * text.
+ */
+static
+void sample_edit(int c, int o, size_t size, unsigned long seed,
+		 int instfd, sample_t * smp)
+{
+    unistr_t ustr;
+    linebreak_t *lbobj;
+    linebreak_layout_t *layout;
+    double a, w;
+    int i;
+
+    generate(c, size, seed, &ustr);
+    if ((lbobj = make_lbobj(o)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    if ((layout = linebreak_layout_new(lbobj, &ustr)) == NULL ||
+	linebreak_layout_edit(lbobj, layout, ustr.len / 2, 0, NULL) != 0) {
+	errno = lbobj->errnum ? lbobj->errnum : errno;
+	fprintf(stderr, "%s/%s/edit: %s\n", corpora[c].name,
+		optsets[o].name, strerror(errno));
+	exit(1);
+    }
+    smp->clusters = (double) (EDIT_KEYS * 2);
+
+    linebreak_set_stats(lbobj, 1);
+    a = alloc_count();
+    if (type_keys(lbobj, layout, &ustr) != 0) {
+	errno = lbobj->errnum ? lbobj->errnum : errno;
+	fprintf(stderr, "%s/%s/edit: %s\n", corpora[c].name,
+		optsets[o].name, strerror(errno));
+	exit(1);
+    }
+    if (0.0 <= a)
+	a = alloc_count() - a;
+    store_counters(lbobj, -1.0, a, smp);
+
+    /* least instructions of 5 runs, if counted. */
+    linebreak_set_stats(lbobj, 0);
+    smp->work = -1.0;
+    for (i = 0; 0.0 <= perfcount_read(instfd) && i < 5; i++) {
+	w = perfcount_read(instfd);
+	type_keys(lbobj, layout, &ustr);
+	w = perfcount_read(instfd) - w;
+	if (smp->work < 0.0 || w < smp->work)
+	    smp->work = w;
+    }
+    if (0.0 <= smp->work)
+	smp->work /= smp->clusters;
+
+    linebreak_layout_destroy(layout);
+    linebreak_destroy(lbobj);
+    free(ustr.str);
+}
+
+/* Write a result of counter mode.  Returns 1 if check failed. */
+static
+int check(const char *name, const char *counter, double value,
+	  double tolerance)
+{
+    baseline_t *b;
+
+    printf("%s\t%s\t%.6f", name, counter, value);
+    if ((b = find_baseline(name, counter)) != NULL &&
+	(value < b->value * (1.0 - tolerance) - 1e-6 ||
+	 b->value * (1.0 + tolerance) + 1e-6 < value)) {
+	printf("\t# FAIL: baseline %.6f\n", b->value);
+	return 1;
+    }
+    printf("\n");
+    return 0;
+}
+
+static
+int check_growth(const char *name, const char *metric, double small,
+		 double large, double limit)
+{
+    double growth;
+
+    if (small < 0.0 || large < 0.0) {
+	printf("#growth\t%s\t%s\tskipped\n", name, metric);
+	return 0;
+    }
+    if (small == 0.0)
+	return 0;
+    growth = large / small;
+    printf("#growth\t%s\t%s\t%.3f", name, metric, growth);
+    if (limit < growth) {
+	printf("\t# FAIL: limit %.3f\n", limit);
+	return 1;
+    }
+    printf("\n");
+    return 0;
+}
+
+static
+int counter_mode(const char *clist, const char *olist, const char *flist,
+		 size_t size, unsigned long seed, double tolerance,
+		 double limit)
+{
+    int c, o, f, i, instfd, fails = 0;
+    sample_t small, large;
+    char name[128];
+
+    instfd = perfcount_open(PERFCOUNT_INSTRUCTIONS);
+    if (perfcount_read(instfd) < 0.0)
+	fprintf(stderr, "Instruction counter is not available: "
+		"growth of work is not checked.\n");
+    printf("# sombok %s unicode %s\n", SOMBOK_VERSION,
+	   linebreak_unicode_version);
+    printf("# size %lu seed %lu work %s\n", (unsigned long) size, seed,
+	   (perfcount_read(instfd) < 0.0) ? "none" : "instructions");
+    printf("#case\tcounter\tper_cluster\n");
+
+    for (c = 0; corpora[c].name != NULL; c++) {
+	if (!selected(clist, corpora[c].name))
+	    continue;
+	for (o = 0; optsets[o].name != NULL; o++) {
+	    if (!selected(olist, optsets[o].name))
+		continue;
+	    for (f = 0; funcs[f].name != NULL; f++) {
+		if (!selected(flist, funcs[f].name))
+		    continue;
+		/* An edit of single paragraph costs its size. */
+		if (funcs[f].edit && corpora[c].onepara)
+		    continue;
+		sprintf(name, "%s/%s/%s", corpora[c].name, optsets[o].name,
+			funcs[f].name);
+		if (funcs[f].edit) {
+		    sample_edit(c, o, size, seed, instfd, &small);
+		    sample_edit(c, o, size * 4, seed, instfd, &large);
+		} else {
+		    sample(c, o, f, size, seed, instfd, &small);
+		    sample(c, o, f, size * 4, seed, instfd, &large);
+		}
+
+		for (i = 0; i < NCOUNTERS; i++)
+		    if (0.0 <= small.counters[i])
+			fails += check(name, counter_names[i],
+				       small.counters[i], tolerance);
+		fails += check_growth(name, "scanned", small.counters[8],
+				      large.counters[8], limit);
+		fails += check_growth(name, "moved", small.counters[9],
+				      large.counters[9], limit);
+		fails += check_growth(name, "gcstring_bytes", small.bytes,
+				      large.bytes, limit);
+		fails += check_growth(name, "allocs", small.allocs,
+				      large.allocs, limit);
+		fails += check_growth(name, "work", small.work, large.work,
+				      limit);
+		fflush(stdout);
+	    }
+	}
+    }
+    if (fails)
+	fprintf(stderr, "%d check(s) failed.\n", fails);
+    return fails ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = 262144, clusters;
+    double mintime = 0.2, start, elapsed, allocs;
+    unsigned long seed = 1, iter;
+    double tolerance = 0.05, limit = 2.5;
+    char *clist = NULL, *olist = NULL, *flist = NULL, *dir = NULL;
+    int i, c, o, f, counters = 0, size_set = 0;
+    long lines;
+    unistr_t ustr;
+    input_t in;
+    linebreak_t *lbobj;
+    gcstring_t *gcstr;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-l") == 0) {
+	    for (c = 0; corpora[c].name != NULL; c++)
+		printf("corpus\t%s\n", corpora[c].name);
+	    for (o = 0; optsets[o].name != NULL; o++)
+		printf("options\t%s\n", optsets[o].name);
+	    for (f = 0; funcs[f].name != NULL; f++)
+		printf("function\t%s\n", funcs[f].name);
+	    exit(0);
+	} else if (strcmp(argv[i], "-C") == 0) {
+	    counters = 1;
+	    continue;
+	} else if (i + 1 == argc || argv[i][0] != '-' || argv[i][1] == '\0'
+		   || argv[i][2] != '\0') {
+	    fprintf(stderr, "Unknown option %s\n", argv[i]);
+	    exit(1);
+	}
+	switch (argv[i][1]) {
+	case 'n':
+	    size = (size_t) atol(argv[++i]);
+	    size_set = 1;
+	    break;
+	case 't':
+	    mintime = atof(argv[++i]);
+	    break;
+	case 's':
+	    seed = (unsigned long) atol(argv[++i]);
+	    break;
+	case 'c':
+	    clist = argv[++i];
+	    break;
+	case 'O':
+	    olist = argv[++i];
+	    break;
+	case 'f':
+	    flist = argv[++i];
+	    break;
+	case 'd':
+	    dir = argv[++i];
+	    break;
+	case 'b':
+	    load_baseline(argv[++i]);
+	    break;
+	case 'T':
+	    tolerance = atof(argv[++i]);
+	    break;
+	case 'G':
+	    limit = atof(argv[++i]);
+	    break;
+	default:
+	    fprintf(stderr, "Unknown option %s\n", argv[i]);
+	    exit(1);
+	}
+    }
+
+    if ((proplb = linebreak_new(NULL)) == NULL) {
+	perror("linebreak_new");
+	exit(errno);
+    }
+
+    if (dir != NULL) {
+	for (c = 0; corpora[c].name != NULL; c++) {
+	    if (!selected(clist, corpora[c].name))
+		continue;
+	    generate(c, size, seed, &ustr);
+	    dump(dir, c, &ustr);
+	    free(ustr.str);
+	}
+	linebreak_destroy(proplb);
+	exit(0);
+    }
+
+    if (counters) {
+	i = counter_mode(clist, olist ? olist : "default,uribreak",
+			 flist ? flist : "break,partial,edit",
+			 size_set ? size : 16384, seed, tolerance, limit);
+	linebreak_destroy(proplb);
+	free(baseline);
+	exit(i);
+    }
+
+    printf("# sombok %s unicode %s sea %s\n", SOMBOK_VERSION,
+	   linebreak_unicode_version, linebreak_southeastasian_supported ?
+	   linebreak_southeastasian_supported : "none");
+    printf("# size %lu seed %lu mintime %g\n", (unsigned long) size, seed,
+	   mintime);
+    printf("#corpus\toptions\tfunction\tbytes\tchars\tclusters\tlines\t"
+	   "iterations\tseconds\tMB/s\tns/cluster\tallocs/line\t"
+	   "allocs/cluster\n");
+    fflush(stdout);
+
+    for (c = 0; corpora[c].name != NULL; c++) {
+	if (!selected(clist, corpora[c].name))
+	    continue;
+	generate(c, size, seed, &ustr);
+	in.ustr = &ustr;
+	if ((in.utf8 = sombok_encode_utf8(NULL, &in.utf8len, 0, &ustr))
+	    == NULL) {
+	    perror("sombok_encode_utf8");
+	    exit(errno);
+	}
+
+	for (o = 0; optsets[o].name != NULL; o++) {
+	    if (!selected(olist, optsets[o].name))
+		continue;
+	    lbobj = make_lbobj(o);
+	    if ((gcstr = gcstring_newcopy(&ustr, lbobj)) == NULL) {
+		perror("gcstring_newcopy");
+		exit(errno);
+	    }
+	    clusters = gcstr->gclen;
+	    gcstring_destroy(gcstr);
+
+	    for (f = 0; funcs[f].name != NULL; f++) {
+		if (!selected(flist, funcs[f].name))
+		    continue;
+		iter = 0;
+		allocs = alloc_count();
+		start = linebreak_stats_clock();
+		do {
+		    lines = (*funcs[f].run) (lbobj, &in);
+		    if (lines < 0) {
+			errno = lbobj->errnum ? lbobj->errnum : errno;
+			fprintf(stderr, "%s/%s/%s: %s\n", corpora[c].name,
+				optsets[o].name, funcs[f].name,
+				strerror(errno));
+			exit(1);
+		    }
+		    linebreak_reset(lbobj);
+		    iter++;
+		    elapsed = linebreak_stats_clock() - start;
+		} while (elapsed < mintime);
+		if (0.0 <= allocs)
+		    allocs = (alloc_count() - allocs) / iter;
+
+		printf("%s\t%s\t%s\t%lu\t%lu\t%lu\t%ld\t%lu\t%.6f\t%.3f\t"
+		       "%.2f", corpora[c].name, optsets[o].name,
+		       funcs[f].name, (unsigned long) in.utf8len,
+		       (unsigned long) ustr.len, (unsigned long) clusters,
+		       lines, iter, elapsed,
+		       (double) in.utf8len * iter / elapsed / 1e6,
+		       clusters ? elapsed * 1e9 / iter / clusters : 0.0);
+		if (allocs < 0.0)
+		    printf("\t-\t-\n");
+		else if (lines == 0)
+		    printf("\t-\t%.3f\n", clusters ? allocs / clusters : 0.0);
+		else
+		    printf("\t%.3f\t%.3f\n", allocs / lines,
+			   clusters ? allocs / clusters : 0.0);
+		fflush(stdout);
+	    }
+	    linebreak_destroy(lbobj);
+	}
+	free(in.utf8);
+	free(ustr.str);
+    }
+
+    linebreak_destroy(proplb);
+    exit(0);
+}
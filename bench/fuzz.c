@@ -0,0 +1,1252 @@
+/*
+ * fuzz.c - differential fuzzing of optimized paths of line breaking.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+/*
+ * Usage: fuzz [options]
+ *   -n CASES   number of cases (default 1000).
+ *   -s SEED    seed of first case (default 1).
+ *   -m CHARS   maximum length of text of each case (default 1024).
+ *   -p NAMES   comma-separated paths and checks to test (default all).
+ *   -l         list names of paths and checks then exit.
+ *   -R         test paths also with LINEBREAK_OPTION_NO_FAST_PATH option.
+ *   -a         allocate memory by counting allocator.
+ *   -v         write configuration of each case.
+ *
+ * Each case consists of random text, in which runs of characters are
+ * chosen by line breaking classes with weights, and random configuration:
+ * option bits, colmax, colmin, charmax, built-in callbacks and URI
+ * breaking.  Text is broken by the reference, i.e. linebreak_break() with
+ * LINEBREAK_OPTION_NO_FAST_PATH option, and by each path with the same
+ * configuration but without that option (with -R, also with it, to tell
+ * faults of fast paths from those of the paths themselves).  Broken lines
+ * must be identical.
+ *
+ * Checks compare other functions with their definitions on the same case:
+ *   columns    sombok_columns_utf8() and sombok_truncate_utf8() on UTF-8
+ *              text with malformed bytes, long clusters and custom East
+ *              Asian width, against gcstring_new_from_utf8().
+ *   state      linebreak_break_partial() resumed by linebreak_state_save()
+ *              and linebreak_state_restore() on new object after each
+ *              chunk, against uninterrupted one.  Truncated state must
+ *              be rejected.
+ *   preview    linebreak_break_preview() against first lines by
+ *              linebreak_break().  The last line with ellipsis must be a
+ *              prefix of the original line, the ellipsis and its newline.
+ *
+ * On the first mismatch, the case is reported to standard error and the
+ * program exits with status 1.  It may be reproduced by "-s SEED -n 1"
+ * with the reported seed.  With -a, memory allocated by library must be
+ * released by the end of each case, or it is reported as a mismatch.
+ * Otherwise, CPU time spent by each path is
+ * written as tab-separated values with ratio of time of the reference to
+ * it, i.e. speedup by fast paths.
+ *
+ * If compiled with -DFUZZ_LIBFUZZER and linked with libFuzzer (e.g.
+ * clang -fsanitize=fuzzer), LLVMFuzzerTestOneInput() is defined instead of
+ * main().  Input bytes drive the generator, and mismatch aborts.
+ */
+
+#include <stdio.h>
+#include "sombok.h"
+#include "sombok_constants.h"
+
+#define POOLSIZ (64)
+
+/***
+ *** Pseudo-random numbers.  Bytes of fuzzer input are used first if any.
+ ***/
+
+static unsigned long rngstate;
+static const unsigned char *fuzzdata = NULL;
+static size_t fuzzlen = 0;
+
+static
+unsigned long rnd(unsigned long n)
+{
+    unsigned long r = 0;
+    int i;
+
+    if (n <= 1)
+	return 0;
+    if (fuzzlen) {
+	for (i = 0; i < 4 && fuzzlen; i++, fuzzdata++, fuzzlen--)
+	    r = (r << 8) | *fuzzdata;
+	return r % n;
+    }
+    rngstate = rngstate * 1103515245UL + 12345UL;
+    rngstate &= 0xFFFFFFFFUL;
+    return (rngstate >> 8) % n;
+}
+
+/***
+ *** Text generation.
+ ***/
+
+/* Sample characters of each line breaking class. */
+static struct {
+    unichar_t c[POOLSIZ];
+    size_t len;
+    unsigned long weight;
+} *pools = NULL;
+static propval_t npools;
+
+static
+void init_pools(void)
+{
+    linebreak_t *lbobj;
+    unichar_t c;
+    propval_t lbc;
+    unsigned long seen[256], state = 1;
+
+    for (npools = 0; linebreak_propvals_LB[npools] != NULL; npools++);
+    if ((pools = calloc(npools, sizeof(*pools))) == NULL ||
+	(lbobj = linebreak_new(NULL)) == NULL) {
+	perror("calloc");
+	exit(errno);
+    }
+    memset(seen, 0, sizeof(seen));
+
+    /* Reservoir sampling on BMP, SMP, SIP and SSP except surrogates. */
+    for (c = 0; c < 0xE1000; c++) {
+	if (c == 0xD800)
+	    c = 0xE000;
+	else if (c == 0x40000)
+	    c = 0xE0000;
+	linebreak_charprop(lbobj, c, &lbc, NULL, NULL, NULL);
+	if (npools <= lbc)
+	    continue;
+	seen[lbc]++;
+	if (pools[lbc].len < POOLSIZ)
+	    pools[lbc].c[pools[lbc].len++] = c;
+	else {
+	    state = (state * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+	    if ((state >> 8) % seen[lbc] < POOLSIZ)
+		pools[lbc].c[(state >> 8) % POOLSIZ] = c;
+	}
+    }
+    linebreak_destroy(lbobj);
+
+    for (lbc = 0; lbc < npools; lbc++)
+	pools[lbc].weight = pools[lbc].len ? 2 : 0;
+#define WEIGHT(lbc, w) if (pools[lbc].len) pools[lbc].weight = (w)
+    WEIGHT(LB_AL, 40);
+    WEIGHT(LB_SP, 20);
+    WEIGHT(LB_ID, 10);
+    WEIGHT(LB_CM, 6);
+    WEIGHT(LB_NU, 4);
+    WEIGHT(LB_BA, 4);
+    WEIGHT(LB_SA, 4);
+    WEIGHT(LB_H2, 3);
+    WEIGHT(LB_H3, 3);
+    WEIGHT(LB_LF, 1);
+#undef WEIGHT
+}
+
+static
+void put(unistr_t * text, size_t max, unichar_t c)
+{
+    if (text->len < max)
+	text->str[text->len++] = c;
+}
+
+/*
+ * Generate text of at most max characters.  Runs of one class are put, so
+ * that long unbreakable runs are sometimes made.  Text of only ISO 8859-1
+ * characters is also made to exercise paths specific to it.
+ */
+static
+void gen_text(unistr_t * text, size_t max)
+{
+    unsigned long total = 0, r;
+    size_t n, run, i;
+    propval_t lbc;
+    int latin1;
+
+    text->len = 0;
+    n = rnd(max + 1);
+    latin1 = (rnd(4) == 0);
+    for (lbc = 0; lbc < npools; lbc++)
+	total += pools[lbc].weight;
+
+    while (text->len < n) {
+	run = rnd(16) ? 1 + rnd(4) : 1 + rnd(200);
+	if (latin1) {
+	    r = rnd(10);
+	    for (i = 0; i < run; i++)
+		if (r < 6)
+		    put(text, max, (unichar_t) ('a' + rnd(26)));
+		else if (r < 8)
+		    put(text, max, 0x0020);
+		else if (r < 9)
+		    put(text, max, (unichar_t) (0xA0 + rnd(0x60)));
+		else
+		    put(text, max, (unichar_t) rnd(0x80));
+	    continue;
+	}
+	r = rnd(total);
+	for (lbc = 0; r >= pools[lbc].weight; lbc++)
+	    r -= pools[lbc].weight;
+	for (i = 0; i < run; i++)
+	    put(text, max, pools[lbc].c[rnd(pools[lbc].len)]);
+    }
+}
+
+/***
+ *** Configuration.
+ ***/
+
+static
+linebreak_t *gen_config(char *desc)
+{
+    linebreak_t *lbobj;
+    const char *format, *sizing, *urgent;
+    int uribreak;
+
+    if ((lbobj = linebreak_new(NULL)) == NULL) {
+	perror("linebreak_new");
+	exit(errno);
+    }
+    lbobj->options = (unsigned int) rnd(LINEBREAK_OPTION_NO_FAST_PATH);
+    switch (rnd(4)) {
+    case 0:
+	lbobj->colmax = 0.0;
+	break;
+    case 1:
+	lbobj->colmax = 76.0;
+	break;
+    case 2:
+	lbobj->colmax = (double) (1 + rnd(8));
+	break;
+    default:
+	lbobj->colmax = (double) (1 + rnd(100));
+	break;
+    }
+    if (rnd(4) == 0)
+	lbobj->colmin = (double) rnd((unsigned long) lbobj->colmax + 1);
+    switch (rnd(3)) {
+    case 0:
+	lbobj->charmax = 0;
+	break;
+    case 1:
+	lbobj->charmax = 1 + rnd(16);
+	break;
+    default:
+	lbobj->charmax = LINEBREAK_DEFAULT_CHARMAX;
+	break;
+    }
+
+    switch (rnd(4)) {
+    case 0:
+	format = "NONE";
+	break;
+    case 1:
+	format = "SIMPLE";
+	linebreak_set_format(lbobj, linebreak_format_SIMPLE, NULL);
+	break;
+    case 2:
+	format = "NEWLINE";
+	linebreak_set_format(lbobj, linebreak_format_NEWLINE, NULL);
+	break;
+    default:
+	format = "TRIM";
+	linebreak_set_format(lbobj, linebreak_format_TRIM, NULL);
+	break;
+    }
+    if (rnd(4)) {
+	sizing = "UAX11";
+	linebreak_set_sizing(lbobj, linebreak_sizing_UAX11, NULL);
+    } else
+	sizing = "NONE";
+    switch (rnd(4)) {
+    case 0:
+	urgent = "NONE";
+	break;
+    case 1:
+	urgent = "ABORT";
+	linebreak_set_urgent(lbobj, linebreak_urgent_ABORT, NULL);
+	break;
+    default:
+	urgent = "FORCE";
+	linebreak_set_urgent(lbobj, linebreak_urgent_FORCE, NULL);
+	break;
+    }
+    if ((uribreak = (rnd(4) == 0)))
+	linebreak_add_prep(lbobj, linebreak_prep_URIBREAK, "");
+
+    sprintf(desc, "options=%u colmax=%g colmin=%g charmax=%lu "
+	    "format=%s sizing=%s urgent=%s uribreak=%d",
+	    lbobj->options, lbobj->colmax, lbobj->colmin,
+	    (unsigned long) lbobj->charmax, format, sizing, urgent,
+	    uribreak);
+    return lbobj;
+}
+
+/***
+ *** Paths.  Each returns broken lines terminated by NULL, or NULL on error.
+ ***/
+
+typedef struct {
+    gcstring_t **lines;
+    size_t len, siz;
+} lines_t;
+
+/* Ensure room for one more line and terminator. */
+static
+int grow_lines(lines_t * l)
+{
+    gcstring_t **p;
+
+    if (l->len + 1 < l->siz)
+	return 0;
+    l->siz = l->siz ? l->siz * 2 : 16;
+    if ((p = sombok_realloc(sombok_allocator, l->lines,
+			    sizeof(gcstring_t *) * l->siz)) == NULL)
+	return -1;
+    l->lines = p;
+    l->lines[l->len] = NULL;
+    return 0;
+}
+
+/* Sink: append copy of line to data. */
+static
+int push_line(linebreak_t * lbobj, void *data, gcstring_t * line)
+{
+    lines_t *l = data;
+
+    if (grow_lines(l) != 0 || (line = gcstring_copy(line)) == NULL)
+	return -1;
+    l->lines[l->len++] = line;
+    l->lines[l->len] = NULL;
+    return 0;
+}
+
+/* Append array of lines to l then free the array. */
+static
+int push_lines(lines_t * l, gcstring_t ** lines)
+{
+    size_t i;
+
+    if (lines == NULL)
+	return -1;
+    for (i = 0; lines[i] != NULL; i++) {
+	if (grow_lines(l) != 0) {
+	    while (lines[i] != NULL)
+		gcstring_destroy(lines[i++]);
+	    linebreak_free_result(lines, 0);
+	    return -1;
+	}
+	l->lines[l->len++] = lines[i];
+	l->lines[l->len] = NULL;
+    }
+    linebreak_free_result(lines, 0);
+    return 0;
+}
+
+/* Returns lines terminated by NULL, or frees them and returns NULL if ret
+ * is not 0. */
+static
+gcstring_t **finish_lines(lines_t * l, int ret)
+{
+    if (ret == 0 && grow_lines(l) == 0)
+	return l->lines;
+    if (l->lines != NULL)
+	linebreak_free_result(l->lines, 1);
+    return NULL;
+}
+
+static
+gcstring_t **p_break(linebreak_t * lbobj, unistr_t * text)
+{
+    return linebreak_break(lbobj, text);
+}
+
+static
+gcstring_t **p_break_fast(linebreak_t * lbobj, unistr_t * text)
+{
+    return linebreak_break_fast(lbobj, text);
+}
+
+static
+gcstring_t **p_partial(linebreak_t * lbobj, unistr_t * text)
+{
+    lines_t l = { NULL, 0, 0 };
+    unistr_t chunk;
+    size_t pos = 0, n;
+    int ret = 0;
+
+    while (ret == 0 && pos < text->len) {
+	n = 1 + rnd(rnd(2) ? 16 : text->len - pos);
+	if (text->len - pos < n)
+	    n = text->len - pos;
+	chunk.str = text->str + pos;
+	chunk.len = n;
+	ret = push_lines(&l, linebreak_break_partial(lbobj, &chunk));
+	pos += n;
+    }
+    if (ret == 0)
+	ret = push_lines(&l, linebreak_break_partial(lbobj, NULL));
+    return finish_lines(&l, ret);
+}
+
+static
+gcstring_t **p_sink(linebreak_t * lbobj, unistr_t * text)
+{
+    lines_t l = { NULL, 0, 0 };
+
+    return finish_lines(&l, linebreak_break_to_sink(lbobj, text, push_line,
+						    &l));
+}
+
+static
+gcstring_t **p_from_utf8(linebreak_t * lbobj, unistr_t * text)
+{
+    gcstring_t **ret;
+    char *s;
+    size_t len;
+
+    if ((s = sombok_encode_utf8(NULL, &len, 0, text)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    ret = linebreak_break_from_utf8(lbobj, s, len, SOMBOK_UTF8_CHECK_NONE);
+    sombok_free(sombok_allocator, s);
+    return ret;
+}
+
+static
+gcstring_t **p_parallel(linebreak_t * lbobj, unistr_t * text)
+{
+    return linebreak_break_parallel(lbobj, text, 2 + (int) rnd(3));
+}
+
+static
+gcstring_t **p_iter(linebreak_t * lbobj, unistr_t * text)
+{
+    lines_t l = { NULL, 0, 0 };
+    linebreak_iter_t *it;
+    gcstring_t *line;
+    int ret = 0;
+
+    if ((it = linebreak_iter_new(lbobj, text)) == NULL)
+	return NULL;
+    while (ret == 0 && (line = linebreak_iter_next(it)) != NULL) {
+	ret = push_line(lbobj, &l, line);
+	gcstring_destroy(line);
+    }
+    linebreak_iter_destroy(it);
+    if (lbobj->errnum)
+	ret = -1;
+    return finish_lines(&l, ret);
+}
+
+/* Text is broken by a session while configuration is frozen. */
+static
+gcstring_t **p_session(linebreak_t * lbobj, unistr_t * text)
+{
+    linebreak_t *session;
+    gcstring_t **ret;
+
+    if ((session = linebreak_session_new(lbobj)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    linebreak_update_lbclass(lbobj, 0x0020, LB_AL);
+    if (lbobj->errnum != EBUSY) {
+	fprintf(stderr, "session: configuration was modified\n");
+	linebreak_destroy(session);
+	lbobj->errnum = EINVAL;
+	return NULL;
+    }
+    lbobj->errnum = 0;
+    ret = linebreak_break(session, text);
+    lbobj->errnum = session->errnum;
+    linebreak_destroy(session);
+    return ret;
+}
+
+/* Second result of the same text is taken from cache. */
+static
+gcstring_t **p_cache(linebreak_t * lbobj, unistr_t * text)
+{
+    gcstring_t **ret;
+
+    linebreak_set_cache(lbobj, 1048576);
+    ret = linebreak_break(lbobj, text);
+    if (ret != NULL) {
+	linebreak_free_result(ret, 1);
+	linebreak_reset(lbobj);
+	ret = linebreak_break(lbobj, text);
+    }
+    linebreak_set_cache(lbobj, 0);
+    return ret;
+}
+
+/* Analysis is made by another colmax then laid out. */
+static
+gcstring_t **p_reflow(linebreak_t * lbobj, unistr_t * text)
+{
+    linebreak_analysis_t *analysis;
+    gcstring_t **ret;
+    double colmax = lbobj->colmax;
+
+    lbobj->colmax = (double) rnd(100);
+    analysis = linebreak_analyze(lbobj, text);
+    lbobj->colmax = colmax;
+    if (analysis == NULL)
+	return NULL;
+    ret = linebreak_reflow(lbobj, analysis);
+    linebreak_analysis_destroy(analysis);
+    return ret;
+}
+
+/*
+ * Replace len characters of layout at pos with inslen characters of text
+ * from beg.  Returns 0, or -1 on error.
+ */
+static
+int edit_layout(linebreak_t * lbobj, linebreak_layout_t * layout,
+		size_t pos, size_t len, unistr_t * text, size_t beg,
+		size_t inslen)
+{
+    unistr_t ins;
+
+    ins.str = text->str + beg;
+    ins.len = inslen;
+    return linebreak_layout_edit(lbobj, layout, pos, len, &ins);
+}
+
+/*
+ * A part of text is removed then typed again piece by piece.  Then another
+ * part is replaced with itself.  Text of layout is checked to be the
+ * same: otherwise EFAULT is reported.
+ */
+static
+gcstring_t **p_layout(linebreak_t * lbobj, unistr_t * text)
+{
+    lines_t l = { NULL, 0, 0 };
+    linebreak_layout_t *layout;
+    unistr_t rest;
+    unichar_t *buf;
+    gcstring_t *line;
+    size_t pos, len, beg, n, i;
+    int ret = 0;
+
+    pos = rnd(text->len + 1);
+    len = rnd(text->len - pos + 1);
+    rest.len = text->len - len;
+    if ((rest.str = malloc(sizeof(unichar_t) * (rest.len + 1))) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    memcpy(rest.str, text->str, sizeof(unichar_t) * pos);
+    memcpy(rest.str + pos, text->str + pos + len,
+	   sizeof(unichar_t) * (text->len - pos - len));
+    layout = linebreak_layout_new(lbobj, &rest);
+    free(rest.str);
+    /* Text without the part may have excessive lines: Insert whole. */
+    if (layout == NULL && lbobj->errnum == LINEBREAK_ELONG) {
+	lbobj->errnum = 0;
+	rest.str = NULL;
+	rest.len = 0;
+	pos = 0;
+	len = text->len;
+	layout = linebreak_layout_new(lbobj, &rest);
+    }
+    if (layout == NULL)
+	return NULL;
+    for (beg = pos; ret == 0 && beg < pos + len; beg += n) {
+	n = 1 + rnd(rnd(2) ? 1 : pos + len - beg);
+	if (pos + len - beg < n)
+	    n = pos + len - beg;
+	ret = edit_layout(lbobj, layout, beg, 0, text, beg, n);
+    }
+    if (ret == 0 && linebreak_layout_length(layout) == text->len) {
+	beg = rnd(text->len + 1);
+	n = rnd(text->len - beg + 1);
+	ret = edit_layout(lbobj, layout, beg, n, text, beg, n);
+    }
+
+    if (ret == 0 &&
+	(buf = malloc(sizeof(unichar_t) * (text->len + 1))) != NULL) {
+	if (linebreak_layout_length(layout) != text->len ||
+	    linebreak_layout_text(layout, 0, text->len + 1, buf) !=
+	    text->len ||
+	    (text->len &&
+	     memcmp(buf, text->str, sizeof(unichar_t) * text->len) != 0)) {
+	    lbobj->errnum = EFAULT;
+	    ret = -1;
+	}
+	free(buf);
+    }
+    n = linebreak_layout_nlines(layout);
+    for (i = 0; ret == 0 && (line = linebreak_layout_line(layout, i)) !=
+	 NULL; i++)
+	ret = push_line(lbobj, &l, line);
+    if (ret == 0 && i != n) {
+	lbobj->errnum = EFAULT;
+	ret = -1;
+    }
+    linebreak_layout_destroy(layout);
+    return finish_lines(&l, ret);
+}
+
+/*
+ * Result of paths with "whole" flag shall be the same as linebreak_break().
+ * Others are compared with the same path by the reference, because
+ * results of linebreak_break_partial() may depend on how input is
+ * divided, e.g. by small charmax, and linebreak_break_fast() gives an
+ * empty line formatted at end of empty input.
+ */
+static struct {
+    const char *name;
+    gcstring_t **(*run) (linebreak_t *, unistr_t *);
+    int whole;
+    double time;
+    unsigned long cases;
+} paths[] = {
+    {"break", p_break, 1, 0.0, 0},
+    {"break_fast", p_break_fast, 0, 0.0, 0},
+    {"partial", p_partial, 0, 0.0, 0},
+    {"sink", p_sink, 1, 0.0, 0},
+    {"from_utf8", p_from_utf8, 1, 0.0, 0},
+    {"parallel", p_parallel, 1, 0.0, 0},
+    {"session", p_session, 1, 0.0, 0},
+    {"iter", p_iter, 1, 0.0, 0},
+    {"cache", p_cache, 1, 0.0, 0},
+    {"reflow", p_reflow, 1, 0.0, 0},
+    {"layout", p_layout, 1, 0.0, 0},
+    {NULL, NULL, 0, 0.0, 0}
+};
+
+static double reftime = 0.0;
+
+/***
+ *** Comparison.
+ ***/
+
+static
+void write_line(FILE * fp, const char *label, gcstring_t * line)
+{
+    unistr_t u;
+    size_t i;
+
+    fprintf(fp, "  %s:", label);
+    if (line == NULL) {
+	fprintf(fp, " (none)\n");
+	return;
+    }
+    u.str = line->str;
+    u.len = line->len;
+    for (i = 0; i < u.len; i++)
+	fprintf(fp, " %04lX", (unsigned long) u.str[i]);
+    fprintf(fp, "\n");
+}
+
+/*
+ * Compare lines.  Returns 0 if they are identical, otherwise reports
+ * difference and returns -1.
+ */
+static
+int compare(const char *name, gcstring_t ** expected, int experr,
+	    gcstring_t ** got, int goterr)
+{
+    size_t i, j;
+
+    if (expected == NULL || got == NULL) {
+	if (expected == NULL && got == NULL && experr == goterr)
+	    return 0;
+	fprintf(stderr, "%s: errnum %d, expected %d\n", name,
+		got == NULL ? goterr : 0, expected == NULL ? experr : 0);
+	return -1;
+    }
+    for (i = 0; expected[i] != NULL && got[i] != NULL; i++) {
+	if (expected[i]->len != got[i]->len ||
+	    expected[i]->gclen != got[i]->gclen ||
+	    (got[i]->len != 0 &&
+	     memcmp(expected[i]->str, got[i]->str,
+		    sizeof(unichar_t) * got[i]->len) != 0))
+	    break;
+	for (j = 0; j < got[i]->gclen; j++)
+	    if (expected[i]->gcstr[j].len != got[i]->gcstr[j].len)
+		break;
+	if (j < got[i]->gclen)
+	    break;
+    }
+    if (expected[i] == NULL && got[i] == NULL)
+	return 0;
+    fprintf(stderr, "%s: line %lu differs\n", name, (unsigned long) i);
+    write_line(stderr, "expected", expected[i]);
+    write_line(stderr, "got", got[i]);
+    return -1;
+}
+
+/***
+ *** Checks.  Each returns 0, or reports mismatch and returns -1.
+ ***/
+
+/* Append bytes to buf of which length is *lenp. */
+static
+void put_bytes(char *buf, size_t * lenp, const char *bytes, size_t len)
+{
+    memcpy(buf + *lenp, bytes, len);
+    *lenp += len;
+}
+
+/*
+ * Compare columns and truncation of UTF-8 text.  Text is encoded, then
+ * malformed bytes and a cluster of hundreds of combining marks, longer
+ * than buffer of sombok_columns_utf8(), may be inserted.  East Asian
+ * width of some characters may be customized.
+ */
+static
+int c_columns(linebreak_t * lbobj, unistr_t * text)
+{
+    linebreak_t *obj;
+    gcstring_t *gcstr = NULL, *pre = NULL;
+    char *utf8, *buf = NULL;
+    size_t utf8len, len, i, n, maxcols, cols, got, gotcols, end, k;
+    int ret = -1;
+
+    if ((obj = linebreak_copy(lbobj)) == NULL ||
+	(utf8 = sombok_encode_utf8(NULL, &utf8len, 0, text)) == NULL) {
+	perror("columns");
+	exit(errno);
+    }
+    if (rnd(2))
+	for (i = rnd(8); 0 < i; i--)
+	    linebreak_update_eawidth(obj, text->len ?
+				     text->str[rnd(text->len)] : 0x00A1,
+				     rnd(2) ? EA_F : EA_N);
+    n = rnd(4) ? 0 : 200 + rnd(200);
+    if ((buf = malloc(utf8len * 2 + n * 2 + 2)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    for (i = 0, len = 0; i <= utf8len; i++) {
+	if (i == utf8len / 2 && n) {
+	    put_bytes(buf, &len, "a", 1);
+	    for (k = 0; k < n; k++)
+		put_bytes(buf, &len, "\xCC\x81", 2);
+	}
+	if (rnd(32) == 0)
+	    buf[len++] = (char) (0x80 + rnd(0x80));
+	if (i < utf8len)
+	    buf[len++] = utf8[i];
+    }
+    sombok_free(sombok_allocator, utf8);
+    if (rnd(4) == 0) {
+	linebreak_destroy(obj);
+	obj = NULL;
+    }
+
+    if ((gcstr = gcstring_new_from_utf8(buf, len, SOMBOK_UTF8_CHECK_NONE,
+					obj)) == NULL) {
+	perror("gcstring_new_from_utf8");
+	exit(errno);
+    }
+    cols = gcstring_columns(gcstr);
+    if ((got = sombok_columns_utf8(obj, buf, len)) != cols) {
+	fprintf(stderr, "columns: %lu columns, expected %lu\n",
+		(unsigned long) got, (unsigned long) cols);
+	goto out;
+    }
+
+    maxcols = rnd(cols + 2);
+    for (i = 0, n = 0, end = 0; i < gcstr->gclen; i++) {
+	if (maxcols < n + gcstr->gcstr[i].col)
+	    break;
+	n += gcstr->gcstr[i].col;
+	end = gcstr->gcstr[i].idx + gcstr->gcstr[i].len;
+    }
+    got = sombok_truncate_utf8(obj, buf, len, maxcols, &gotcols);
+    if ((pre = gcstring_new_from_utf8(buf, got, SOMBOK_UTF8_CHECK_NONE,
+				      obj)) == NULL) {
+	perror("gcstring_new_from_utf8");
+	exit(errno);
+    }
+    if (gotcols != n || pre->len != end ||
+	(end != 0 &&
+	 memcmp(pre->str, gcstr->str, sizeof(unichar_t) * end) != 0)) {
+	fprintf(stderr, "columns: truncated by %lu columns to %lu "
+		"characters and %lu columns, expected %lu and %lu\n",
+		(unsigned long) maxcols, (unsigned long) pre->len,
+		(unsigned long) gotcols, (unsigned long) end,
+		(unsigned long) n);
+	goto out;
+    }
+    ret = 0;
+
+  out:
+    gcstring_destroy(pre);
+    gcstring_destroy(gcstr);
+    free(buf);
+    linebreak_destroy(obj);
+    return ret;
+}
+
+/*
+ * Break text by chunks ending at ends[0..nends) using copy of lbobj.  If
+ * resume is set, state is saved after each chunk and restored into
+ * another copy, which breaks the rest.  Truncated state saved at random
+ * chunk must be rejected with EINVAL.  Returns lines, or NULL with error
+ * number stored into *errp.
+ */
+static
+gcstring_t **state_run(linebreak_t * lbobj, unistr_t * text, size_t * ends,
+		       size_t nends, int resume, int *errp)
+{
+    lines_t l = { NULL, 0, 0 };
+    linebreak_t *obj, *newobj;
+    unistr_t chunk;
+    char *data;
+    size_t i, k, pos = 0, len, trunc = rnd(nends + 1);
+    int ret = 0;
+
+    if ((obj = linebreak_copy(lbobj)) == NULL) {
+	perror("linebreak_copy");
+	exit(errno);
+    }
+    for (i = 0; ret == 0 && i <= nends; i++) {
+	chunk.str = text->str + pos;
+	chunk.len = (i < nends) ? ends[i] - pos : 0;
+	ret = push_lines(&l, linebreak_break_partial(obj, (i < nends) ?
+						      &chunk : NULL));
+	if (ret != 0 || nends <= i)
+	    continue;
+	pos = ends[i];
+	if (!resume)
+	    continue;
+
+	if ((data = linebreak_state_save(obj, &len)) == NULL) {
+	    ret = -1;
+	    continue;
+	}
+	for (k = 0; i == trunc && ret == 0 && k < len; k++) {
+	    if ((newobj = linebreak_copy(lbobj)) == NULL) {
+		perror("linebreak_copy");
+		exit(errno);
+	    }
+	    if (linebreak_state_restore(newobj, data, k) == 0 ||
+		newobj->errnum != EINVAL) {
+		fprintf(stderr, "state: state truncated to %lu of %lu "
+			"bytes was not rejected\n", (unsigned long) k,
+			(unsigned long) len);
+		obj->errnum = EINVAL;
+		ret = -1;
+	    }
+	    linebreak_destroy(newobj);
+	}
+	if ((newobj = linebreak_copy(lbobj)) == NULL) {
+	    perror("linebreak_copy");
+	    exit(errno);
+	}
+	if (ret == 0 && linebreak_state_restore(newobj, data, len) != 0) {
+	    obj->errnum = newobj->errnum;
+	    ret = -1;
+	}
+	sombok_free(obj->allocator, data);
+	linebreak_destroy(obj);
+	obj = newobj;
+    }
+    *errp = obj->errnum;
+    linebreak_destroy(obj);
+    return finish_lines(&l, ret);
+}
+
+static
+int c_state(linebreak_t * lbobj, unistr_t * text)
+{
+    gcstring_t **expected, **got;
+    size_t *ends, nends = 0, pos = 0;
+    unsigned long state;
+    int experr, goterr, ret;
+
+    if ((ends = malloc(sizeof(size_t) * (text->len + 1))) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    while (pos < text->len) {
+	pos += 1 + rnd(rnd(2) ? 16 : text->len - pos);
+	if (text->len < pos)
+	    pos = text->len;
+	ends[nends++] = pos;
+    }
+
+    state = rngstate;
+    expected = state_run(lbobj, text, ends, nends, 0, &experr);
+    rngstate = state;
+    got = state_run(lbobj, text, ends, nends, 1, &goterr);
+    ret = compare("state", expected, experr, got, goterr);
+    if (expected != NULL)
+	linebreak_free_result(expected, 1);
+    if (got != NULL)
+	linebreak_free_result(got, 1);
+    free(ends);
+    return ret;
+}
+
+/* Does str[0..len) of line b equal that of line a at offset off? */
+static
+int same_chars(gcstring_t * a, size_t off, gcstring_t * b, size_t len)
+{
+    return (off + len <= a->len && len <= b->len &&
+	    (len == 0 || memcmp(a->str + off, b->str,
+				sizeof(unichar_t) * len) == 0));
+}
+
+static
+int c_preview(linebreak_t * lbobj, unistr_t * text)
+{
+    gcstring_t **full, **got, *ellipsis = NULL, *line;
+    unistr_t u;
+    unichar_t ell[3] = { 0x002E, 0x002E, 0x002E };
+    size_t nfull, ngot, maxlines, i, eol, pre, tail;
+    propval_t lbc;
+    int ret = -1;
+
+    /* Preview is not defined if breaking fails. */
+    if ((full = linebreak_break(lbobj, text)) == NULL)
+	return 0;
+    linebreak_reset(lbobj);
+    for (nfull = 0; full[nfull] != NULL; nfull++);
+
+    maxlines = 1 + rnd(nfull + 1);
+    if (rnd(2)) {
+	u.str = ell;
+	u.len = rnd(2) ? 3 : 1;
+	if (u.len == 1)
+	    ell[0] = 0x2026;
+	if ((ellipsis = gcstring_newcopy(&u, lbobj)) == NULL) {
+	    perror("gcstring_newcopy");
+	    exit(errno);
+	}
+    }
+    if ((got = linebreak_break_preview(lbobj, text, maxlines, ellipsis)) ==
+	NULL) {
+	fprintf(stderr, "preview: errnum %d\n", lbobj->errnum);
+	goto out;
+    }
+    for (ngot = 0; got[ngot] != NULL; ngot++);
+    if (ngot != (nfull < maxlines ? nfull : maxlines)) {
+	fprintf(stderr, "preview: %lu lines by %lu of %lu\n",
+		(unsigned long) ngot, (unsigned long) maxlines,
+		(unsigned long) nfull);
+	goto out;
+    }
+
+    for (i = 0; i < ngot; i++) {
+	line = full[i];
+	if (i + 1 < maxlines || nfull <= maxlines || ellipsis == NULL) {
+	    if (got[i]->len == line->len &&
+		same_chars(line, 0, got[i], line->len))
+		continue;
+	} else {
+	    /* truncated line, ellipsis and newline of original line. */
+	    for (eol = line->gclen; 0 < eol; eol--)
+		if ((lbc = gcstring_lbclass(line, eol - 1)) != LB_BK &&
+		    lbc != LB_CR && lbc != LB_LF && lbc != LB_NL)
+		    break;
+	    eol = (eol < line->gclen) ? line->gcstr[eol].idx : line->len;
+	    tail = line->len - eol;
+	    if (ellipsis->len + tail <= got[i]->len) {
+		pre = got[i]->len - ellipsis->len - tail;
+		u.str = got[i]->str + pre;
+		if (pre <= eol && same_chars(line, 0, got[i], pre) &&
+		    memcmp(u.str, ellipsis->str,
+			   sizeof(unichar_t) * ellipsis->len) == 0 &&
+		    (tail == 0 ||
+		     memcmp(u.str + ellipsis->len, line->str + eol,
+			    sizeof(unichar_t) * tail) == 0))
+		    continue;
+	    }
+	}
+	fprintf(stderr, "preview: line %lu of %lu differs\n",
+		(unsigned long) i, (unsigned long) maxlines);
+	write_line(stderr, "original", line);
+	write_line(stderr, "got", got[i]);
+	goto out;
+    }
+    ret = 0;
+
+  out:
+    if (got != NULL)
+	linebreak_free_result(got, 1);
+    linebreak_free_result(full, 1);
+    gcstring_destroy(ellipsis);
+    return ret;
+}
+
+static struct {
+    const char *name;
+    int (*run) (linebreak_t *, unistr_t *);
+    double time;
+    unsigned long cases;
+} checks[] = {
+    {"columns", c_columns, 0.0, 0},
+    {"state", c_state, 0.0, 0},
+    {"preview", c_preview, 0.0, 0},
+    {NULL, NULL, 0.0, 0}
+};
+
+/***
+ *** Cases.
+ ***/
+
+static unistr_t text = { NULL, 0 };
+static size_t maxlen = 1024;
+static char *plist = NULL;
+static int verbose = 0;
+static int refonly = 0;
+
+/*
+ * Counting allocator: data points to number of blocks alive.
+ */
+static
+void *count_malloc(void *data, size_t size)
+{
+    void *p;
+
+    if ((p = malloc(size)) != NULL)
+	(*(long *) data)++;
+    return p;
+}
+
+static
+void *count_realloc(void *data, void *ptr, size_t size)
+{
+    void *p;
+
+    if ((p = realloc(ptr, size)) != NULL && ptr == NULL)
+	(*(long *) data)++;
+    return p;
+}
+
+static
+void count_free(void *data, void *ptr)
+{
+    if (ptr != NULL)
+	(*(long *) data)--;
+    free(ptr);
+}
+
+static long nblocks = 0;
+static sombok_allocator_t counter = {
+    count_malloc, count_realloc, count_free, &nblocks
+};
+
+static
+int selected(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    if (list == NULL)
+	return 1;
+    for (p = list; *p; p++) {
+	if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')
+	    && (p == list || p[-1] == ','))
+	    return 1;
+    }
+    return 0;
+}
+
+/*
+ * Run one case.  Returns 0, or -1 on mismatch.
+ */
+static
+int run_case(unsigned long seed)
+{
+    linebreak_t *ref, *lbobj;
+    gcstring_t **expected, **pexpected, **got;
+    int referr, perr;
+    char desc[256];
+    unsigned long state;
+    const unsigned char *data;
+    size_t datalen;
+    double t;
+    int k, ret = 0;
+
+    if (pools == NULL) {
+	init_pools();
+	if ((text.str = malloc(sizeof(unichar_t) * (maxlen + 1))) == NULL) {
+	    perror("malloc");
+	    exit(errno);
+	}
+    }
+    rngstate = seed;
+    lbobj = gen_config(desc);
+    gen_text(&text, maxlen);
+    if (verbose)
+	printf("# seed %lu length %lu %s\n", seed, (unsigned long) text.len,
+	       desc);
+
+    if ((ref = linebreak_copy(lbobj)) == NULL) {
+	perror("linebreak_copy");
+	exit(errno);
+    }
+    ref->options |= LINEBREAK_OPTION_NO_FAST_PATH;
+    t = linebreak_stats_clock();
+    expected = linebreak_break(ref, &text);
+    reftime += linebreak_stats_clock() - t;
+    referr = ref->errnum;
+
+    for (k = 0; ret == 0 && paths[k].name != NULL; k++) {
+	if (!selected(plist, paths[k].name))
+	    continue;
+	linebreak_reset(lbobj);
+	lbobj->errnum = 0;
+	if (refonly)
+	    lbobj->options |= LINEBREAK_OPTION_NO_FAST_PATH;
+
+	/* Both shall make the same random choices. */
+	state = rngstate;
+	data = fuzzdata;
+	datalen = fuzzlen;
+	if (paths[k].whole) {
+	    pexpected = expected;
+	    perr = referr;
+	} else {
+	    linebreak_reset(ref);
+	    ref->errnum = 0;
+	    pexpected = (*paths[k].run) (ref, &text);
+	    perr = ref->errnum;
+	    rngstate = state;
+	    fuzzdata = data;
+	    fuzzlen = datalen;
+	}
+
+	t = linebreak_stats_clock();
+	got = (*paths[k].run) (lbobj, &text);
+	paths[k].time += linebreak_stats_clock() - t;
+	paths[k].cases++;
+	if ((ret = compare(paths[k].name, pexpected, perr, got,
+			   lbobj->errnum)) != 0)
+	    fprintf(stderr, "seed %lu length %lu %s\n", seed,
+		    (unsigned long) text.len, desc);
+	if (got != NULL)
+	    linebreak_free_result(got, 1);
+	if (pexpected != expected && pexpected != NULL)
+	    linebreak_free_result(pexpected, 1);
+    }
+
+    for (k = 0; ret == 0 && checks[k].name != NULL; k++) {
+	if (!selected(plist, checks[k].name))
+	    continue;
+	linebreak_reset(lbobj);
+	lbobj->errnum = 0;
+	if (refonly)
+	    lbobj->options |= LINEBREAK_OPTION_NO_FAST_PATH;
+	t = linebreak_stats_clock();
+	ret = (*checks[k].run) (lbobj, &text);
+	checks[k].time += linebreak_stats_clock() - t;
+	checks[k].cases++;
+	if (ret != 0)
+	    fprintf(stderr, "seed %lu length %lu %s\n", seed,
+		    (unsigned long) text.len, desc);
+    }
+
+    if (expected != NULL)
+	linebreak_free_result(expected, 1);
+    linebreak_destroy(ref);
+    linebreak_destroy(lbobj);
+    return ret;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+    fuzzdata = data;
+    fuzzlen = size;
+    if (run_case((unsigned long) size) != 0)
+	abort();
+    return 0;
+}
+
+#else				/* FUZZ_LIBFUZZER */
+
+/***
+ *** Main.
+ ***/
+
+int main(int argc, char **argv)
+{
+    unsigned long seed = 1, ncases = 1000, n;
+    int i, k;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-l") == 0) {
+	    for (k = 0; paths[k].name != NULL; k++)
+		printf("%s\n", paths[k].name);
+	    for (k = 0; checks[k].name != NULL; k++)
+		printf("%s\n", checks[k].name);
+	    exit(0);
+	} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+	    ncases = (unsigned long) atol(argv[++i]);
+	else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+	    seed = (unsigned long) atol(argv[++i]);
+	else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+	    maxlen = (size_t) atol(argv[++i]);
+	else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+	    plist = argv[++i];
+	else if (strcmp(argv[i], "-R") == 0)
+	    refonly = 1;
+	else if (strcmp(argv[i], "-a") == 0)
+	    sombok_set_allocator(&counter);
+	else if (strcmp(argv[i], "-v") == 0)
+	    verbose = 1;
+	else {
+	    fprintf(stderr, "Unknown option %s\n", argv[i]);
+	    exit(1);
+	}
+    }
+
+    printf("# sombok %s unicode %s\n", SOMBOK_VERSION,
+	   linebreak_unicode_version);
+    printf("# cases %lu seed %lu maxlen %lu\n", ncases, seed,
+	   (unsigned long) maxlen);
+    fflush(stdout);
+    for (n = 0; n < ncases; n++) {
+	if (run_case(seed + n) != 0)
+	    exit(1);
+	if (nblocks != 0) {
+	    fprintf(stderr, "LEAK seed %lu: %ld blocks\n", seed + n,
+		    nblocks);
+	    exit(1);
+	}
+    }
+
+    printf("#path\tcases\tseconds\tratio\n");
+    printf("reference\t%lu\t%.3f\t%.2f\n", ncases, reftime, 1.0);
+    for (k = 0; paths[k].name != NULL; k++) {
+	if (!selected(plist, paths[k].name))
+	    continue;
+	printf("%s\t%lu\t%.3f\t", paths[k].name, paths[k].cases,
+	       paths[k].time);
+	if (0.0 < paths[k].time)
+	    printf("%.2f\n", reftime / paths[k].time);
+	else
+	    printf("-\n");
+    }
+    for (k = 0; checks[k].name != NULL; k++) {
+	if (!selected(plist, checks[k].name))
+	    continue;
+	printf("%s\t%lu\t%.3f\t-\n", checks[k].name, checks[k].cases,
+	       checks[k].time);
+    }
+
+    free(text.str);
+    free(pools);
+    exit(0);
+}
+
+#endif				/* FUZZ_LIBFUZZER */
@@ -0,0 +1,374 @@
+/*
+ * micro.c - microbenchmarks of kernels of line breaking.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+/*
+ * Usage: micro [options]
+ *   -n ELEMENTS number of elements processed by one run (default 65536).
+ *   -t SECONDS  minimum time of each measurement (default 0.5).
+ *   -k NAMES    comma-separated kernels to measure (default all).
+ *   -l          list names of kernels then exit.
+ *
+ * Each kernel is run repeatedly, and the fastest run is reported as
+ * nanoseconds and CPU cycles per element.  Cycles are counted by
+ * perf_event_open(2) where available and permitted; otherwise "-" is
+ * written in place of them.
+ */
+
+#include <stdio.h>
+#include "sombok.h"
+#include "sombok_constants.h"
+#include "perfcount.h"
+
+#define MIN_SAMPLES (5)
+
+/***
+ *** Inputs.
+ ***/
+
+static unsigned long rngstate = 1;
+
+static
+unsigned long rnd(unsigned long n)
+{
+    rngstate = rngstate * 1103515245UL + 12345UL;
+    rngstate &= 0xFFFFFFFFUL;
+    return (rngstate >> 8) % n;
+}
+
+/* Blocks of characters mixed in input, with relative frequencies. */
+static struct {
+    unichar_t beg, end;
+    unsigned long freq;
+} blocks[] = {
+    {0x0061, 0x007A, 40},	/* Latin small letters */
+    {0x0020, 0x0020, 12},	/* SPACE */
+    {0x0021, 0x0040, 4},	/* ASCII punctuations and digits */
+    {0x00C0, 0x024F, 3},	/* Latin-1 and Latin extended */
+    {0x0915, 0x094D, 4},	/* Devanagari */
+    {0x0E01, 0x0E4E, 4},	/* Thai */
+    {0x3041, 0x30FF, 6},	/* Kana */
+    {0x4E00, 0x9FFF, 12},	/* CJK ideographs */
+    {0xAC00, 0xD7A3, 6},	/* Hangul syllables */
+    {0x1F300, 0x1F64F, 2},	/* emoji */
+    {0, 0, 0}
+};
+
+static
+unichar_t random_char(void)
+{
+    unsigned long total = 0, r;
+    int i;
+
+    for (i = 0; blocks[i].freq; i++)
+	total += blocks[i].freq;
+    r = rnd(total);
+    for (i = 0; r >= blocks[i].freq; i++)
+	r -= blocks[i].freq;
+    return blocks[i].beg +
+	(unichar_t) rnd(blocks[i].end - blocks[i].beg + 1);
+}
+
+static int cycfd = -1;
+static size_t nelem = 65536;
+static unistr_t text = { NULL, 0 };
+static char *utf8 = NULL;
+static size_t utf8len;
+static gcstring_t *gctext = NULL, *gcunit = NULL;
+static linebreak_t *lbobj = NULL, *maplb = NULL;
+static propval_t nlbc;
+
+/***
+ *** Kernels.  Each performs one run and returns number of elements.
+ ***/
+
+static volatile unsigned long sink;
+
+static
+size_t k_charprop(void)
+{
+    propval_t lbc, eaw, gbc, scr;
+    unsigned long s = 0;
+    size_t i;
+
+    for (i = 0; i < text.len; i++) {
+	linebreak_charprop(lbobj, text.str[i], &lbc, &eaw, &gbc, &scr);
+	s += lbc + eaw + gbc + scr;
+    }
+    sink = s;
+    return text.len;
+}
+
+static
+size_t k_charprop_map(void)
+{
+    propval_t lbc, eaw, gbc, scr;
+    unsigned long s = 0;
+    size_t i;
+
+    for (i = 0; i < text.len; i++) {
+	linebreak_charprop(maplb, text.str[i], &lbc, &eaw, &gbc, &scr);
+	s += lbc + eaw + gbc + scr;
+    }
+    sink = s;
+    return text.len;
+}
+
+static
+size_t k_gcstring_new(void)
+{
+    gcstring_t *gcstr;
+
+    if ((gcstr = gcstring_newcopy(&text, lbobj)) == NULL)
+	return 0;
+    sink = gcstr->gclen;
+    gcstring_destroy(gcstr);
+    return text.len;
+}
+
+static
+size_t k_lbrule(void)
+{
+    propval_t b, a;
+    unsigned long s = 0;
+    size_t n = 0;
+
+    while (n < nelem)
+	for (b = 0; b < nlbc; b++)
+	    for (a = 0; a < nlbc; a++, n++)
+		s += linebreak_get_lbrule(lbobj, b, a);
+    sink = s;
+    return n;
+}
+
+static
+size_t k_decode_utf8(void)
+{
+    unistr_t unistr = { NULL, 0 };
+
+    if (sombok_decode_utf8(&unistr, 0, utf8, utf8len,
+			   SOMBOK_UTF8_CHECK_NONE) == NULL)
+	return 0;
+    sink = unistr.len;
+    free(unistr.str);
+    return text.len;
+}
+
+static
+size_t k_encode_utf8(void)
+{
+    char *s;
+    size_t len;
+
+    if ((s = sombok_encode_utf8(NULL, &len, 0, &text)) == NULL)
+	return 0;
+    sink = len;
+    free(s);
+    return text.len;
+}
+
+static
+size_t k_gcstring_append(void)
+{
+    gcstring_t *gcstr;
+    size_t i;
+
+    if ((gcstr = gcstring_new(NULL, lbobj)) == NULL)
+	return 0;
+    for (i = 0; i < nelem; i++)
+	if (gcstring_append(gcstr, gcunit) == NULL)
+	    return 0;
+    sink = gcstr->gclen;
+    gcstring_destroy(gcstr);
+    return nelem;
+}
+
+static
+size_t k_gcstring_substr(void)
+{
+    gcstring_t *gcstr;
+    size_t i, n = 0;
+
+    for (i = 0; i + 16 <= gctext->gclen; i += 7, n++) {
+	if ((gcstr = gcstring_substr(gctext, (int) i, 16)) == NULL)
+	    return 0;
+	sink = gcstr->len;
+	gcstring_destroy(gcstr);
+    }
+    return n;
+}
+
+static struct {
+    const char *name;
+    size_t (*run) (void);
+    size_t mapsiz;
+} kernels[] = {
+    {"charprop", k_charprop, 0},
+    {"charprop_map16", k_charprop_map, 16},
+    {"charprop_map256", k_charprop_map, 256},
+    {"charprop_map4096", k_charprop_map, 4096},
+    {"gcstring_new", k_gcstring_new, 0},
+    {"lbrule", k_lbrule, 0},
+    {"decode_utf8", k_decode_utf8, 0},
+    {"encode_utf8", k_encode_utf8, 0},
+    {"gcstring_append", k_gcstring_append, 0},
+    {"gcstring_substr", k_gcstring_substr, 0},
+    {NULL, NULL, 0}
+};
+
+/*
+ * Custom map with n single-character entries spread over the range of
+ * input characters.
+ */
+static
+linebreak_t *make_maplb(size_t n)
+{
+    linebreak_t *obj;
+    size_t i;
+
+    if ((obj = linebreak_new(NULL)) == NULL)
+	return NULL;
+    for (i = 0; i < n; i++)
+	linebreak_update_lbclass(obj, (unichar_t) (i * (0x20000 / n)),
+				 (i & 1) ? LB_AL : LB_ID);
+    return obj;
+}
+
+/***
+ *** Main.
+ ***/
+
+static
+int selected(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    if (list == NULL)
+	return 1;
+    for (p = list; *p; p++) {
+	if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')
+	    && (p == list || p[-1] == ','))
+	    return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    double mintime = 0.5, total, t, c, best_t, best_c;
+    char *klist = NULL;
+    unichar_t u = 0x0061;
+    unistr_t unit;
+    size_t i, n, samples;
+    int k;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-l") == 0) {
+	    for (k = 0; kernels[k].name != NULL; k++)
+		printf("%s\n", kernels[k].name);
+	    exit(0);
+	} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+	    nelem = (size_t) atol(argv[++i]);
+	else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+	    mintime = atof(argv[++i]);
+	else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+	    klist = argv[++i];
+	else {
+	    fprintf(stderr, "Unknown option %s\n", argv[i]);
+	    exit(1);
+	}
+    }
+    if (nelem == 0)
+	nelem = 1;
+
+    /* Prepare inputs. */
+    if ((lbobj = linebreak_new(NULL)) == NULL ||
+	(text.str = malloc(sizeof(unichar_t) * nelem)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    for (text.len = 0; text.len < nelem; text.len++)
+	text.str[text.len] = random_char();
+    unit.str = &u;
+    unit.len = 1;
+    if ((utf8 = sombok_encode_utf8(NULL, &utf8len, 0, &text)) == NULL ||
+	(gctext = gcstring_newcopy(&text, lbobj)) == NULL ||
+	(gcunit = gcstring_newcopy(&unit, lbobj)) == NULL) {
+	perror("malloc");
+	exit(errno);
+    }
+    for (nlbc = 0; linebreak_propvals_LB[nlbc] != NULL; nlbc++);
+
+    cycfd = perfcount_open(PERFCOUNT_CYCLES);
+
+    printf("# sombok %s unicode %s cycles %s\n", SOMBOK_VERSION,
+	   linebreak_unicode_version,
+	   perfcount_read(cycfd) < 0.0 ? "unavailable" : "perf_event");
+    printf("# elements %lu mintime %g\n", (unsigned long) nelem, mintime);
+    printf("#kernel\telements\tsamples\tns/element\tcycles/element\n");
+    fflush(stdout);
+
+    for (k = 0; kernels[k].name != NULL; k++) {
+	if (!selected(klist, kernels[k].name))
+	    continue;
+	if (kernels[k].mapsiz &&
+	    (maplb = make_maplb(kernels[k].mapsiz)) == NULL) {
+	    perror("linebreak_new");
+	    exit(errno);
+	}
+
+	/* warm up. */
+	(*kernels[k].run) ();
+
+	best_t = best_c = -1.0;
+	total = 0.0;
+	n = 0;
+	for (samples = 0; samples < MIN_SAMPLES || total < mintime;
+	     samples++) {
+	    c = perfcount_read(cycfd);
+	    t = linebreak_stats_clock();
+	    n = (*kernels[k].run) ();
+	    t = linebreak_stats_clock() - t;
+	    if (0.0 <= c)
+		c = perfcount_read(cycfd) - c;
+	    if (n == 0) {
+		perror(kernels[k].name);
+		exit(1);
+	    }
+	    total += t;
+	    if (best_t < 0.0 || t < best_t)
+		best_t = t;
+	    if (0.0 <= c && (best_c < 0.0 || c < best_c))
+		best_c = c;
+	}
+
+	printf("%s\t%lu\t%lu\t%.3f\t", kernels[k].name, (unsigned long) n,
+	       (unsigned long) samples, best_t * 1e9 / n);
+	if (best_c < 0.0)
+	    printf("-\n");
+	else
+	    printf("%.2f\n", best_c / n);
+	fflush(stdout);
+
+	if (maplb != NULL) {
+	    linebreak_destroy(maplb);
+	    maplb = NULL;
+	}
+    }
+
+    gcstring_destroy(gcunit);
+    gcstring_destroy(gctext);
+    free(utf8);
+    free(text.str);
+    linebreak_destroy(lbobj);
+    exit(0);
+}
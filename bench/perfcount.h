@@ -0,0 +1,64 @@
+/*
+ * perfcount.h - hardware event counters for benchmarks.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+#ifndef _PERFCOUNT_H_
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_SYS_SYSCALL_H)
+#    include <linux/perf_event.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#    ifdef __NR_perf_event_open
+#        define USE_PERF_EVENT 1
+#    endif
+#endif
+
+#define PERFCOUNT_CYCLES (0)
+#define PERFCOUNT_INSTRUCTIONS (1)
+
+/*
+ * Open counter of user-space CPU cycles or instructions of this process by
+ * perf_event_open(2).  Returns -1 if it is not available or not permitted.
+ */
+static
+int perfcount_open(int event)
+{
+#ifdef USE_PERF_EVENT
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = (event == PERFCOUNT_INSTRUCTIONS) ?
+	PERF_COUNT_HW_INSTRUCTIONS : PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif				/* USE_PERF_EVENT */
+}
+
+/* Returns events counted so far, or -1 if counter is not available. */
+static
+double perfcount_read(int fd)
+{
+#ifdef USE_PERF_EVENT
+    unsigned long long count;
+
+    if (0 <= fd && read(fd, &count, sizeof(count)) == sizeof(count))
+	return (double) count;
+#endif				/* USE_PERF_EVENT */
+    return -1.0;
+}
+
+#define _PERFCOUNT_H_
+#endif				/* _PERFCOUNT_H_ */
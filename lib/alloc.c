@@ -0,0 +1,103 @@
+/*
+ * alloc.c - custom memory allocators.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+#include "sombok.h"
+
+/** @defgroup sombok_alloc alloc
+ * @brief Custom memory allocators
+ *
+ * Each linebreak object has an allocator, given to its constructor or
+ * taken from the default allocator set by sombok_set_allocator().
+ * Memory of the object itself, its internal state and grapheme cluster
+ * strings made with it are allocated by the allocator and are released
+ * by the same one.  Copies and sessions inherit the allocator of the
+ * original object, unless another one is given to
+ * linebreak_session_new_with_allocator().
+ *
+ * Arrays of lines returned by linebreak_break() and so on, and functions
+ * without linebreak object such as sombok_decode_utf8() and
+ * sombok_encode_utf8(), use the default allocator.  Variants such as
+ * sombok_decode_utf8_with_allocator() take an allocator explicitly.
+ *
+ * So, for example, an arena allocator whose free function does nothing
+ * may be given to a session for each request; then all lines of the
+ * request are released by resetting the arena at once, without
+ * destroying them.
+ *
+ * Allocator shall not be released nor be modified while any object or
+ * memory allocated by it is alive.
+ *@{*/
+
+/** Default allocator, or NULL to use malloc(3) and so on. */
+const sombok_allocator_t *sombok_allocator = NULL;
+
+/** Set Default Allocator
+ *
+ * Default allocator is used by objects made afterward and by functions
+ * without linebreak object.  This should be called before making any
+ * objects, since it is not thread-safe.
+ * @param[in] alloc allocator, or NULL to restore malloc(3) and so on.
+ * @return 0.  If alloc lacked any functions, errno is set to EINVAL then
+ * -1 is returned.
+ */
+int sombok_set_allocator(const sombok_allocator_t * alloc)
+{
+    if (alloc != NULL && (alloc->malloc_func == NULL ||
+			  alloc->realloc_func == NULL ||
+			  alloc->free_func == NULL)) {
+	errno = EINVAL;
+	return -1;
+    }
+    sombok_allocator = alloc;
+    return 0;
+}
+
+/** Allocate Memory
+ *
+ * @param[in] alloc allocator, or NULL to use malloc(3).
+ * @param[in] size size of memory.
+ * @return allocated memory, or NULL with errno set.
+ */
+void *sombok_malloc(const sombok_allocator_t * alloc, size_t size)
+{
+    return SOMBOK_MALLOC(alloc, size);
+}
+
+/** Reallocate Memory
+ *
+ * @param[in] alloc allocator, or NULL to use realloc(3).
+ * @param[in] ptr memory allocated by alloc, or NULL.
+ * @param[in] size new size of memory.
+ * @return reallocated memory, or NULL with errno set.
+ */
+void *sombok_realloc(const sombok_allocator_t * alloc, void *ptr,
+		     size_t size)
+{
+    return SOMBOK_REALLOC(alloc, ptr, size);
+}
+
+/** Release Memory
+ *
+ * Releases memory returned by functions of library, e.g. by
+ * sombok_free(lbobj->allocator, ptr) for memory allocated for lbobj, or by
+ * sombok_free(sombok_allocator, ptr) for memory allocated by functions
+ * without linebreak object.
+ * @param[in] alloc allocator, or NULL to use free(3).
+ * @param[in] ptr memory allocated by alloc, or NULL.
+ * @return none.
+ */
+void sombok_free(const sombok_allocator_t * alloc, void *ptr)
+{
+    SOMBOK_FREE(alloc, ptr);
+}
+
+/*@}*/
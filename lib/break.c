@@ -12,10 +12,31 @@
 
 #include "sombok_constants.h"
 #include "sombok.h"
+#ifdef USE_PTHREAD
+#    include <pthread.h>
+#endif				/* USE_PTHREAD */
 
 extern propval_t *linebreak_rules[];
 extern size_t linebreak_rulessiz;
 
+/*
+ * Update performance counters, if enabled.  See stats.c.
+ * STATS_LAP() adds time elapsed from t to member then updates t.
+ */
+#define STATS_ADD(lbobj, member, n)				\
+    do {							\
+	if ((lbobj)->stats != NULL)				\
+	    (lbobj)->stats->member += (n);			\
+    } while (0)
+#define STATS_LAP(lbobj, member, t)				\
+    do {							\
+	if ((lbobj)->stats != NULL) {				\
+	    double _now = linebreak_stats_clock();		\
+	    (lbobj)->stats->member += _now - (t);		\
+	    (t) = _now;						\
+	}							\
+    } while (0)
+
 /**
  * @defgroup linebreak_break break
  * @brief Perform line breaking algorithm
@@ -28,9 +49,11 @@ gcstring_t *_user(linebreak_t * lbobj, unistr_t * str)
 
     if (str == NULL)
 	return NULL;
-    else if (lbobj->user_func == NULL ||
-	     ((result = (*(lbobj->user_func)) (lbobj, str)) == NULL &&
-	      !lbobj->errnum)) {
+    if (lbobj->user_func != NULL)
+	STATS_ADD(lbobj, calls_prep, 1);
+    if (lbobj->user_func == NULL ||
+	((result = (*(lbobj->user_func)) (lbobj, str)) == NULL &&
+	 !lbobj->errnum)) {
 	if ((result = gcstring_newcopy(str, lbobj)) == NULL)
 	    lbobj->errnum = errno ? errno : ENOMEM;
     }
@@ -69,6 +92,7 @@ gcstring_t *_prep_sub(linebreak_t * lbobj, unistr_t * substr,
 	/* Pass I: search. */
 	unistr.str = prev_str;
 	unistr.len = prev_len;
+	STATS_ADD(lbobj, calls_prep, 1);
 	gcstring_destroy((*func) (lbobj, data, &unistr, text));
 	/* - no match: stop searching. */
 	if (unistr.str == NULL)
@@ -105,6 +129,7 @@ gcstring_t *_prep_sub(linebreak_t * lbobj, unistr_t * substr,
 	}
 
 	/* Pass II: process matched string. */
+	STATS_ADD(lbobj, calls_prep, 1);
 	if ((s = (*func) (lbobj, data, &unistr, NULL)) == NULL) {
 	    if (lbobj->errnum != 0) {
 		gcstring_destroy(ret);
@@ -178,28 +203,76 @@ gcstring_t *_format(linebreak_t * lbobj, linebreak_state_t action,
 		    gcstring_t * str)
 {
     gcstring_t *result;
+    double t = 0.0;
 
     if (str == NULL)
 	return NULL;
-    else if (lbobj->format_func == NULL ||
-	     ((result =
-	       (*(lbobj->format_func)) (lbobj, action, str)) == NULL &&
-	      !lbobj->errnum)) {
+    if (lbobj->format_func != NULL && lbobj->stats != NULL) {
+	lbobj->stats->calls_format++;
+	t = linebreak_stats_clock();
+    }
+    if (lbobj->format_func == NULL)
+	result = NULL;
+    else {
+	SOMBOK_TRACE("format", 'B');
+	result = (*(lbobj->format_func)) (lbobj, action, str);
+	SOMBOK_TRACE("format", 'E');
+    }
+    if (result == NULL && !lbobj->errnum) {
 	if ((result = gcstring_copy(str)) == NULL)
 	    lbobj->errnum = errno ? errno : ENOMEM;
     }
+    if (lbobj->format_func != NULL)
+	STATS_LAP(lbobj, time_format, t);
     return result;
 }
 
+/*
+ * Check if fast paths may be used.
+ */
+#define FAST_PATH_ENABLED(lbobj)				\
+    (!((lbobj)->options & LINEBREAK_OPTION_NO_FAST_PATH))
+
+/*
+ * Check if sizing callback is none or built-in one.  With NO_FAST_PATH
+ * option, built-in one is called as callback.
+ */
+#define SIZING_IS_NATIVE(lbobj)					\
+    ((lbobj)->sizing_func == NULL ||				\
+     ((lbobj)->sizing_func == linebreak_sizing_UAX11 &&		\
+      FAST_PATH_ENABLED(lbobj)))
+
+/*
+ * Size of a fragment by built-in sizing: number of columns by UAX #11 or
+ * number of grapheme clusters.
+ */
+static
+double _columns(linebreak_t * lbobj, gcstring_t * str)
+{
+    if (str == NULL)
+	return 0.0;
+    if (lbobj->sizing_func == linebreak_sizing_UAX11)
+	return (double) gcstring_columns(str);
+    return (double) str->gclen;
+}
+
 static
 double _sizing(linebreak_t * lbobj, double len,
 	       gcstring_t * pre, gcstring_t * spc, gcstring_t * str)
 {
     double ret;
 
-    if (lbobj->sizing_func == NULL ||
-	((ret = (*(lbobj->sizing_func)) (lbobj, len, pre, spc, str))
-	 < 0.0 && !lbobj->errnum)) {
+    /*
+     * Built-in sizing is computed without concatenating spc and str:
+     * both are delimited at grapheme cluster boundaries.
+     */
+    if (SIZING_IS_NATIVE(lbobj))
+	return len + _columns(lbobj, spc) + _columns(lbobj, str);
+    STATS_ADD(lbobj, calls_sizing, 1);
+    SOMBOK_TRACE("sizing", 'B');
+    ret = (*(lbobj->sizing_func)) (lbobj, len, pre, spc, str);
+    SOMBOK_TRACE("sizing", 'E');
+    if (ret < 0.0 && !lbobj->errnum) {
 	if (spc != NULL)
 	    len += (double) spc->gclen;
 	if (str != NULL)
@@ -214,36 +287,466 @@ gcstring_t *_urgent_break(linebreak_t * lbobj, gcstring_t * str)
 {
     gcstring_t *result;
 
-    if (lbobj->urgent_func == NULL ||
-	((result = (*(lbobj->urgent_func)) (lbobj, str)) == NULL &&
-	 !lbobj->errnum)) {
+    if (lbobj->urgent_func == NULL)
+	result = NULL;
+    else {
+	STATS_ADD(lbobj, calls_urgent, 1);
+	SOMBOK_TRACE("urgent", 'B');
+	result = (*(lbobj->urgent_func)) (lbobj, str);
+	SOMBOK_TRACE("urgent", 'E');
+    }
+    if (result == NULL && !lbobj->errnum) {
 	if ((result = gcstring_copy(str)) == NULL)
 	    lbobj->errnum = errno ? errno : ENOMEM;
     }
     return result;
 }
 
+/*
+ * If urgently broken text consists of the same grapheme clusters as n
+ * clusters of str from pos, copy its flags to str and return 1.
+ * Otherwise, or if fast paths are disabled, str is not modified and 0 is
+ * returned.
+ */
+static
+int _urgent_flag(gcstring_t * str, size_t pos, size_t n,
+		 gcstring_t * broken)
+{
+    size_t i, idx;
+
+    if (str->lbobj != NULL && !FAST_PATH_ENABLED(str->lbobj))
+	return 0;
+    if (broken->gclen != n || n == 0 || str->gclen < pos + n)
+	return 0;
+    idx = str->gcstr[pos].idx;
+    if (str->len < idx + broken->len ||
+	memcmp(str->str + idx, broken->str,
+	       sizeof(unichar_t) * broken->len) != 0)
+	return 0;
+    for (i = 0; i < n; i++)
+	if (str->gcstr[pos + i].len != broken->gcstr[i].len)
+	    return 0;
+
+    for (i = 0; i < n; i++)
+	str->gcstr[pos + i].flag = broken->gcstr[i].flag;
+    return 1;
+}
+
+/*
+ * Scratch: buffers of working text, of line buffer, of its trailing
+ * spaces and of fragment, reused by every call of _break_partial() so
+ * that steady breaking won't allocate memory but for lines.  Each buffer
+ * is a grapheme cluster string with numbers of characters and clusters
+ * its memory may hold.  lbobj member of them is not referenced.
+ */
+typedef struct {
+    gcstring_t gcstr;
+    size_t siz;
+    size_t gcsiz;
+} _scratch_buf_t;
+
+struct linebreak_scratch_t {
+    const sombok_allocator_t *allocator;
+    int busy;
+    _scratch_buf_t str, bufstr, bufspc, frg;
+};
+
+/* Larger buffers are released after each call. */
+#define SCRATCH_KEEP_MAX (65536)
+
+/* Empty buffer, keeping its memory. */
+#define SCRATCH_CLEAR(buf)					\
+    ((buf)->gcstr.len = (buf)->gcstr.gclen = (buf)->gcstr.pos = 0)
+/* Buffer was modified by gcstring_replace() and so on: memory is fitted. */
+#define SCRATCH_SYNC(buf)					\
+    ((buf)->siz = (buf)->gcstr.str ? (buf)->gcstr.len : 0,		\
+     (buf)->gcsiz = (buf)->gcstr.gcstr ? (buf)->gcstr.gclen : 0)
+
+static
+void _scratch_buf_free(struct linebreak_scratch_t *sc, _scratch_buf_t * buf)
+{
+    SOMBOK_FREE(sc->allocator, buf->gcstr.str);
+    SOMBOK_FREE(sc->allocator, buf->gcstr.gcstr);
+    memset(buf, 0, sizeof(_scratch_buf_t));
+}
+
+/** Destroy Scratch
+ *
+ * @note this function is for internal use.
+ *
+ * @param[in] sc scratch, or NULL.
+ * @return none.
+ */
+void linebreak_scratch_destroy(struct linebreak_scratch_t *sc)
+{
+    if (sc == NULL)
+	return;
+    _scratch_buf_free(sc, &sc->str);
+    _scratch_buf_free(sc, &sc->bufstr);
+    _scratch_buf_free(sc, &sc->bufspc);
+    _scratch_buf_free(sc, &sc->frg);
+    SOMBOK_FREE(sc->allocator, sc);
+}
+
+/*
+ * Get scratch of lbobj for exclusive use, making it at first time.  If
+ * it is in use, i.e. breaking is called back recursively, a temporary one
+ * is made.  Returns NULL on error.
+ */
+static
+struct linebreak_scratch_t *_scratch_acquire(linebreak_t * lbobj)
+{
+    struct linebreak_scratch_t *sc = lbobj->scratch;
+
+    if (sc == NULL || sc->busy) {
+	if ((sc = SOMBOK_MALLOC(lbobj->allocator,
+				sizeof(struct linebreak_scratch_t))) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    return NULL;
+	}
+	memset(sc, 0, sizeof(struct linebreak_scratch_t));
+	sc->allocator = lbobj->allocator;
+	if (lbobj->scratch == NULL)
+	    lbobj->scratch = sc;
+    }
+    sc->busy = 1;
+    sc->str.gcstr.lbobj = sc->bufstr.gcstr.lbobj = sc->bufspc.gcstr.lbobj =
+	sc->frg.gcstr.lbobj = lbobj;
+    return sc;
+}
+
+static
+void _scratch_buf_trim(struct linebreak_scratch_t *sc, _scratch_buf_t * buf)
+{
+    if (SCRATCH_KEEP_MAX < buf->siz || SCRATCH_KEEP_MAX < buf->gcsiz)
+	_scratch_buf_free(sc, buf);
+    SCRATCH_CLEAR(buf);
+}
+
+/*
+ * End exclusive use of scratch got by _scratch_acquire().
+ */
+static
+void _scratch_release(linebreak_t * lbobj, struct linebreak_scratch_t *sc)
+{
+    if (sc == NULL)
+	return;
+    if (sc != lbobj->scratch) {
+	linebreak_scratch_destroy(sc);
+	return;
+    }
+    _scratch_buf_trim(sc, &sc->str);
+    _scratch_buf_trim(sc, &sc->bufstr);
+    _scratch_buf_trim(sc, &sc->bufspc);
+    _scratch_buf_trim(sc, &sc->frg);
+    sc->busy = 0;
+}
+
+/*
+ * Set text of buffer to a followed by b (if not NULL).  Buffer of a is
+ * owned by lbobj and is released.  Clusters are not segmented.  Returns
+ * grapheme cluster string of buffer, or NULL on error.
+ */
+static
+gcstring_t *_scratch_take(linebreak_t * lbobj, _scratch_buf_t * buf,
+			  unistr_t * a, unistr_t * b)
+{
+    size_t len = a->len + (b != NULL ? b->len : 0), siz;
+    unichar_t *_u;
+
+    if (buf->siz < len) {
+	for (siz = buf->siz ? buf->siz * 2 : 16; siz < len; siz *= 2);
+	if ((_u = SOMBOK_REALLOC(lbobj->allocator, buf->gcstr.str,
+				 sizeof(unichar_t) * siz)) == NULL)
+	    return NULL;
+	buf->gcstr.str = _u;
+	buf->siz = siz;
+    }
+    if (a->len)
+	memcpy(buf->gcstr.str, a->str, sizeof(unichar_t) * a->len);
+    if (b != NULL && b->len)
+	memcpy(buf->gcstr.str + a->len, b->str, sizeof(unichar_t) * b->len);
+    buf->gcstr.len = len;
+    buf->gcstr.gclen = buf->gcstr.pos = 0;
+
+    SOMBOK_FREE(lbobj->allocator, a->str);
+    a->str = NULL;
+    a->len = 0;
+    return &buf->gcstr;
+}
+
+/* Append length clusters of appe from offset to buffer. */
+#define SCRATCH_APPEND(buf, appe, offset, length)			\
+    gcstring_append_substr(&(buf)->gcstr, (appe), (offset), (length),	\
+			   &(buf)->siz, &(buf)->gcsiz)
+
+/*
+ * Save text of gcstr from offset into unistr owned by lbobj.  Returns 0,
+ * or -1 on error.
+ */
+static
+int _scratch_save(linebreak_t * lbobj, unistr_t * unistr,
+		  gcstring_t * gcstr, size_t offset)
+{
+    size_t idx;
+
+    idx = (offset < gcstr->gclen) ? gcstr->gcstr[offset].idx : gcstr->len;
+    unistr->str = NULL;
+    unistr->len = 0;
+    if (gcstr->len <= idx)
+	return 0;
+    if ((unistr->str = SOMBOK_MALLOC(lbobj->allocator, sizeof(unichar_t) *
+				     (gcstr->len - idx))) == NULL)
+	return -1;
+    memcpy(unistr->str, gcstr->str + idx,
+	   sizeof(unichar_t) * (gcstr->len - idx));
+    unistr->len = gcstr->len - idx;
+    return 0;
+}
+
+/*
+ * Destroy string unless it is a buffer of scratch.
+ */
+static
+void _discard(struct linebreak_scratch_t *sc, gcstring_t * gcstr)
+{
+    if (sc != NULL &&
+	(gcstr == &sc->str.gcstr || gcstr == &sc->bufstr.gcstr ||
+	 gcstr == &sc->bufspc.gcstr || gcstr == &sc->frg.gcstr))
+	return;
+    gcstring_destroy(gcstr);
+}
+
 #define gcstring_DESTROY(gcstr) \
-    gcstring_destroy(gcstr); gcstr = NULL;
+    _discard(sc, gcstr); gcstr = NULL;
 
 #define IF_NULL_THEN_ABORT(x)					\
     if ((x) == NULL) {						\
-	size_t i;						\
 	if (lbobj->errnum == 0)					\
 	    lbobj->errnum = errno? errno: EINVAL;		\
-	gcstring_destroy(str);					\
-	gcstring_destroy(bufStr);				\
-	gcstring_destroy(bufSpc);				\
-	for (i = 0; i < reslen; i++)				\
-	    gcstring_destroy(results[i]);			\
-	free(results);						\
-	gcstring_destroy(s);					\
-	gcstring_destroy(t);					\
-	gcstring_destroy(beforeFrg);				\
-	gcstring_destroy(fmt);					\
-	gcstring_destroy(broken);				\
-	return NULL;						\
+	_discard(sc, str);					\
+	_discard(sc, bufStr);					\
+	_discard(sc, bufSpc);					\
+	_discard(sc, s);					\
+	_discard(sc, t);					\
+	_discard(sc, beforeFrg);				\
+	_discard(sc, fmt);					\
+	_discard(sc, broken);					\
+	_scratch_release(lbobj, sc);				\
+	return -1;						\
+    }
+
+/*
+ * Destination of broken lines: either an array or a sink callback.
+ * If record is not NULL, fragments are recorded into it by offset of
+ * characters counted from base.  See linebreak_analyze().
+ */
+typedef struct {
+    linebreak_sink_func_t sink;
+    void *data;
+    gcstring_t **results;
+    size_t reslen;
+    size_t ressiz;
+    unsigned char *record;
+    size_t base;
+} _output_t;
+
+/*
+ * Output a line.  line is always consumed.  Returns 0, or -1 on error.
+ */
+static
+int _emit_line(linebreak_t * lbobj, _output_t * out, gcstring_t * line)
+{
+    gcstring_t **r;
+    size_t ressiz;
+
+    STATS_ADD(lbobj, lines, 1);
+    if (out->sink != NULL) {
+	if ((*(out->sink)) (lbobj, out->data, line) != 0) {
+	    gcstring_destroy(line);
+	    if (lbobj->errnum == 0)
+		lbobj->errnum = LINEBREAK_EEXTN;
+	    return -1;
+	}
+	gcstring_destroy(line);
+	return 0;
+    }
+
+    if (out->ressiz <= out->reslen + 1) {
+	ressiz = out->ressiz ? out->ressiz * 2 : 16;
+	if ((r = SOMBOK_REALLOC(sombok_allocator, out->results,
+				sizeof(gcstring_t *) * ressiz)) == NULL) {
+	    gcstring_destroy(line);
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    return -1;
+	}
+	out->results = r;
+	out->ressiz = ressiz;
+    }
+    out->results[out->reslen++] = line;
+    out->results[out->reslen] = NULL;
+    return 0;
+}
+
+/*
+ * Output a line consists of str and spc.
+ * Arguments are not modified.  Returns 0, or -1 on error.
+ */
+static
+int _put_line(linebreak_t * lbobj, _output_t * out, gcstring_t * str,
+	      gcstring_t * spc)
+{
+    gcstring_t *line;
+
+    if ((line = gcstring_concat(str, spc)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return -1;
+    }
+    return _emit_line(lbobj, out, line);
+}
+
+/*
+ * Check if format callback is none or built-in one.  Built-in callbacks
+ * never modify text at SOT, SOP, SOL and LINE.  With NO_FAST_PATH option,
+ * built-in ones are called as callbacks.
+ */
+#define FORMAT_IS_NATIVE(lbobj)					\
+    ((lbobj)->format_func == NULL ||				\
+     (FAST_PATH_ENABLED(lbobj) &&				\
+      ((lbobj)->format_func == linebreak_format_SIMPLE ||		\
+       (lbobj)->format_func == linebreak_format_NEWLINE ||		\
+       (lbobj)->format_func == linebreak_format_TRIM)))
+
+/*
+ * Format a line consists of str and spc at EOL, EOP or EOT then output
+ * it.  Behavior of built-in format callbacks is performed directly
+ * without copying fragments.  Returns 0, or -1 on error.
+ */
+static
+int _put_formatted(linebreak_t * lbobj, _output_t * out,
+		   linebreak_state_t action, gcstring_t * str,
+		   gcstring_t * spc)
+{
+    linebreak_format_func_t func = lbobj->format_func;
+    gcstring_t *line = NULL, *s, *t;
+    unistr_t unistr;
+    size_t i;
+    int ret;
+
+    if (action == LINEBREAK_STATE_EOL)
+	STATS_ADD(lbobj, lines_arbitrary, 1);
+    else if (action == LINEBREAK_STATE_EOP)
+	STATS_ADD(lbobj, lines_mandatory, 1);
+
+    if (func == NULL)
+	return _put_line(lbobj, out, str, spc);
+    else if (!FORMAT_IS_NATIVE(lbobj)) {
+	if ((s = _format(lbobj, LINEBREAK_STATE_LINE, str)) == NULL)
+	    return -1;
+	if ((t = _format(lbobj, action, spc)) == NULL) {
+	    gcstring_destroy(s);
+	    return -1;
+	}
+	ret = _put_line(lbobj, out, s, t);
+	gcstring_destroy(s);
+	gcstring_destroy(t);
+	return ret;
+    }
+
+    if (func == linebreak_format_NEWLINE ||
+	(func == linebreak_format_TRIM && action == LINEBREAK_STATE_EOL))
+	/* replace by newline. */
+	line = gcstring_copy(str);
+    else if (func == linebreak_format_TRIM) {
+	/* remove SPACEs. */
+	for (i = 0; i < spc->gclen && spc->gcstr[i].lbc == LB_SP; i++);
+	if ((t = gcstring_substr(spc, i, spc->gclen)) != NULL) {
+	    line = gcstring_concat(str, t);
+	    gcstring_destroy(t);
+	}
+	action = LINEBREAK_STATE_NONE;
+    } else {
+	/* append newline at EOL. */
+	line = gcstring_concat(str, spc);
+	if (action != LINEBREAK_STATE_EOL)
+	    action = LINEBREAK_STATE_NONE;
+    }
+    if (line == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return -1;
+    }
+
+    if (action != LINEBREAK_STATE_NONE && lbobj->newline.len) {
+	unistr.str = lbobj->newline.str;
+	unistr.len = lbobj->newline.len;
+	if ((t = gcstring_new(&unistr, lbobj)) == NULL ||
+	    gcstring_append(line, t) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    if (t != NULL) {
+		t->str = NULL;
+		gcstring_destroy(t);
+	    }
+	    gcstring_destroy(line);
+	    return -1;
+	}
+	t->str = NULL;
+	gcstring_destroy(t);
+    }
+    return _emit_line(lbobj, out, line);
+}
+
+/*
+ * Get array of lines terminated by NULL.  Arrays of lines are allocated
+ * by default allocator so that linebreak_free_result() may release them.
+ */
+static
+gcstring_t **_output_result(linebreak_t * lbobj, _output_t * out)
+{
+    if (out->results == NULL) {
+	if ((out->results = SOMBOK_MALLOC(sombok_allocator,
+					  sizeof(gcstring_t *))) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    return NULL;
+	}
+	out->results[0] = NULL;
+	out->ressiz = 1;
+    }
+    return out->results;
+}
+
+static
+void _output_free(linebreak_t * lbobj, _output_t * out)
+{
+    size_t i;
+
+    for (i = 0; i < out->reslen; i++)
+	gcstring_destroy(out->results[i]);
+    SOMBOK_FREE(sombok_allocator, out->results);
+    out->results = NULL;
+    out->reslen = out->ressiz = 0;
+}
+
+/*
+ * Record a fragment: len clusters of str from beg followed by spc
+ * spaces.  Flag of each cluster is kept in lower bits and analysis bits
+ * in upper bits.  base is offset of str in whole text.
+ */
+static
+void _output_record(_output_t * out, gcstring_t * str, size_t base,
+		    size_t beg, size_t len, size_t spc, int mandatory)
+{
+    unsigned char *rec = out->record + base, bits;
+    size_t i;
+
+    for (i = beg; i < beg + len + spc; i++) {
+	bits = (i == beg) ? LINEBREAK_ANALYSIS_BREAK : 0;
+	if (beg + len <= i)
+	    bits |= LINEBREAK_ANALYSIS_SPACE;
+	if (mandatory && i + 1 == beg + len + spc)
+	    bits |= LINEBREAK_ANALYSIS_MANDATORY;
+	rec[str->gcstr[i].idx] = (bits << 4) | (str->gcstr[i].flag & 0x0F);
     }
+}
 
 /** @fn propval_t linebreak_lbrule(propval_t b_idx, propval_t a_idx)
  * @deprecated Use linebreak_get_lbrule().
@@ -277,6 +780,99 @@ propval_t _lbruleinfo(propval_t b_idx, propval_t a_idx)
     return result;
 }
 
+/*
+ * Resolve line breaking class of a grapheme cluster by rules LB1 and LB10
+ * and by options.
+ */
+static
+propval_t _lbclass_resolve(linebreak_t * lbobj, propval_t lbc)
+{
+    switch (lbc) {
+    /* (SG and XX are already resolved). */
+    /* LB1: Resolve AI and CJ. */
+    case LB_AI:
+	return (lbobj->options & LINEBREAK_OPTION_EASTASIAN_CONTEXT) ?
+	    LB_ID : LB_AL;
+    case LB_CJ:
+	return (lbobj->options & LINEBREAK_OPTION_NONSTARTER_LOOSE) ?
+	    LB_ID : LB_NS;
+    /* LB1: SA is resolved to AL. */
+    case LB_SA:
+	return LB_AL;
+    /* LB10: Treat any remaining CM+ as if it were AL. */
+    case LB_CM:
+	return LB_AL;
+#if 0
+    /* (As of 6.1.0): Treat HL as AL. */
+    case LB_HL:
+	return LB_AL;
+#endif
+    /* Optionally, treat hangul syllable as if it were AL. */
+    case LB_H2:
+    case LB_H3:
+    case LB_JL:
+    case LB_JV:
+    case LB_JT:
+	if (lbobj->options & LINEBREAK_OPTION_HANGUL_AS_AL)
+	    return LB_AL;
+	break;
+    }
+    return lbc;
+}
+
+/*
+ * Count fragments of one grapheme cluster from pos, each directly
+ * breakable before the next one, while they fit in colmax columns
+ * starting at *colsptr.  Columns by built-in sizing are added to
+ * *colsptr.  The fragment following the counted ones is also of one
+ * cluster.  Typically these are runs of ideographs or hangul syllables.
+ */
+static
+size_t _direct_run(linebreak_t * lbobj, gcstring_t * str, size_t pos,
+		   double *colsptr)
+{
+    size_t i;
+    double cols = *colsptr, w;
+    propval_t albc;
+
+    for (i = pos; i + 1 < str->gclen; i++) {
+	/* Break before next cluster shall be direct... */
+	switch (albc = gcstring_lbclass(str, i + 1)) {
+	case LB_SP:
+	case LB_BK:
+	case LB_CR:
+	case LB_LF:
+	case LB_NL:
+	case LB_ZW:
+	case LB_CM:
+	    goto last_RUN;
+	}
+	if (str->gcstr[i + 1].flag & LINEBREAK_FLAG_ALLOW_BEFORE);
+	else if (str->gcstr[i + 1].flag & LINEBREAK_FLAG_PROHIBIT_BEFORE ||
+		 _lbruleinfo(_lbclass_resolve(lbobj,
+					      gcstring_lbclass_ext(str, i)),
+			     _lbclass_resolve(lbobj, albc)) !=
+		 LINEBREAK_ACTION_DIRECT)
+	    break;
+	/* ...and it shall not be followed by unbreakable clusters. */
+	if (i + 2 < str->gclen &&
+	    (str->gcstr[i + 2].flag & LINEBREAK_FLAG_PROHIBIT_BEFORE ||
+	     gcstring_lbclass(str, i + 2) == LB_CM))
+	    break;
+
+	if (lbobj->sizing_func == NULL)
+	    w = 1.0;
+	else
+	    w = (double) str->gcstr[i].col;
+	if (0 < lbobj->colmax && lbobj->colmax < cols + w)
+	    break;
+	cols += w;
+    }
+  last_RUN:
+    *colsptr = cols;
+    return i - pos;
+}
+
 propval_t linebreak_lbrule(propval_t b_idx, propval_t a_idx)
 {
     /* Resolve before-side class. */
@@ -362,70 +958,84 @@ propval_t linebreak_lbrule(propval_t b_idx, propval_t a_idx)
  * @param[in] input Unicode string; give NULL to specify end of input.
  * @return array of (partial) broken grapheme cluster strings terminated by NULL.
  * If internal error occurred, lbobj->errnum is set then NULL is returned.
+ *
+ * Internally, lines are passed to out and 0 is returned, or -1 on error.
+ * eop may be set when the input is known to end with a mandatory break:
+ * the break is processed as if more text followed it, so that the object
+ * is left in start-of-paragraph state with empty buffers.
  */
 static
-gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
-			    size_t * lenp, int eot)
+int _break_partial(linebreak_t * lbobj, unistr_t * input, _output_t * out,
+		   int eot, int eop)
 {
     int state;
     gcstring_t *str = NULL, *bufStr = NULL, *bufSpc = NULL;
-    double bufCols;
-    size_t bBeg, bLen, bCM, bSpc, aCM, urgEnd;
-    gcstring_t **results = NULL;
-    size_t reslen = 0;
+    double bufCols, lap = 0.0, fmtTime = 0.0;
+    size_t bBeg, bLen, bCM, bSpc, aCM, urgBeg, urgEnd;
 
     gcstring_t *s = NULL, *t = NULL, *beforeFrg = NULL, *fmt = NULL,
 	*broken = NULL;
     unistr_t unistr;
-    size_t i;
+    size_t i, j;
     gcstring_t empty = { NULL, 0, NULL, 0, 0, lbobj };
+    int native_format = FORMAT_IS_NATIVE(lbobj);
+    int native_sizing = SIZING_IS_NATIVE(lbobj);
+    size_t base;
+    struct linebreak_scratch_t *sc;
+
+    if (lbobj->stats != NULL) {
+	lap = linebreak_stats_clock();
+	fmtTime = lbobj->stats->time_format;
+	if (input != NULL)
+	    lbobj->stats->chars += input->len;
+    }
+
+    if ((sc = _scratch_acquire(lbobj)) == NULL)
+	return -1;
 
     /***
      *** Unread and additional input.
      ***/
 
-    unistr.str = lbobj->unread.str;
-    unistr.len = lbobj->unread.len;
-    lbobj->unread.str = NULL;
-    lbobj->unread.len = 0;
-    if (input != NULL && input->len != 0) {
-	unichar_t *_u;
-	if ((_u = realloc(unistr.str,
-			  sizeof(unichar_t) * (unistr.len + input->len)))
-	    == NULL) {
-	    lbobj->errnum = errno;
-	    free(unistr.str);
-	    return NULL;
-	} else
-	    unistr.str = _u;
-	memcpy(unistr.str + unistr.len, input->str,
-	       sizeof(unichar_t) * input->len);
-	unistr.len += input->len;
-    }
+    /* offset of text in whole input, used by recording. */
+    base = out->base - lbobj->unread.len;
+    IF_NULL_THEN_ABORT(s = _scratch_take(lbobj, &sc->str, &lbobj->unread,
+					 input));
+    unistr.str = s->len ? s->str : NULL;
+    unistr.len = s->len;
 
     /***
      *** Preprocessing.
      ***/
 
     /* perform user breaking */
+    SOMBOK_TRACE("prep", 'B');
     if (lbobj->user_func != NULL)
 	str = _user(lbobj, &unistr);
-    else
+    else if (lbobj->prep_func != NULL)
 	str = _prep(lbobj, &unistr);
-    free(unistr.str);
-    if (str == NULL)
-	return NULL;
+    else if ((str = gcstring_resegment(s, &sc->str.gcsiz)) == NULL)
+	lbobj->errnum = errno ? errno : ENOMEM;
+    s = NULL;
+    SOMBOK_TRACE("prep", 'E');
+    IF_NULL_THEN_ABORT(str);
+    STATS_ADD(lbobj, clusters, str->gclen);
+    STATS_ADD(lbobj, scanned, str->len);
+    STATS_LAP(lbobj, time_prep, lap);
 
     /* South East Asian complex breaking. */
+    SOMBOK_TRACE("sea", 'B');
     errno = 0;
     linebreak_southeastasian_flagbreak(str);
+    SOMBOK_TRACE("sea", 'E');
     if (errno) {
 	lbobj->errnum = errno;
-	gcstring_DESTROY(str);
-	return NULL;
+	IF_NULL_THEN_ABORT(NULL);
     }
+    STATS_LAP(lbobj, time_sea, lap);
 
     /* LB21a (as of 6.1.0): HL (HY | BA) × [^ CB] */
+    SOMBOK_TRACE("lb21a", 'B');
     if (str != NULL && str->gclen) {
 	propval_t lbc;
 
@@ -476,9 +1086,12 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		str->gcstr[i].flag = LINEBREAK_FLAG_PROHIBIT_BEFORE;
 	}
     }
+    SOMBOK_TRACE("lb21a", 'E');
+    STATS_LAP(lbobj, time_lb21a, lap);
 
     /* LB25: not break in (PR|PO)? (OP|HY)? NU (NU|SY|IS)* (CL|CP)? (PR|PO)? */
     /* FIXME:Avoid non-CM grapheme extenders */
+    SOMBOK_TRACE("lb25", 'B');
     if (str != NULL && str->gclen) {
 	size_t st, et;
 
@@ -512,7 +1125,7 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		while (i < str->gclen && gcstring_lbclass(str, i) == LB_CM)
 		    i++;
 		if (str->gclen <= i) {
-		    if (eot)
+		    if (eot || eop)
 			goto LB25_BREAK;
 		    else
 			goto LB25_FOUND;	/* save possible partial sequence. */
@@ -608,6 +1221,8 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
       LB25_BREAK:
 	;
     }
+    SOMBOK_TRACE("lb25", 'E');
+    STATS_LAP(lbobj, time_lb25, lap);
 
     /***
      *** Initialize status.
@@ -627,17 +1242,14 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
      */
     state = lbobj->state;
 
-    unistr.str = lbobj->bufstr.str;
-    unistr.len = lbobj->bufstr.len;
-    lbobj->bufstr.str = NULL;
-    lbobj->bufstr.len = 0;
-    IF_NULL_THEN_ABORT(bufStr = gcstring_new(&unistr, lbobj));
+    IF_NULL_THEN_ABORT(bufStr = _scratch_take(lbobj, &sc->bufstr,
+					      &lbobj->bufstr, NULL));
+    IF_NULL_THEN_ABORT(gcstring_resegment(bufStr, &sc->bufstr.gcsiz));
 
-    unistr.str = lbobj->bufspc.str;
-    unistr.len = lbobj->bufspc.len;
-    lbobj->bufspc.str = NULL;
-    lbobj->bufspc.len = 0;
-    IF_NULL_THEN_ABORT(bufSpc = gcstring_new(&unistr, lbobj));
+    IF_NULL_THEN_ABORT(bufSpc = _scratch_take(lbobj, &sc->bufspc,
+					      &lbobj->bufspc, NULL));
+    IF_NULL_THEN_ABORT(gcstring_resegment(bufSpc, &sc->bufspc.gcsiz));
+    STATS_ADD(lbobj, scanned, bufStr->len + bufSpc->len);
 
     bufCols = lbobj->bufcols;
 
@@ -656,11 +1268,7 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
      *                                 point
      * `read' positions shall never be read again.
      */
-    bBeg = bLen = bCM = bSpc = aCM = urgEnd = 0;
-
-    /* Result. */
-    IF_NULL_THEN_ABORT(results = malloc(sizeof(gcstring_t **)));
-    results[0] = NULL;
+    bBeg = bLen = bCM = bSpc = aCM = urgBeg = urgEnd = 0;
 
     while (1) {
 	/***
@@ -668,7 +1276,31 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 	 ***/
 	int action = 0;
 	propval_t lbc;
-	double newcols;
+	double newcols, frgCols = 0.0;
+
+	/*
+	 * Fragments of one cluster followed by direct breaks are appended
+	 * at once, when they fit in the line and need no callbacks.
+	 */
+	if (native_format && native_sizing && FAST_PATH_ENABLED(lbobj) &&
+	    (state == LINEBREAK_STATE_SOL || state == LINEBREAK_STATE_SOP) &&
+	    bLen == 1 && bSpc == 0 && bCM == 0 && aCM == 0 &&
+	    str->pos == bBeg + 1) {
+	    newcols = bufCols + _columns(lbobj, bufSpc);
+	    if ((i = _direct_run(lbobj, str, bBeg, &newcols)) != 0) {
+		if (out->record != NULL)
+		    for (j = bBeg; j < bBeg + i; j++)
+			_output_record(out, str, base, j, 1, 0, 0);
+		IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufstr, bufSpc, 0,
+						  bufSpc->gclen));
+		IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufstr, str, bBeg, i));
+		SCRATCH_CLEAR(&sc->bufspc);
+		bufCols = newcols;
+
+		bBeg += i;
+		str->pos = bBeg + 1;
+	    }
+	}
 
 	/* Go ahead reading input. */
 	while (!gcstring_eos(str)) {
@@ -756,7 +1388,7 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 	/* Mandatory break. */
 	if (0 < bSpc &&
 	    (lbc = gcstring_lbclass(str, bBeg + bLen + bSpc - 1)) != LB_SP
-	    && (lbc != LB_CR || eot || !gcstring_eos(str))) {
+	    && (lbc != LB_CR || eot || eop || !gcstring_eos(str))) {
 	    /* CR at end of input may be part of CR LF therefore not be eop. */
 	    action = LINEBREAK_ACTION_MANDATORY;
 	    /* LB11, LB12 and tailorable rules LB13 - LB31.
@@ -782,83 +1414,12 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		else
 		    btail = bBeg + bLen - bCM - 1;	/* LB9 */
 
-		blbc = gcstring_lbclass_ext(str, btail);
-		switch (blbc) {
-		/* (SG and XX are already resolved). */
-		/* LB1: Resolve AI and CJ. */
-		case LB_AI:
-		    blbc = (lbobj->options &
-			    LINEBREAK_OPTION_EASTASIAN_CONTEXT) ?
-			LB_ID : LB_AL;
-		    break;
-		case LB_CJ:
-		    blbc = (lbobj->options &
-			    LINEBREAK_OPTION_NONSTARTER_LOOSE) ?
-			LB_ID : LB_NS;
-		    break;
-		/* LB1: SA is resolved to AL. */
-		case LB_SA:
-		    blbc = LB_AL;
-		    break;
-		/* LB10: Treat any remaining CM+ as if it were AL. */
-		case LB_CM:
-		    blbc = LB_AL;
-		    break;
-#if 0
-		/* (As of 6.1.0): Treat HL as AL. */
-		case LB_HL:
-		    blbc = LB_AL;
-		    break;
-#endif
-		/* Optionally, treat hangul syllable as if it were AL. */
-		case LB_H2:
-		case LB_H3:
-		case LB_JL:
-		case LB_JV:
-		case LB_JT:
-		    if (lbobj->options & LINEBREAK_OPTION_HANGUL_AS_AL)
-			blbc = LB_AL;
-		    break;
-		}
+		blbc = _lbclass_resolve(lbobj,
+					gcstring_lbclass_ext(str, btail));
 
-		albc = gcstring_lbclass(str, bBeg + bLen + bSpc);
-		switch (albc) {
-		/* (SG and XX are already resolved). */
-		/* LB1: Resolve AI and CJ. */
-		case LB_AI:
-		    albc = (lbobj->options &
-			    LINEBREAK_OPTION_EASTASIAN_CONTEXT) ?
-			LB_ID : LB_AL;
-		    break;
-		case LB_CJ:
-		    albc = (lbobj->options &
-			    LINEBREAK_OPTION_NONSTARTER_LOOSE) ?
-			LB_ID : LB_NS;
-		    break;
-		/* LB1: SA is resolved to AL. */
-		case LB_SA:
-		    albc = LB_AL;
-		    break;
-		/* LB10: Treat any remaining CM+ as if it were AL. */
-		case LB_CM:
-		    albc = LB_AL;
-		    break;
-#if 0
-		/* (As of 6.1.0): Treat HL as AL. */
-		case LB_HL:
-		    albc = LB_AL;
-		    break;
-#endif
-		/* Optionally, treat hangul syllable as if it were AL. */
-		case LB_H2:
-		case LB_H3:
-		case LB_JL:
-		case LB_JV:
-		case LB_JT:
-		    if (lbobj->options & LINEBREAK_OPTION_HANGUL_AS_AL)
-			albc = LB_AL;
-		    break;
-		}
+		albc = _lbclass_resolve(lbobj,
+					gcstring_lbclass(str,
+							 bBeg + bLen + bSpc));
 
 		action = _lbruleinfo(blbc, albc);
 	    }
@@ -899,11 +1460,22 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 			gcstring_next(broken);
 		    }		/* while (!gcstring_eos(broken)) */
 
-		    urgEnd = broken->gclen;
-		    gcstring_replace(str, 0, str->pos, broken);
+		    /* Flag breaks in place if possible.
+		     * Otherwise rebuild str. */
+		    if (_urgent_flag(str, bBeg, str->pos - bBeg, broken)) {
+			urgEnd = bBeg + broken->gclen;
+			str->pos = bBeg;
+		    } else {
+			/* str will start at bBeg. */
+			base += str->gcstr[bBeg].idx;
+			urgEnd = broken->gclen;
+			gcstring_replace(str, 0, str->pos, broken);
+			SCRATCH_SYNC(&sc->str);
+			str->pos = 0;
+			bBeg = 0;
+		    }
 		    gcstring_DESTROY(broken);
-		    str->pos = 0;
-		    bBeg = bLen = bCM = bSpc = aCM = 0;
+		    bLen = bCM = bSpc = aCM = 0;
 		    continue;	/* while (1) */
 		}
 
@@ -919,48 +1491,51 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 	/***
 	 *** Check end of input.
 	 ***/
-	if (!eot && str->gclen <= bBeg + bLen + bSpc) {
+	if (!eot && str->gclen <= bBeg + bLen + bSpc &&
+	    !(eop && action == LINEBREAK_ACTION_MANDATORY)) {
 	    /* Save status then output partial result. */
-	    lbobj->bufstr.str = bufStr->str;
-	    lbobj->bufstr.len = bufStr->len;
-	    bufStr->str = NULL;
-	    bufStr->len = 0;
-	    gcstring_DESTROY(bufStr);
-
-	    lbobj->bufspc.str = bufSpc->str;
-	    lbobj->bufspc.len = bufSpc->len;
-	    bufSpc->str = NULL;
-	    bufSpc->len = 0;
-	    gcstring_DESTROY(bufSpc);
-
+	    if (_scratch_save(lbobj, &lbobj->bufstr, bufStr, 0) != 0 ||
+		_scratch_save(lbobj, &lbobj->bufspc, bufSpc, 0) != 0 ||
+		_scratch_save(lbobj, &lbobj->unread, str, bBeg) != 0) {
+		IF_NULL_THEN_ABORT(NULL);
+	    }
 	    lbobj->bufcols = bufCols;
 
-	    s = gcstring_substr(str, bBeg, str->gclen - bBeg);
-	    lbobj->unread.str = s->str;
-	    lbobj->unread.len = s->len;
-	    s->str = NULL;
-	    s->len = 0;
-	    gcstring_DESTROY(s);
-
 	    lbobj->state = state;
+	    if (lbobj->stats != NULL)
+		lbobj->stats->time_main += linebreak_stats_clock() - lap -
+		    (lbobj->stats->time_format - fmtTime);
 
 	    /* clenup. */
 	    gcstring_DESTROY(str);
+	    _scratch_release(lbobj, sc);
 
-	    if (lenp != NULL)
-		*lenp = reslen;
-	    return results;
+	    return 0;
 	}
 
 	/* After all, possible actions are MANDATORY and arbitrary. */
 
+	if (out->record != NULL)
+	    _output_record(out, str, base, bBeg, bLen, bSpc,
+			   action == LINEBREAK_ACTION_MANDATORY);
+
 	/***
 	 *** Examine line breaking action
 	 ***/
 
-	IF_NULL_THEN_ABORT(beforeFrg = gcstring_substr(str, bBeg, bLen));
-
-	if (state == LINEBREAK_STATE_NONE) {	/* sot undone. */
+	SCRATCH_CLEAR(&sc->frg);
+	IF_NULL_THEN_ABORT(beforeFrg = SCRATCH_APPEND(&sc->frg, str, bBeg,
+						      bLen));
+
+	if (native_format) {
+	    /* sot and sop won't modify text. */
+	    if (state == LINEBREAK_STATE_NONE ||
+		state == LINEBREAK_STATE_SOT_FORMAT)
+		state = LINEBREAK_STATE_SOL;
+	    else if (state == LINEBREAK_STATE_SOT ||
+		     state == LINEBREAK_STATE_SOP_FORMAT)
+		state = LINEBREAK_STATE_SOP;
+	} else if (state == LINEBREAK_STATE_NONE) {	/* sot undone. */
 	    /* Process start of text. */
 	    IF_NULL_THEN_ABORT(fmt = _format(lbobj, LINEBREAK_STATE_SOT,
 					     beforeFrg));
@@ -973,6 +1548,7 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		gcstring_append(fmt, s);
 		gcstring_DESTROY(s);
 		gcstring_replace(str, 0, str->pos, fmt);
+		SCRATCH_SYNC(&sc->str);
 		str->pos = 0;
 		bBeg = bLen = bCM = bSpc = aCM = 0;
 		urgEnd = 0;
@@ -1000,6 +1576,7 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		gcstring_append(fmt, s);
 		gcstring_DESTROY(s);
 		gcstring_replace(str, 0, str->pos, fmt);
+		SCRATCH_SYNC(&sc->str);
 		str->pos = 0;
 		bBeg = bLen = bCM = bSpc = aCM = 0;
 		urgEnd = 0;
@@ -1018,13 +1595,19 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 	/***
 	 *** Check if arbitrary break is needed.
 	 ***/
-	newcols = _sizing(lbobj, bufCols, bufStr, bufSpc, beforeFrg);
-	if (newcols < 0.0) {
+	if (native_sizing) {
+	    /* size of fragment is computed once. */
+	    frgCols = _columns(lbobj, beforeFrg);
+	    newcols = bufCols + _columns(lbobj, bufSpc) + frgCols;
+	} else if ((newcols = _sizing(lbobj, bufCols, bufStr, bufSpc,
+				      beforeFrg)) < 0.0) {
 	    IF_NULL_THEN_ABORT(NULL);
 	}
 	if (0 < lbobj->colmax && lbobj->colmax < newcols) {
-	    newcols = _sizing(lbobj, 0.0, &empty, &empty, beforeFrg);
-	    if (newcols < 0.0) {
+	    if (native_sizing)
+		newcols = frgCols;
+	    else if ((newcols = _sizing(lbobj, 0.0, &empty, &empty,
+					beforeFrg)) < 0.0) {
 		IF_NULL_THEN_ABORT(NULL);
 	    }
 
@@ -1039,8 +1622,9 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		if (0.0 < bufCols && bufCols < lbobj->colmin) {
 		    gcstring_replace(beforeFrg, 0, 0, bufSpc);
 		    gcstring_replace(beforeFrg, 0, 0, bufStr);
-		    gcstring_shrink(bufSpc, 0);
-		    gcstring_shrink(bufStr, 0);
+		    SCRATCH_SYNC(&sc->frg);
+		    SCRATCH_CLEAR(&sc->bufspc);
+		    SCRATCH_CLEAR(&sc->bufstr);
 		    bufCols = 0.0;
 		    IF_NULL_THEN_ABORT(broken = _urgent_break(lbobj,
 							      beforeFrg));
@@ -1049,12 +1633,25 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 							      beforeFrg));
 		}
 
-		if (broken != NULL) {
+		if (broken != NULL &&
+		    _urgent_flag(str, bBeg, bLen, broken)) {
+		    /* Breaks are flagged in place. */
+		    str->pos = bBeg;
+		    urgBeg = bBeg;
+		    urgEnd = bBeg + bLen + bSpc;
+		    bLen = bCM = bSpc = aCM = 0;
+		    gcstring_DESTROY(broken);
+
+		    gcstring_DESTROY(beforeFrg);
+		    continue;	/* while (1) */
+		} else if (broken != NULL) {
 		    s = gcstring_substr(str, bBeg + bLen, bSpc);
 		    gcstring_append(broken, s);
 		    gcstring_DESTROY(s);
 		    gcstring_replace(str, 0, bBeg + bLen + bSpc, broken);
+		    SCRATCH_SYNC(&sc->str);
 		    str->pos = 0;
+		    urgBeg = 0;
 		    urgEnd = broken->gclen;
 		    bBeg = bLen = bCM = bSpc = aCM = 0;
 		    gcstring_DESTROY(broken);
@@ -1068,28 +1665,22 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 	     ** Otherwise, process arbitrary break.
 	     **/
 	    if (bufStr->len || bufSpc->len) {
-		gcstring_t **r;
-
-		IF_NULL_THEN_ABORT(r = realloc(results,
-					       sizeof(gcstring_t *) *
-					       (reslen + 2)));
-		(results = r)[reslen + 1] = NULL;
-		IF_NULL_THEN_ABORT(s = _format(lbobj, LINEBREAK_STATE_LINE,
-					       bufStr));
-		IF_NULL_THEN_ABORT(t = _format(lbobj, LINEBREAK_STATE_EOL,
-					       bufSpc));
-		IF_NULL_THEN_ABORT(results[reslen] =
-				   gcstring_concat(s, t));
-		reslen++;
-		gcstring_DESTROY(s);
-		gcstring_DESTROY(t);
-
+		if (_put_formatted(lbobj, out, LINEBREAK_STATE_EOL,
+				   bufStr, bufSpc) != 0) {
+		    IF_NULL_THEN_ABORT(NULL);
+		}
+		/* broken inside of urgently broken text. */
+		if (urgBeg < bBeg && bBeg < urgEnd)
+		    STATS_ADD(lbobj, lines_urgent, 1);
+	    }
+	    if ((bufStr->len || bufSpc->len) && !native_format) {
 		IF_NULL_THEN_ABORT(fmt =
 				   _format(lbobj, LINEBREAK_STATE_SOL,
 					   beforeFrg));
 		if (gcstring_cmp(beforeFrg, fmt) != 0) {
 		    gcstring_DESTROY(beforeFrg);
 		    beforeFrg = fmt;
+		    fmt = NULL;
 		    newcols =
 			_sizing(lbobj, 0.0, &empty, &empty, beforeFrg);
 		    if (newcols < 0.0) {
@@ -1098,26 +1689,27 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 		} else
 		    gcstring_DESTROY(fmt);
 	    }
-	    gcstring_shrink(bufStr, 0);
-	    gcstring_append(bufStr, beforeFrg);
+	    SCRATCH_CLEAR(&sc->bufstr);
+	    IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufstr, beforeFrg, 0,
+					      beforeFrg->gclen));
 
-	    gcstring_shrink(bufSpc, 0);
-	    s = gcstring_substr(str, bBeg + bLen, bSpc);
-	    gcstring_append(bufSpc, s);
-	    gcstring_DESTROY(s);
+	    SCRATCH_CLEAR(&sc->bufspc);
+	    IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufspc, str, bBeg + bLen,
+					      bSpc));
 
 	    bufCols = newcols;
 	/***
 	 *** Arbitrary break is not needed.
 	 ***/
 	} else {
-	    gcstring_append(bufStr, bufSpc);
-	    gcstring_append(bufStr, beforeFrg);
+	    IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufstr, bufSpc, 0,
+					      bufSpc->gclen));
+	    IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufstr, beforeFrg, 0,
+					      beforeFrg->gclen));
 
-	    gcstring_shrink(bufSpc, 0);
-	    s = gcstring_substr(str, bBeg + bLen, bSpc);
-	    gcstring_append(bufSpc, s);
-	    gcstring_DESTROY(s);
+	    SCRATCH_CLEAR(&sc->bufspc);
+	    IF_NULL_THEN_ABORT(SCRATCH_APPEND(&sc->bufspc, str, bBeg + bLen,
+					      bSpc));
 
 	    bufCols = newcols;
 	}			/* if (0 < lbobj->colmax ... ) */
@@ -1132,26 +1724,16 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
 
 	if (action == LINEBREAK_ACTION_MANDATORY) {
 	    /* Process mandatory break. */
-	    gcstring_t **r;
-
-	    IF_NULL_THEN_ABORT(r = realloc(results,
-					   sizeof(gcstring_t *) *
-					   (reslen + 2)));
-	    (results = r)[reslen + 1] = NULL;
-	    IF_NULL_THEN_ABORT(s = _format(lbobj, LINEBREAK_STATE_LINE,
-					   bufStr));
-	    IF_NULL_THEN_ABORT(t = _format(lbobj, LINEBREAK_STATE_EOP,
-					   bufSpc));
-	    IF_NULL_THEN_ABORT(results[reslen] = gcstring_concat(s, t));
-	    reslen++;
-	    gcstring_DESTROY(s);
-	    gcstring_DESTROY(t);
+	    if (_put_formatted(lbobj, out, LINEBREAK_STATE_EOP,
+			       bufStr, bufSpc) != 0) {
+		IF_NULL_THEN_ABORT(NULL);
+	    }
 
 	    /* eop done then sop must be carried out. */
 	    state = LINEBREAK_STATE_SOT;
 
-	    gcstring_shrink(bufStr, 0);
-	    gcstring_shrink(bufSpc, 0);
+	    SCRATCH_CLEAR(&sc->bufstr);
+	    SCRATCH_CLEAR(&sc->bufspc);
 	    bufCols = 0.0;
 	}
 
@@ -1168,39 +1750,64 @@ gcstring_t **_break_partial(linebreak_t * lbobj, unistr_t * input,
     /***
      *** Process end of text.
      ***/
-    {
-	gcstring_t **r;
-
-	IF_NULL_THEN_ABORT(r = realloc(results,
-				       sizeof(gcstring_t *) * (reslen +
-							       2)));
-	(results = r)[reslen + 1] = NULL;
-	IF_NULL_THEN_ABORT(s =
-			   _format(lbobj, LINEBREAK_STATE_LINE, bufStr));
-	IF_NULL_THEN_ABORT(t =
-			   _format(lbobj, LINEBREAK_STATE_EOT, bufSpc));
-	IF_NULL_THEN_ABORT(results[reslen] = gcstring_concat(s, t));
-	reslen++;
-	gcstring_DESTROY(s);
-	gcstring_DESTROY(t);
+    if (_put_formatted(lbobj, out, LINEBREAK_STATE_EOT, bufStr, bufSpc)
+	!= 0) {
+	IF_NULL_THEN_ABORT(NULL);
     }
+    if (lbobj->stats != NULL)
+	lbobj->stats->time_main += linebreak_stats_clock() - lap -
+	    (lbobj->stats->time_format - fmtTime);
 
     /* clenup. */
     gcstring_DESTROY(str);
     gcstring_DESTROY(bufStr);
     gcstring_DESTROY(bufSpc);
+    _scratch_release(lbobj, sc);
 
     /* Reset status then return the rest of result. */
     linebreak_reset(lbobj);
 
-    if (lenp != NULL)
-	*lenp = reslen;
-    return results;
+    return 0;
 }
 
 gcstring_t **linebreak_break_partial(linebreak_t * lbobj, unistr_t * input)
 {
-    return _break_partial(lbobj, input, NULL, (input == NULL));
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+
+    if (_break_partial(lbobj, input, &out, (input == NULL), 0) != 0) {
+	_output_free(lbobj, &out);
+	return NULL;
+    }
+    return _output_result(lbobj, &out);
+}
+
+/** Perform line breaking algorithm with incremental inputs, passing
+ * each line to a callback.
+ *
+ * Each line is passed to sink as soon as it is determined.  The line is
+ * owned by the library and will be destroyed after sink returns.
+ * If sink returns non-zero value, processing is aborted and, unless
+ * lbobj->errnum was set by sink, it is set to LINEBREAK_EEXTN.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string; give NULL to specify end of input.
+ * @param[in] sink callback function called as sink(lbobj, data, line).
+ * @param[in] data data argument of sink.
+ * @return 0.
+ * If error occurred, lbobj->errnum is set then -1 is returned.
+ */
+int linebreak_break_partial_to_sink(linebreak_t * lbobj, unistr_t * input,
+				    linebreak_sink_func_t sink, void *data)
+{
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+
+    if (sink == NULL) {
+	lbobj->errnum = EINVAL;
+	return -1;
+    }
+    out.sink = sink;
+    out.data = data;
+    return _break_partial(lbobj, input, &out, (input == NULL), 0);
 }
 
 /**
@@ -1216,21 +1823,200 @@ gcstring_t **linebreak_break_partial(linebreak_t * lbobj, unistr_t * input)
  */
 gcstring_t **linebreak_break_fast(linebreak_t * lbobj, unistr_t * input)
 {
-    gcstring_t **ret;
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
 
-    if (input == NULL) {
-	if ((ret = malloc(sizeof(gcstring_t *))) == NULL)
-	    lbobj->errnum = errno ? errno : ENOMEM;
-	else
-	    ret[0] = NULL;
-	return ret;
+    if (input != NULL && _break_partial(lbobj, input, &out, 1, 0) != 0) {
+	_output_free(lbobj, &out);
+	return NULL;
     }
+    return _output_result(lbobj, &out);
+}
 
-    return _break_partial(lbobj, input, NULL, 1);
+/*
+ * Search end of paragraph at or after pos, i.e. position just after
+ * a mandatory break which is a grapheme cluster by itself.  Search stops
+ * before lim.  If not found, returns lim or length of input, whichever
+ * is less.
+ */
+static
+size_t _search_eop(linebreak_t * lbobj, unistr_t * input, size_t pos,
+		   size_t lim)
+{
+    propval_t lbc, gcb, ngcb;
+    size_t beg = pos;
+
+    if (input->len < lim)
+	lim = input->len;
+    for (; pos < lim; pos++) {
+	/* Without custom map, only these may be mandatory breaks. */
+	if (lbobj->map == NULL || lbobj->mapsiz == 0)
+	    switch (input->str[pos]) {
+	    case 0x000A:
+	    case 0x000B:
+	    case 0x000C:
+	    case 0x000D:
+	    case 0x0085:
+	    case 0x2028:
+	    case 0x2029:
+		break;
+	    default:
+		continue;
+	    }
+	linebreak_charprop(lbobj, input->str[pos], &lbc, NULL, &gcb, NULL);
+	if (gcb != GB_CR && gcb != GB_LF && gcb != GB_Control)
+	    continue;
+	if (lbc != LB_BK && lbc != LB_CR && lbc != LB_LF && lbc != LB_NL)
+	    continue;
+	if (gcb == GB_LF && 0 < pos) {
+	    /* LF in CR LF is not a top of grapheme cluster. */
+	    linebreak_charprop(lbobj, input->str[pos - 1], NULL, NULL,
+			       &ngcb, NULL);
+	    if (ngcb == GB_CR)
+		continue;
+	}
+	if (gcb == GB_CR && pos + 1 < input->len) {
+	    linebreak_charprop(lbobj, input->str[pos + 1], NULL, NULL,
+			       &ngcb, NULL);
+	    if (ngcb == GB_LF)
+		pos++;
+	}
+	STATS_ADD(lbobj, scanned, pos + 1 - beg);
+	return pos + 1;
+    }
+    STATS_ADD(lbobj, scanned, lim - beg);
+    return lim;
 }
 
 #define PARTIAL_LENGTH (1000)
 
+/*
+ * Pass a chunk of span input->str[*kp..end) to engine, then advance *kp
+ * to the end of chunk.  See _break_span().
+ */
+static
+int _break_chunk(linebreak_t * lbobj, unistr_t * input, size_t * kp,
+		 size_t end, int eop, _output_t * out)
+{
+    unistr_t unistr;
+    size_t k = *kp, l, next, lim;
+    int at_eop;
+
+    /* Paragraphs are not searched beyond the chunk. */
+    lim = k + PARTIAL_LENGTH + 1;
+    if ((l = _search_eop(lbobj, input, k, lim)) <= k + PARTIAL_LENGTH) {
+	/* gather paragraphs. */
+	while (l < end &&
+	       (next = _search_eop(lbobj, input, l, lim)) <=
+	       k + PARTIAL_LENGTH)
+	    l = next;
+	at_eop = 1;
+    } else {
+	/* a part of long paragraph. */
+	l = k + PARTIAL_LENGTH;
+	at_eop = 0;
+    }
+    if (end < l)
+	l = end;
+    *kp = l;
+
+    out->base = k;
+    unistr.str = input->str + k;
+    unistr.len = l - k;
+    if (l < end)
+	return _break_partial(lbobj, &unistr, out, 0, at_eop);
+    return _break_partial(lbobj, &unistr, out, !eop, eop);
+}
+
+/*
+ * Break a span input->str[beg..end) which starts at top of a paragraph.
+ * Short paragraphs are passed to engine together up to PARTIAL_LENGTH
+ * characters, and longer one is divided by every PARTIAL_LENGTH
+ * characters counted from its top.  Thus result of a paragraph does not
+ * depend on its position, and any span gives same result as
+ * linebreak_break() on whole input.  If eop is set, span must end with a
+ * mandatory break and the object will be left at start of paragraph.
+ * Otherwise, span is the end of text.
+ */
+static
+int _break_span(linebreak_t * lbobj, unistr_t * input, size_t beg,
+		size_t end, int eop, _output_t * out)
+{
+    size_t k;
+
+    for (k = beg; k < end;)
+	if (_break_chunk(lbobj, input, &k, end, eop, out) != 0)
+	    return -1;
+    return 0;
+}
+
+/*
+ * Break input->str[0..len) paragraph by paragraph, looking up cache.
+ * Result is the same as _break_span() on whole input.
+ */
+static
+int _break_text(linebreak_t * lbobj, unistr_t * input, _output_t * out)
+{
+    _output_t tmp;
+    unistr_t para;
+    gcstring_t **lines;
+    unsigned long confhash;
+    size_t beg, end, i, nlines;
+    int eop, kind;
+
+    if (lbobj->cache == NULL || lbobj->user_func != NULL ||
+	lbobj->prep_func != NULL)
+	return _break_span(lbobj, input, 0, input->len, 0, out);
+
+    confhash = linebreak_cache_confhash(lbobj);
+    for (beg = 0; beg < input->len; beg = end) {
+	end = _search_eop(lbobj, input, beg, input->len);
+	eop = (end < input->len);
+
+	/* Paragraph following pending text can't be cached. */
+	if ((lbobj->state != LINEBREAK_STATE_NONE &&
+	     lbobj->state != LINEBREAK_STATE_SOT) ||
+	    lbobj->unread.len || lbobj->bufstr.len || lbobj->bufspc.len) {
+	    if (_break_span(lbobj, input, beg, end, eop, out) != 0)
+		return -1;
+	    continue;
+	}
+
+	para.str = input->str + beg;
+	para.len = end - beg;
+	kind = (lbobj->state == LINEBREAK_STATE_NONE) ? 1 : 0;
+	if (eop)
+	    kind |= 2;
+	if ((lines = linebreak_cache_get(lbobj, &para, kind, confhash,
+					 &nlines)) != NULL) {
+	    /* State after the paragraph. */
+	    if (eop)
+		lbobj->state = LINEBREAK_STATE_SOT;
+	    else
+		linebreak_reset(lbobj);
+	} else {
+	    memset(&tmp, 0, sizeof(_output_t));
+	    if (_break_span(lbobj, input, beg, end, eop, &tmp) != 0) {
+		_output_free(lbobj, &tmp);
+		return -1;
+	    }
+	    lines = tmp.results;
+	    nlines = tmp.reslen;
+	    linebreak_cache_put(lbobj, &para, kind, confhash, lines,
+				nlines);
+	}
+
+	for (i = 0; i < nlines; i++)
+	    if (_emit_line(lbobj, out, lines[i]) != 0) {
+		while (++i < nlines)
+		    gcstring_destroy(lines[i]);
+		SOMBOK_FREE(sombok_allocator, lines);
+		return -1;
+	    }
+	SOMBOK_FREE(sombok_allocator, lines);
+    }
+    return 0;
+}
+
 /** Perform line breaking algorithm on complete input.
  *
  * This function will consume constant size of heap.
@@ -1242,79 +2028,1183 @@ gcstring_t **linebreak_break_fast(linebreak_t * lbobj, unistr_t * input)
  */
 gcstring_t **linebreak_break(linebreak_t * lbobj, unistr_t * input)
 {
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+
+    if (input != NULL && _break_text(lbobj, input, &out) != 0) {
+	_output_free(lbobj, &out);
+	return NULL;
+    }
+    return _output_result(lbobj, &out);
+}
+
+/** Perform line breaking algorithm on complete input, passing each line
+ * to a callback.
+ *
+ * Unlike linebreak_break(), lines are not accumulated:  Each line is
+ * passed to sink as soon as it is determined, and will be destroyed after
+ * sink returns.  Thus heap consumption is bounded by the longest line.
+ * See linebreak_break_partial_to_sink() about sink.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @param[in] sink callback function called as sink(lbobj, data, line).
+ * @param[in] data data argument of sink.
+ * @return 0.
+ * If error occurred, lbobj->errnum is set then -1 is returned.
+ */
+int linebreak_break_to_sink(linebreak_t * lbobj, unistr_t * input,
+			    linebreak_sink_func_t sink, void *data)
+{
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+
+    if (sink == NULL) {
+	lbobj->errnum = EINVAL;
+	return -1;
+    }
+    if (input == NULL)
+	return 0;
+    out.sink = sink;
+    out.data = data;
+    return _break_text(lbobj, input, &out);
+}
+
+/*
+ * Check if result of analysis by linebreak_analyze() may be laid out by
+ * linebreak_reflow().  Unbreakable fragments and their columns are
+ * independent of colmax only when no callbacks but built-in ones are set
+ * and colmin is not set.
+ */
+#define ANALYSIS_IS_NATIVE(lbobj)				\
+    ((lbobj)->user_func == NULL && (lbobj)->prep_func == NULL &&	\
+     (lbobj)->urgent_func == NULL && (lbobj)->colmin <= 0.0 &&	\
+     FORMAT_IS_NATIVE(lbobj) && SIZING_IS_NATIVE(lbobj))
+
+/*
+ * Hash of configuration except colmax.
+ */
+static
+unsigned long _analysis_confhash(linebreak_t * lbobj)
+{
+    return linebreak_cache_confhash_colmax(lbobj, 0.0);
+}
+
+static
+int _discard_line(linebreak_t * lbobj, void *data, gcstring_t * line)
+{
+    return 0;
+}
+
+/** Analyze text to lay it out by various number of columns.
+ *
+ * Line breaking opportunities and width of grapheme clusters are
+ * computed once, then linebreak_reflow() lays out text only by fitting
+ * fragments in lines.  Partial state of lbobj is not affected.
+ *
+ * If preprocessing, urgent breaking or custom format or sizing callbacks
+ * or colmin are set, opportunities depend on number of columns.  In such
+ * case only text is kept and linebreak_reflow() performs whole line
+ * breaking.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @return New analysis.
+ * If error occurred, lbobj->errnum is set then NULL is returned.
+ */
+linebreak_analysis_t *linebreak_analyze(linebreak_t * lbobj,
+					unistr_t * input)
+{
+    linebreak_analysis_t *analysis;
+    linebreak_t *obj;
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
     unistr_t unistr = { NULL, 0 };
-    gcstring_t **ret, **appe, **r;
-    size_t i, j, k, retlen, appelen;
+    unsigned char *rec;
+    size_t i;
 
-    if ((ret = malloc(sizeof(gcstring_t *))) == NULL) {
+    if (input == NULL)
+	input = &unistr;
+    if ((analysis = SOMBOK_MALLOC(lbobj->allocator,
+				  sizeof(linebreak_analysis_t))) == NULL) {
 	lbobj->errnum = errno ? errno : ENOMEM;
 	return NULL;
-    } else
-	ret[0] = NULL;
-    if (input == NULL)
-	return ret;
-    retlen = 0;
+    }
+    analysis->brk = NULL;
+    analysis->confhash = _analysis_confhash(lbobj);
+    analysis->allocator = lbobj->allocator;
+    if ((analysis->gcstr = gcstring_newcopy(input, lbobj)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	SOMBOK_FREE(lbobj->allocator, analysis);
+	return NULL;
+    }
+    if (!ANALYSIS_IS_NATIVE(lbobj) || input->len == 0)
+	return analysis;
 
-    unistr.len = PARTIAL_LENGTH;
-    for (k = 0; PARTIAL_LENGTH < input->len - k; k += PARTIAL_LENGTH) {
-	unistr.str = input->str + k;
-	if ((appe = _break_partial(lbobj, &unistr, &appelen, 0)) == NULL) {
-	    for (i = 0; i < retlen; i++)
-		gcstring_destroy(ret[i]);
-	    free(ret);
-	    return NULL;
+    /*
+     * Break text by a copy of lbobj without arbitrary breaks, recording
+     * fragments.
+     */
+    if ((obj = linebreak_copy(lbobj)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	linebreak_analysis_destroy(analysis);
+	return NULL;
+    }
+    linebreak_reset(obj);
+    obj->colmax = 0.0;
+
+    out.sink = _discard_line;
+    if ((out.record = SOMBOK_MALLOC(lbobj->allocator, input->len)) == NULL)
+	obj->errnum = errno ? errno : ENOMEM;
+    else {
+	memset(out.record, 0, input->len);
+	_break_span(obj, input, 0, input->len, 0, &out);
+    }
+    if (obj->errnum) {
+	lbobj->errnum = obj->errnum;
+	linebreak_destroy(obj);
+	SOMBOK_FREE(lbobj->allocator, out.record);
+	linebreak_analysis_destroy(analysis);
+	return NULL;
+    }
+    linebreak_destroy(obj);
+
+    /* Characters are segmented as clusters of the same extent. */
+    rec = out.record;
+    for (i = 0; i < analysis->gcstr->gclen; i++) {
+	rec[i] = rec[analysis->gcstr->gcstr[i].idx];
+	analysis->gcstr->gcstr[i].flag = rec[i] & 0x0F;
+	rec[i] >>= 4;
+    }
+    analysis->brk = rec;
+    return analysis;
+}
+
+/*
+ * Output a line consists of clusters [beg, sbeg) of gcstr followed by
+ * spaces [sbeg, end).  Returns 0, or -1 on error.
+ */
+static
+int _put_range(linebreak_t * lbobj, _output_t * out,
+	       linebreak_state_t action, gcstring_t * gcstr, size_t beg,
+	       size_t sbeg, size_t end)
+{
+    gcstring_t *s, *t = NULL;
+    int ret = -1;
+
+    if ((s = gcstring_substr(gcstr, beg, sbeg - beg)) == NULL ||
+	(t = gcstring_substr(gcstr, sbeg, end - sbeg)) == NULL)
+	lbobj->errnum = errno ? errno : ENOMEM;
+    else
+	ret = _put_formatted(lbobj, out, action, s, t);
+    gcstring_destroy(s);
+    gcstring_destroy(t);
+    return ret;
+}
+
+/** Lay out analyzed text.
+ *
+ * Lines are broken by current colmax of lbobj.  lbobj should be
+ * configured as it was by linebreak_analyze() except colmax.
+ * Result is the same as linebreak_break() on analyzed text by lbobj with
+ * initial state.
+ *
+ * If configuration differs or analysis keeps only text, whole line
+ * breaking is performed and partial state of lbobj is reset.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] analysis analysis made by linebreak_analyze().
+ * @return array of broken grapheme cluster strings terminated by NULL.
+ * If error occurred, lbobj->errnum is set then NULL is returned.
+ */
+gcstring_t **linebreak_reflow(linebreak_t * lbobj,
+			      linebreak_analysis_t * analysis)
+{
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+    gcstring_t *gcstr;
+    linebreak_t *obj;
+    unistr_t unistr;
+    unsigned char *brk;
+    size_t i, j, k, lbeg, sbeg;
+    double bufCols, spcCols, frgCols, newcols, w;
+    int ret = 0;
+
+    if (analysis == NULL) {
+	lbobj->errnum = EINVAL;
+	return NULL;
+    }
+    gcstr = analysis->gcstr;
+    if (analysis->brk == NULL ||
+	analysis->confhash != _analysis_confhash(lbobj)) {
+	linebreak_reset(lbobj);
+	unistr.str = gcstr->str;
+	unistr.len = gcstr->len;
+	return linebreak_break(lbobj, &unistr);
+    }
+    /* lines shall refer lbobj. */
+    obj = gcstr->lbobj;
+    gcstr->lbobj = lbobj;
+    brk = analysis->brk;
+
+    /*
+     * Line buffer is [lbeg, sbeg) followed by spaces [sbeg, i).
+     * Each fragment is [i, j) followed by spaces [j, k).
+     */
+    lbeg = sbeg = 0;
+    bufCols = spcCols = 0.0;
+    for (i = 0; i < gcstr->gclen; i = k) {
+	frgCols = 0.0;
+	for (j = i; j < gcstr->gclen; j++) {
+	    if ((i < j && brk[j] & LINEBREAK_ANALYSIS_BREAK) ||
+		brk[j] & LINEBREAK_ANALYSIS_SPACE)
+		break;
+	    frgCols += (lbobj->sizing_func == NULL) ? 1.0 :
+		(double) gcstr->gcstr[j].col;
+	}
+	w = 0.0;
+	for (k = j; k < gcstr->gclen; k++) {
+	    if (i < k && brk[k] & LINEBREAK_ANALYSIS_BREAK)
+		break;
+	    w += (lbobj->sizing_func == NULL) ? 1.0 :
+		(double) gcstr->gcstr[k].col;
+	}
+
+	/* Arbitrary break. */
+	newcols = bufCols + spcCols + frgCols;
+	if (0 < lbobj->colmax && lbobj->colmax < newcols) {
+	    if (lbeg < i &&
+		(ret = _put_range(lbobj, &out, LINEBREAK_STATE_EOL, gcstr,
+				  lbeg, sbeg, i)) != 0)
+		break;
+	    lbeg = i;
+	    bufCols = frgCols;
+	} else
+	    bufCols = newcols;
+	sbeg = j;
+	spcCols = w;
+
+	/* Mandatory break, unless at end of text. */
+	if (gcstr->gclen <= k)
+	    break;
+	if (brk[k - 1] & LINEBREAK_ANALYSIS_MANDATORY) {
+	    if ((ret = _put_range(lbobj, &out, LINEBREAK_STATE_EOP, gcstr,
+				  lbeg, sbeg, k)) != 0)
+		break;
+	    lbeg = sbeg = k;
+	    bufCols = spcCols = 0.0;
+	}
+    }
+
+    /* End of text. */
+    if (ret == 0)
+	ret = _put_range(lbobj, &out, LINEBREAK_STATE_EOT, gcstr,
+			 lbeg, sbeg, gcstr->gclen);
+    gcstr->lbobj = obj;
+
+    if (ret != 0) {
+	_output_free(lbobj, &out);
+	return NULL;
+    }
+    return _output_result(lbobj, &out);
+}
+
+/** Destroy analysis.
+ *
+ * @param[in] analysis analysis made by linebreak_analyze().
+ * @return none.
+ */
+void linebreak_analysis_destroy(linebreak_analysis_t * analysis)
+{
+    if (analysis == NULL)
+	return;
+    gcstring_destroy(analysis->gcstr);
+    SOMBOK_FREE(analysis->allocator, analysis->brk);
+    SOMBOK_FREE(analysis->allocator, analysis);
+}
+
+/** Paragraph of layout. */
+typedef struct {
+    /* Broken lines followed by text, allocated at once. */
+    gcstring_t **lines;
+    size_t nlines;
+    unistr_t text;
+    /*
+     * Offset of paragraph and index of its first line.  Those of the
+     * paragraphs after the gap are counted backward from end of text and
+     * end of lines, so that they are kept through edits before them.
+     */
+    size_t idx;
+    size_t line;
+} _para_t;
+
+/** Layout of text updated incrementally.  See linebreak_layout_new(). */
+struct linebreak_layout_t {
+    /*
+     * Table of paragraphs with a gap:  Paragraphs before the gap are at
+     * top of the array and the others are at bottom of it.  The gap is
+     * moved to each edit, so that edits at nearby places move few entries.
+     */
+    _para_t *paras;
+    size_t nparas;
+    size_t gap;
+    size_t parasiz;
+    /* Length of text and number of lines. */
+    size_t len;
+    size_t nlines;
+    /* Paragraph found last by linebreak_layout_line(). */
+    size_t cur;
+    unsigned long confhash;
+    const sombok_allocator_t *allocator;
+};
+
+#define LAYOUT_PARA(layout, i)						\
+    (((i) < (layout)->gap) ? (layout)->paras + (i) :			\
+     (layout)->paras + (layout)->parasiz - (layout)->nparas + (i))
+
+/* Offset of i-th paragraph, or length of text if i is nparas. */
+static
+size_t _layout_idx(linebreak_layout_t * layout, size_t i)
+{
+    if (i < layout->gap)
+	return layout->paras[i].idx;
+    if (i < layout->nparas)
+	return layout->len - LAYOUT_PARA(layout, i)->idx;
+    return layout->len;
+}
+
+/* Index of first line of i-th paragraph, or nlines if i is nparas. */
+static
+size_t _layout_line(linebreak_layout_t * layout, size_t i)
+{
+    if (i < layout->gap)
+	return layout->paras[i].line;
+    if (i < layout->nparas)
+	return layout->nlines - LAYOUT_PARA(layout, i)->line;
+    return layout->nlines;
+}
+
+/*
+ * Find the last paragraph of which offset (or index of first line, if
+ * byline is set) is not greater than n.  Layout must not be empty.
+ */
+static
+size_t _layout_find(linebreak_layout_t * layout, size_t n, int byline)
+{
+    size_t lo = 0, hi = layout->nparas, i;
+
+    while (lo + 1 < hi) {
+	i = (lo + hi) / 2;
+	if ((byline ? _layout_line(layout, i) : _layout_idx(layout, i)) <=
+	    n)
+	    lo = i;
+	else
+	    hi = i;
+    }
+    return lo;
+}
+
+/* Move the gap to just before i-th paragraph. */
+static
+void _layout_move_gap(linebreak_t * lbobj, linebreak_layout_t * layout,
+		      size_t i)
+{
+    size_t gapsiz = layout->parasiz - layout->nparas;
+    _para_t *p;
+
+    STATS_ADD(lbobj, moved,
+	      (i < layout->gap) ? layout->gap - i : i - layout->gap);
+    while (i < layout->gap) {
+	layout->gap--;
+	p = layout->paras + layout->gap;
+	p->idx = layout->len - p->idx;
+	p->line = layout->nlines - p->line;
+	layout->paras[layout->gap + gapsiz] = *p;
+    }
+    while (layout->gap < i) {
+	p = layout->paras + layout->gap + gapsiz;
+	p->idx = layout->len - p->idx;
+	p->line = layout->nlines - p->line;
+	layout->paras[layout->gap] = *p;
+	layout->gap++;
+    }
+}
+
+/* Append n characters to buf of which size is *sizp.  Returns 0, or -1. */
+static
+int _layout_append(linebreak_t * lbobj, linebreak_layout_t * layout,
+		   unistr_t * buf, size_t * sizp, unichar_t * str, size_t n)
+{
+    unichar_t *s;
+    size_t siz;
+
+    if (*sizp < buf->len + n) {
+	for (siz = *sizp ? *sizp : 256; siz < buf->len + n; siz *= 2);
+	if ((s = SOMBOK_REALLOC(layout->allocator, buf->str,
+				sizeof(unichar_t) * siz)) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    return -1;
+	}
+	buf->str = s;
+	*sizp = siz;
+    }
+    if (n)
+	memcpy(buf->str + buf->len, str, sizeof(unichar_t) * n);
+    buf->len += n;
+    STATS_ADD(lbobj, moved, n);
+    return 0;
+}
+
+/*
+ * Append the part of text of i-th paragraph in the range [beg, end) of
+ * offsets to buf.  Returns 0, or -1 on error.
+ */
+static
+int _layout_append_para(linebreak_t * lbobj, linebreak_layout_t * layout,
+			size_t i, size_t beg, size_t end, unistr_t * buf,
+			size_t * sizp)
+{
+    _para_t *p = LAYOUT_PARA(layout, i);
+    size_t idx = _layout_idx(layout, i);
+
+    if (beg < idx)
+	beg = idx;
+    if (idx + p->text.len < end)
+	end = idx + p->text.len;
+    if (end <= beg)
+	return 0;
+    return _layout_append(lbobj, layout, buf, sizp,
+			  p->text.str + beg - idx, end - beg);
+}
+
+/** Create layout of text.
+ *
+ * Layout keeps text with broken lines by paragraphs.  It may be updated by
+ * linebreak_layout_edit().  Partial state of lbobj is reset.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @return New layout.
+ * If error occurred, lbobj->errnum is set then NULL is returned.
+ */
+linebreak_layout_t *linebreak_layout_new(linebreak_t * lbobj,
+					 unistr_t * input)
+{
+    linebreak_layout_t *layout;
+
+    if ((layout = SOMBOK_MALLOC(lbobj->allocator,
+				sizeof(linebreak_layout_t))) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    memset(layout, 0, sizeof(linebreak_layout_t));
+    layout->allocator = lbobj->allocator;
+    layout->confhash = linebreak_cache_confhash(lbobj);
+
+    if (linebreak_layout_edit(lbobj, layout, 0, 0, input) != 0) {
+	linebreak_layout_destroy(layout);
+	return NULL;
+    }
+    return layout;
+}
+
+/** Replace a part of text and update layout.
+ *
+ * Paragraphs are broken again from one containing the edit, until a
+ * paragraph ends at the same place as before.  Following paragraphs are
+ * reused without being visited.  Thus lines will be the same as
+ * linebreak_break() on whole text with initial state, while cost is
+ * proportional to size of affected paragraphs, plus number of paragraphs
+ * between this edit and the previous one.
+ * If configuration of lbobj was changed, whole text is broken again.
+ * Partial state of lbobj is reset.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @param[in] pos offset of text to be replaced.
+ * @param[in] len length of text to be replaced.
+ * @param[in] input Unicode string to be inserted, or NULL.
+ * @return 0.
+ * If error occurred, lbobj->errnum is set then -1 is returned and layout
+ * is not modified.
+ */
+int linebreak_layout_edit(linebreak_t * lbobj, linebreak_layout_t * layout,
+			  size_t pos, size_t len, unistr_t * input)
+{
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+    unistr_t buf = { NULL, 0 };
+    _para_t *newparas = NULL, *p;
+    size_t inslen, nparas, bufsiz = 0, newsiz = 0, nnew = 0, siz;
+    size_t first, next, keep, r, base, beg, end, line, i, j, n;
+    unsigned long confhash;
+    const sombok_allocator_t *alloc;
+
+    if (layout == NULL || layout->len < pos || layout->len - pos < len) {
+	lbobj->errnum = EINVAL;
+	return -1;
+    }
+    alloc = layout->allocator;
+    inslen = (input == NULL) ? 0 : input->len;
+    nparas = layout->nparas;
+    confhash = linebreak_cache_confhash(lbobj);
+
+    /*
+     * First affected paragraph contains the character just before pos,
+     * since it may be joined with inserted text (e.g. CR and LF).  Old
+     * paragraphs from it are put after the gap.
+     */
+    first = 0;
+    if (confhash == layout->confhash && 0 < pos)
+	first = _layout_find(layout, pos - 1, 0);
+    _layout_move_gap(lbobj, layout, first);
+    base = _layout_idx(layout, first);
+
+    /* New text from the first paragraph to the end of replaced text. */
+    for (next = first; next < nparas &&
+	 _layout_idx(layout, next) < pos + len; next++)
+	if (_layout_append_para(lbobj, layout, next, base, pos, &buf,
+				&bufsiz) != 0)
+	    goto ABORT;
+    if (_layout_append(lbobj, layout, &buf, &bufsiz,
+		       (input == NULL) ? NULL : input->str, inslen) != 0)
+	goto ABORT;
+    for (i = first; i < next; i++)
+	if (_layout_append_para(lbobj, layout, i, pos + len, (size_t) - 1,
+				&buf, &bufsiz) != 0)
+	    goto ABORT;
+
+    /*
+     * Break paragraphs until one ends at an end of old paragraph after
+     * the replaced text.  Old paragraphs are appended to buf when end of
+     * paragraph is not found in it.  Those from keep are reused.
+     */
+    r = (first < next) ? next - 1 : first;
+    keep = nparas;
+    for (beg = 0;; beg = end) {
+	end = _search_eop(lbobj, &buf, beg, buf.len);
+	while (end == buf.len && next < nparas) {
+	    if (_layout_append_para(lbobj, layout, next, 0, (size_t) - 1,
+				    &buf, &bufsiz) != 0)
+		goto ABORT;
+	    next++;
+	    end = _search_eop(lbobj, &buf, beg, buf.len);
 	}
-	if (appelen) {
-	    if ((r = realloc(ret,
-			     sizeof(gcstring_t *) *
-			     (retlen + appelen + 1))) == NULL) {
+	if (newsiz <= nnew + 1) {
+	    newsiz = newsiz ? newsiz * 2 : 16;
+	    if ((p = SOMBOK_REALLOC(alloc, newparas,
+				    sizeof(_para_t) * newsiz)) == NULL) {
 		lbobj->errnum = errno ? errno : ENOMEM;
-		for (i = 0; i < retlen; i++)
-		    gcstring_destroy(ret[i]);
-		free(ret);
-		for (j = 0; j < appelen; j++)
-		    gcstring_destroy(appe[j]);
-		free(appe);
-		return NULL;
-	    } else
-		ret = r;
-	    memcpy(ret + retlen, appe,
-		   sizeof(gcstring_t *) * (appelen + 1));
-	    retlen += appelen;
+		goto ABORT;
+	    }
+	    newparas = p;
+	}
+	newparas[nnew].lines = NULL;
+	newparas[nnew].idx = beg;
+	newparas[nnew].line = out.reslen;
+	if (buf.len <= beg) {
+	    keep = next;
+	    break;
+	}
+	nnew++;
+
+	linebreak_reset(lbobj);
+	if (0 < base + beg)
+	    lbobj->state = LINEBREAK_STATE_SOT;
+	if (_break_span(lbobj, &buf, beg, end, (end < buf.len), &out) != 0)
+	    goto ABORT;
+
+	if (confhash != layout->confhash)
+	    continue;
+	while (r < next && _layout_idx(layout, r + 1) - len - base + inslen
+	       < end)
+	    r++;
+	if (r < next && _layout_idx(layout, r + 1) - len - base + inslen
+	    == end) {
+	    keep = r + 1;
+	    newparas[nnew].lines = NULL;
+	    newparas[nnew].idx = end;
+	    newparas[nnew].line = out.reslen;
+	    break;
 	}
-	free(appe);
     }
-    unistr.len = input->len - k;
-    unistr.str = input->str + k;
-    if (k < input->len) {
-	if ((appe = _break_partial(lbobj, &unistr, &appelen, 1)) == NULL) {
-	    for (i = 0; i < retlen; i++)
-		gcstring_destroy(ret[i]);
-	    free(ret);
+
+    /* Allocate new paragraphs and room in the table for them. */
+    for (i = 0; i < nnew; i++) {
+	p = newparas + i;
+	p->nlines = newparas[i + 1].line - p->line;
+	p->text.len = newparas[i + 1].idx - p->idx;
+	if ((p->lines = SOMBOK_MALLOC(alloc, sizeof(gcstring_t *) *
+				      p->nlines + sizeof(unichar_t) *
+				      p->text.len)) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    goto ABORT;
+	}
+    }
+    n = nparas - (keep - first) + nnew;
+    if (layout->parasiz < n) {
+	siz = layout->parasiz ? layout->parasiz * 2 : 16;
+	if (siz < n)
+	    siz = n;
+	if ((p = SOMBOK_REALLOC(alloc, layout->paras,
+				sizeof(_para_t) * siz)) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    goto ABORT;
+	}
+	memmove(p + siz - (nparas - first), p + layout->parasiz -
+		(nparas - first), sizeof(_para_t) * (nparas - first));
+	layout->paras = p;
+	layout->parasiz = siz;
+    }
+
+    /* Replace old paragraphs with new ones. */
+    line = _layout_line(layout, first);
+    n = _layout_line(layout, keep) - line;
+    for (i = first; i < keep; i++) {
+	p = LAYOUT_PARA(layout, i);
+	for (j = 0; j < p->nlines; j++)
+	    gcstring_destroy(p->lines[j]);
+	SOMBOK_FREE(alloc, p->lines);
+    }
+    layout->nparas -= keep - first;
+    for (i = 0; i < nnew; i++) {
+	p = layout->paras + layout->gap;
+	*p = newparas[i];
+	memcpy(p->lines, out.results + p->line,
+	       sizeof(gcstring_t *) * p->nlines);
+	p->text.str = (unichar_t *) (p->lines + p->nlines);
+	memcpy(p->text.str, buf.str + p->idx,
+	       sizeof(unichar_t) * p->text.len);
+	STATS_ADD(lbobj, moved, p->text.len);
+	p->idx += base;
+	p->line += line;
+	layout->gap++;
+	layout->nparas++;
+    }
+    layout->len = layout->len - len + inslen;
+    layout->nlines = layout->nlines - n + out.reslen;
+    layout->cur = first;
+    layout->confhash = confhash;
+
+    SOMBOK_FREE(alloc, buf.str);
+    SOMBOK_FREE(sombok_allocator, out.results);
+    SOMBOK_FREE(alloc, newparas);
+    return 0;
+
+  ABORT:
+    for (i = 0; i < nnew; i++)
+	SOMBOK_FREE(alloc, newparas[i].lines);
+    SOMBOK_FREE(alloc, buf.str);
+    SOMBOK_FREE(alloc, newparas);
+    _output_free(lbobj, &out);
+    return -1;
+}
+
+/** Get a line of layout.
+ *
+ * Lines next to the line got last are found without search.
+ *
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @param[in] n index of line.
+ * @return n-th line, or NULL if n is not less than number of lines.  Line
+ * belongs to layout:  It must not be modified nor destroyed, and is valid
+ * until layout is edited or destroyed.
+ */
+gcstring_t *linebreak_layout_line(linebreak_layout_t * layout, size_t n)
+{
+    size_t i;
+
+    if (layout == NULL || layout->nlines <= n)
+	return NULL;
+    i = layout->cur;
+    if (layout->nparas <= i || n < _layout_line(layout, i) ||
+	_layout_line(layout, i + 1) <= n) {
+	i++;
+	if (layout->nparas <= i || n < _layout_line(layout, i) ||
+	    _layout_line(layout, i + 1) <= n)
+	    i = _layout_find(layout, n, 1);
+    }
+    layout->cur = i;
+    return LAYOUT_PARA(layout, i)->lines[n - _layout_line(layout, i)];
+}
+
+/** Get number of lines of layout.
+ *
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @return number of lines.
+ */
+size_t linebreak_layout_nlines(linebreak_layout_t * layout)
+{
+    return (layout == NULL) ? 0 : layout->nlines;
+}
+
+/** Get length of text of layout.
+ *
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @return length of text.
+ */
+size_t linebreak_layout_length(linebreak_layout_t * layout)
+{
+    return (layout == NULL) ? 0 : layout->len;
+}
+
+/** Copy a part of text of layout.
+ *
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @param[in] pos offset of text.
+ * @param[in] len maximum length to be copied.
+ * @param[out] buf buffer to store at most len characters.
+ * @return number of characters stored.
+ */
+size_t linebreak_layout_text(linebreak_layout_t * layout, size_t pos,
+			     size_t len, unichar_t * buf)
+{
+    _para_t *p;
+    size_t i, beg, n, ret = 0;
+
+    if (layout == NULL || layout->len <= pos)
+	return 0;
+    if (layout->len - pos < len)
+	len = layout->len - pos;
+    for (i = _layout_find(layout, pos, 0); ret < len; i++) {
+	p = LAYOUT_PARA(layout, i);
+	beg = pos + ret - _layout_idx(layout, i);
+	n = p->text.len - beg;
+	if (len - ret < n)
+	    n = len - ret;
+	memcpy(buf + ret, p->text.str + beg, sizeof(unichar_t) * n);
+	ret += n;
+    }
+    return ret;
+}
+
+/** Destroy layout.
+ *
+ * @param[in] layout layout made by linebreak_layout_new().
+ * @return none.
+ */
+void linebreak_layout_destroy(linebreak_layout_t * layout)
+{
+    _para_t *p;
+    size_t i, j;
+
+    if (layout == NULL)
+	return;
+    for (i = 0; i < layout->nparas; i++) {
+	p = LAYOUT_PARA(layout, i);
+	for (j = 0; j < p->nlines; j++)
+	    gcstring_destroy(p->lines[j]);
+	SOMBOK_FREE(layout->allocator, p->lines);
+    }
+    SOMBOK_FREE(layout->allocator, layout->paras);
+    SOMBOK_FREE(layout->allocator, layout);
+}
+
+/** Iterator of broken lines.  See linebreak_iter_new(). */
+struct linebreak_iter_t {
+    linebreak_t *lbobj;
+    unistr_t input;
+    size_t pos;
+    /* Lines determined but not yet returned. */
+    _output_t out;
+    size_t cur;
+};
+
+/** Create iterator to get broken lines one by one.
+ *
+ * Lines are the same as linebreak_break() on input.  Input is broken
+ * lazily by chunks of at most a few thousand characters each time
+ * linebreak_iter_next() runs out of determined lines, so that getting
+ * the first lines of huge text costs only a fraction of breaking whole
+ * text.
+ * Input is not copied:  It must not be modified nor freed until the
+ * iterator is destroyed.  lbobj will be referred by the iterator and its
+ * partial state will be changed by linebreak_iter_next().
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @return new iterator.
+ * If error occurred, lbobj->errnum is set then NULL is returned.
+ */
+linebreak_iter_t *linebreak_iter_new(linebreak_t * lbobj, unistr_t * input)
+{
+    linebreak_iter_t *it;
+
+    if ((it = SOMBOK_MALLOC(lbobj->allocator, sizeof(linebreak_iter_t)))
+	== NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    memset(it, 0, sizeof(linebreak_iter_t));
+    it->lbobj = linebreak_incref(lbobj);
+    if (input != NULL)
+	it->input = *input;
+    return it;
+}
+
+/** Get next broken line.
+ *
+ * @param[in] it iterator made by linebreak_iter_new().
+ * @return next line which should be destroyed by caller, or NULL at end of
+ * input.
+ * If error occurred, errnum of linebreak object is set then NULL is
+ * returned; iterator will return no more lines.
+ */
+gcstring_t *linebreak_iter_next(linebreak_iter_t * it)
+{
+    while (it->out.reslen <= it->cur) {
+	it->out.reslen = 0;
+	it->cur = 0;
+	if (it->input.len <= it->pos)
+	    return NULL;
+	if (_break_chunk(it->lbobj, &it->input, &it->pos, it->input.len, 0,
+			 &it->out) != 0) {
+	    while (it->cur < it->out.reslen)
+		gcstring_destroy(it->out.results[it->cur++]);
+	    it->out.reslen = 0;
+	    it->pos = it->input.len;
 	    return NULL;
 	}
-	if (appelen) {
-	    if ((r = realloc(ret,
-			     sizeof(gcstring_t *) *
-			     (retlen + appelen + 1))) == NULL) {
-		lbobj->errnum = errno ? errno : ENOMEM;
-		for (i = 0; i < retlen; i++)
-		    gcstring_destroy(ret[i]);
-		free(ret);
-		for (j = 0; j < appelen; j++)
-		    gcstring_destroy(appe[j]);
-		free(appe);
+    }
+    return it->out.results[it->cur++];
+}
+
+/** Destroy iterator.  Lines not yet returned are discarded.
+ *
+ * @param[in] it iterator made by linebreak_iter_new().
+ * @return none.
+ */
+void linebreak_iter_destroy(linebreak_iter_t * it)
+{
+    const sombok_allocator_t *alloc;
+
+    if (it == NULL)
+	return;
+    alloc = it->lbobj->allocator;
+    while (it->cur < it->out.reslen)
+	gcstring_destroy(it->out.results[it->cur++]);
+    SOMBOK_FREE(sombok_allocator, it->out.results);
+    linebreak_destroy(it->lbobj);
+    SOMBOK_FREE(alloc, it);
+}
+
+/*
+ * Check if line may be broken before i-th grapheme cluster of str,
+ * possibly after spaces.
+ */
+static
+int _may_break_before(linebreak_t * lbobj, gcstring_t * str, size_t i)
+{
+    propval_t albc, blbc, action;
+    size_t j;
+
+    if (str->gcstr[i].flag & LINEBREAK_FLAG_ALLOW_BEFORE)
+	return 1;
+    if (str->gcstr[i].flag & LINEBREAK_FLAG_PROHIBIT_BEFORE)
+	return 0;
+    if ((albc = gcstring_lbclass(str, i)) == LB_SP || albc == LB_CM)
+	return 0;
+    for (j = i; 0 < j && gcstring_lbclass(str, j - 1) == LB_SP; j--);
+    if (j == 0)
+	return 0;
+    blbc = gcstring_lbclass_ext(str, j - 1);
+    action = _lbruleinfo(_lbclass_resolve(lbobj, blbc),
+			 _lbclass_resolve(lbobj, albc));
+    return (action == LINEBREAK_ACTION_DIRECT ||
+	    (j < i && action == LINEBREAK_ACTION_INDIRECT));
+}
+
+/*
+ * Truncate line so that ellipsis appended to it fits in colmax columns.
+ * Line is truncated at the last breaking opportunity, or at a grapheme
+ * cluster boundary if there are none.  Trailing spaces are discarded but
+ * newline is kept.
+ */
+static
+gcstring_t *_ellipsize(linebreak_t * lbobj, gcstring_t * line,
+		       gcstring_t * ellipsis)
+{
+    gcstring_t empty = { NULL, 0, NULL, 0, 0, lbobj };
+    gcstring_t *ret, *sub;
+    size_t eol, end, fit, brk, i;
+    double ellCols, cols;
+    propval_t lbc;
+
+    for (eol = line->gclen; 0 < eol; eol--)
+	if ((lbc = gcstring_lbclass(line, eol - 1)) != LB_BK &&
+	    lbc != LB_CR && lbc != LB_LF && lbc != LB_NL)
+	    break;
+    for (end = eol; 0 < end && gcstring_lbclass(line, end - 1) == LB_SP;
+	 end--);
+
+    fit = end;
+    if (0 < lbobj->colmax) {
+	ellCols = _sizing(lbobj, 0.0, &empty, &empty, ellipsis);
+	fit = brk = 0;
+	cols = 0.0;
+	for (i = 1; i <= end; i++) {
+	    if (SIZING_IS_NATIVE(lbobj))
+		cols += (lbobj->sizing_func == NULL) ? 1.0 :
+		    (double) line->gcstr[i - 1].col;
+	    else {
+		if ((sub = gcstring_substr(line, 0, i)) == NULL) {
+		    lbobj->errnum = errno ? errno : ENOMEM;
+		    return NULL;
+		}
+		cols = _sizing(lbobj, 0.0, &empty, &empty, sub);
+		gcstring_destroy(sub);
+	    }
+	    if (lbobj->colmax < cols + ellCols)
+		break;
+	    fit = i;
+	    if (i < end && _may_break_before(lbobj, line, i))
+		brk = i;
+	}
+	if (fit < end && 0 < brk)
+	    fit = brk;
+	while (0 < fit && gcstring_lbclass(line, fit - 1) == LB_SP)
+	    fit--;
+    }
+
+    if ((ret = gcstring_substr(line, 0, fit)) == NULL ||
+	(sub = gcstring_substr(line, eol, line->gclen - eol)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	gcstring_destroy(ret);
+	return NULL;
+    }
+    if (gcstring_append(ret, ellipsis) == NULL ||
+	gcstring_append(ret, sub) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	gcstring_destroy(ret);
+	ret = NULL;
+    }
+    gcstring_destroy(sub);
+    return ret;
+}
+
+/** Perform line breaking algorithm on beginning of input.
+ *
+ * Lines are the same as first ones by linebreak_break(), but input
+ * following the chunk containing maxlines-th line is not processed.
+ * If input continues after maxlines-th line and ellipsis is given, that
+ * line is truncated at a breaking opportunity (or a grapheme cluster
+ * boundary if there are none) so that ellipsis appended to it fits in
+ * colmax columns.
+ * Partial state of lbobj is reset unless error occurred.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @param[in] maxlines maximum number of lines.  0 means no limit.
+ * @param[in] ellipsis grapheme cluster string appended to the last line,
+ * or NULL.
+ * @return array of at most maxlines broken grapheme cluster strings
+ * terminated by NULL.
+ * If internal error occurred, lbobj->errnum is set then NULL is returned.
+ */
+gcstring_t **linebreak_break_preview(linebreak_t * lbobj, unistr_t * input,
+				     size_t maxlines, gcstring_t * ellipsis)
+{
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+    gcstring_t *line, **ret;
+    size_t pos = 0;
+
+    if (maxlines == 0) {
+	if ((ret = linebreak_break(lbobj, input)) != NULL)
+	    linebreak_reset(lbobj);
+	return ret;
+    }
+
+    if (input != NULL)
+	while (out.reslen <= maxlines && pos < input->len)
+	    if (_break_chunk(lbobj, input, &pos, input->len, 0, &out) != 0) {
+		_output_free(lbobj, &out);
+		return NULL;
+	    }
+    linebreak_reset(lbobj);
+
+    /* Input continues after maxlines-th line. */
+    if (maxlines < out.reslen) {
+	while (maxlines < out.reslen)
+	    gcstring_destroy(out.results[--out.reslen]);
+	out.results[out.reslen] = NULL;
+	if (ellipsis != NULL) {
+	    if ((line = _ellipsize(lbobj, out.results[maxlines - 1],
+				   ellipsis)) == NULL) {
+		_output_free(lbobj, &out);
 		return NULL;
-	    } else
-		ret = r;
-	    memcpy(ret + retlen, appe,
-		   sizeof(gcstring_t *) * (appelen + 1));
-	    retlen += appelen;
+	    }
+	    gcstring_destroy(out.results[maxlines - 1]);
+	    out.results[maxlines - 1] = line;
+	}
+    }
+    return _output_result(lbobj, &out);
+}
+
+#ifdef USE_PTHREAD
+typedef struct {
+    linebreak_t *lbobj;
+    unistr_t *input;
+    size_t beg, end;
+    int eop;
+    int running;
+    int failed;
+    gcstring_t **result;
+    size_t reslen;
+} _span_t;
+
+static
+void *_break_span_thread(void *arg)
+{
+    _span_t *span = (_span_t *) arg;
+    _output_t out = { NULL, NULL, NULL, 0, 0 };
+
+    if (_break_span(span->lbobj, span->input, span->beg, span->end,
+		    span->eop, &out) != 0) {
+	_output_free(span->lbobj, &out);
+	span->failed = 1;
+    } else {
+	span->result = out.results;
+	span->reslen = out.reslen;
+    }
+    return NULL;
+}
+
+#endif				/* USE_PTHREAD */
+
+/** Perform line breaking algorithm on complete input using threads.
+ *
+ * Input is divided into spans at mandatory breaks, and each span is broken
+ * by its own thread with a session of linebreak object (see
+ * linebreak_session_new()).
+ * Result is the same as linebreak_break().
+ *
+ * Callback functions may be called concurrently from several threads
+ * (with distinct copies of lbobj), so they must be reentrant.
+ * If the library was built without thread support, or if prep_func or
+ * user_func is set, input is broken sequentially by linebreak_break().
+ *
+ * Note that grapheme cluster strings in result may refer to sessions of
+ * lbobj.
+ *
+ * @param[in] lbobj linebreak object.
+ * @param[in] input Unicode string.
+ * @param[in] nthreads maximum number of threads including caller.
+ * @return array of broken grapheme cluster strings terminated by NULL.
+ * If internal error occurred, lbobj->errnum is set then NULL is returned.
+ */
+gcstring_t **linebreak_break_parallel(linebreak_t * lbobj, unistr_t * input,
+				      int nthreads)
+{
+#ifdef USE_PTHREAD
+    _span_t *spans;
+    pthread_t *threads;
+    gcstring_t **ret = NULL;
+    size_t i, j, n, pos, retlen;
+    int errnum;
+    const sombok_allocator_t *alloc = lbobj->allocator;
+
+    if (input == NULL || lbobj->user_func != NULL ||
+	lbobj->prep_func != NULL || nthreads <= 1 ||
+	input->len / PARTIAL_LENGTH < 2)
+	return linebreak_break(lbobj, input);
+    if (input->len / PARTIAL_LENGTH < (size_t) nthreads)
+	nthreads = (int) (input->len / PARTIAL_LENGTH);
+
+    if ((spans = SOMBOK_MALLOC(alloc, sizeof(_span_t) * nthreads)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    if ((threads = SOMBOK_MALLOC(alloc, sizeof(pthread_t) * nthreads)) ==
+	NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	SOMBOK_FREE(alloc, spans);
+	return NULL;
+    }
+
+    /* Divide input. */
+    pos = 0;
+    for (n = 0; n < (size_t) nthreads && pos < input->len; n++) {
+	spans[n].input = input;
+	spans[n].beg = pos;
+	if (n + 1 < (size_t) nthreads)
+	    pos = _search_eop(lbobj, input,
+			      input->len / nthreads * (n + 1) < pos ?
+			      pos : input->len / nthreads * (n + 1),
+			      input->len);
+	else
+	    pos = input->len;
+	spans[n].end = pos;
+	spans[n].eop = (pos < input->len);
+	spans[n].running = 0;
+	spans[n].failed = 0;
+	spans[n].result = NULL;
+	spans[n].reslen = 0;
+
+	/* The first span inherits state of lbobj; following ones start
+	 * at start of paragraph. */
+	if (n == 0)
+	    spans[n].lbobj = lbobj;
+	else if ((spans[n].lbobj = linebreak_session_new(lbobj)) == NULL) {
+	    lbobj->errnum = errno ? errno : ENOMEM;
+	    for (i = 1; i < n; i++)
+		linebreak_destroy(spans[i].lbobj);
+	    SOMBOK_FREE(alloc, threads);
+	    SOMBOK_FREE(alloc, spans);
+	    return NULL;
+	} else
+	    spans[n].lbobj->state = LINEBREAK_STATE_SOT;
+    }
+
+    /* Break spans. */
+    for (i = 1; i < n; i++)
+	spans[i].running = (pthread_create(&threads[i], NULL,
+					   _break_span_thread,
+					   &spans[i]) == 0);
+    _break_span_thread(&spans[0]);
+    for (i = 1; i < n; i++) {
+	if (spans[i].running)
+	    pthread_join(threads[i], NULL);
+	else
+	    /* thread could not be created: run it in this thread. */
+	    _break_span_thread(&spans[i]);
+    }
+    SOMBOK_FREE(alloc, threads);
+
+    /* Concatenate results. */
+    errnum = 0;
+    retlen = 0;
+    for (i = 0; i < n; i++) {
+	if (spans[i].failed) {
+	    if (errnum == 0)
+		errnum = spans[i].lbobj->errnum ?
+		    spans[i].lbobj->errnum : EINVAL;
+	} else
+	    retlen += spans[i].reslen;
+    }
+    if (errnum == 0 &&
+	(ret = SOMBOK_MALLOC(sombok_allocator,
+			     sizeof(gcstring_t *) * (retlen + 1))) == NULL)
+	errnum = errno ? errno : ENOMEM;
+    retlen = 0;
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < spans[i].reslen; j++)
+	    if (errnum)
+		gcstring_destroy(spans[i].result[j]);
+	    else
+		ret[retlen++] = spans[i].result[j];
+	SOMBOK_FREE(sombok_allocator, spans[i].result);
+	if (0 < i) {
+	    linebreak_stats_add(lbobj->stats, spans[i].lbobj->stats);
+	    linebreak_destroy(spans[i].lbobj);
 	}
-	free(appe);
     }
+    SOMBOK_FREE(alloc, spans);
 
+    linebreak_reset(lbobj);
+    if (errnum) {
+	lbobj->errnum = errnum;
+	return NULL;
+    }
+    ret[retlen] = NULL;
     return ret;
+#else				/* USE_PTHREAD */
+    return linebreak_break(lbobj, input);
+#endif				/* USE_PTHREAD */
 }
 
 /** Perform line breaking algorithm on UTF-8 text
@@ -1338,14 +3228,25 @@ gcstring_t **linebreak_break_from_utf8(linebreak_t * lbobj,
 	lbobj->errnum = EINVAL;
 	return NULL;
     }
-    if (sombok_decode_utf8(&unistr, 0, input, len, check) == NULL)
+    if (sombok_decode_utf8_with_allocator(lbobj->allocator, &unistr, 0,
+					  input, len, check) == NULL)
 	return NULL;
 
     ret = linebreak_break(lbobj, &unistr);
-    free(unistr.str);
+    SOMBOK_FREE(lbobj->allocator, unistr.str);
     return ret;
 }
 
+/** Release array of broken lines.
+ *
+ * Arrays of lines are allocated by default allocator (see
+ * sombok_set_allocator()), while lines are allocated by allocator of
+ * linebreak object.  If custom allocator might be used, arrays should be
+ * released by this function, not by free(3).
+ * @param[in] result array returned by linebreak_break() and so on.
+ * @param[in] deep if non-zero, lines are also destroyed.
+ * @return none.
+ */
 void linebreak_free_result(gcstring_t ** result, int deep)
 {
     size_t i;
@@ -1355,5 +3256,5 @@ void linebreak_free_result(gcstring_t ** result, int deep)
     if (deep)
 	for (i = 0; result[i] != NULL; i++)
 	    gcstring_destroy(result[i]);
-    free(result);
+    SOMBOK_FREE(sombok_allocator, result);
 }
@@ -0,0 +1,455 @@
+/*
+ * cache.c - cache of line breaking results.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+#include "sombok_constants.h"
+#include "sombok.h"
+
+/** @defgroup linebreak_cache cache
+ * @brief Cache results of line breaking by paragraph
+ *
+ * Results of linebreak_break() and linebreak_break_to_sink() may be
+ * cached by each paragraph, i.e. text terminated by a mandatory break.
+ * Paragraphs are looked up by their content and a hash of configuration
+ * of linebreak object, and least recently used ones are evicted when
+ * total size exceeds the limit.
+ *@{*/
+
+typedef struct _entry_t {
+    /** chain of hash bucket */
+    struct _entry_t *hnext;
+    /** LRU list: previous is more recently used */
+    struct _entry_t *prev, *next;
+    /** hash of text and key */
+    unsigned long hash;
+    /** configuration and kind of paragraph */
+    unsigned long confhash;
+    int kind;
+    /** paragraph */
+    unistr_t text;
+    /** broken lines */
+    size_t nlines;
+    size_t *lens;
+    unichar_t *str;
+    gcchar_t *gcstr;
+    /** memory consumed by entry */
+    size_t size;
+} _entry_t;
+
+struct linebreak_cache_t {
+    size_t maxsize;
+    size_t size;
+    size_t nentries;
+    _entry_t **buckets;
+    size_t nbuckets;
+    _entry_t *head, *tail;
+    unsigned long hits;
+    unsigned long misses;
+    int bypass;
+    const sombok_allocator_t *allocator;
+};
+
+#define FNV_INIT (2166136261UL)
+#define FNV_PRIME (16777619UL)
+#define FNV(h, v) (((h) ^ (unsigned long)(v)) * FNV_PRIME)
+
+static
+unsigned long _hash_bytes(unsigned long h, const void *p, size_t len)
+{
+    const unsigned char *s = (const unsigned char *) p;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	h = FNV(h, s[i]);
+    return h;
+}
+
+static
+unsigned long _hash_text(unistr_t * text, unsigned long h)
+{
+    size_t i;
+
+    for (i = 0; i < text->len; i++)
+	h = FNV(h, text->str[i]);
+    return h;
+}
+
+static
+void _unlink(struct linebreak_cache_t *cache, _entry_t * ent)
+{
+    _entry_t **p;
+
+    for (p = cache->buckets + ent->hash % cache->nbuckets; *p != ent;
+	 p = &(*p)->hnext);
+    *p = ent->hnext;
+
+    if (ent->prev != NULL)
+	ent->prev->next = ent->next;
+    else
+	cache->head = ent->next;
+    if (ent->next != NULL)
+	ent->next->prev = ent->prev;
+    else
+	cache->tail = ent->prev;
+
+    cache->size -= ent->size;
+    cache->nentries--;
+}
+
+static
+void _entry_free(struct linebreak_cache_t *cache, _entry_t * ent)
+{
+    SOMBOK_FREE(cache->allocator, ent->text.str);
+    SOMBOK_FREE(cache->allocator, ent->lens);
+    SOMBOK_FREE(cache->allocator, ent->str);
+    SOMBOK_FREE(cache->allocator, ent->gcstr);
+    SOMBOK_FREE(cache->allocator, ent);
+}
+
+/** Destroy Cache
+ *
+ * @note this function is for internal use.
+ *
+ * @param[in] cache cache, or NULL.
+ * @return none.
+ */
+void linebreak_cache_destroy(struct linebreak_cache_t *cache)
+{
+    _entry_t *ent, *next;
+
+    if (cache == NULL)
+	return;
+    for (ent = cache->head; ent != NULL; ent = next) {
+	next = ent->next;
+	_entry_free(cache, ent);
+    }
+    SOMBOK_FREE(cache->allocator, cache->buckets);
+    SOMBOK_FREE(cache->allocator, cache);
+}
+
+/** Setter: Enable or disable cache
+ *
+ * Enable cache of line breaking results by paragraph, or disable and
+ * discard it.
+ *
+ * Paragraphs are cached by linebreak_break() and linebreak_break_to_sink(),
+ * only when neither prep_func nor user_func is set.  Other callbacks are
+ * identified by their functions and data arguments, so callbacks giving
+ * different results for the same input shall call linebreak_cache_bypass().
+ * Cache is not shared with copies nor sessions of lbobj.
+ * @param[in] lbobj target linebreak object, must not be NULL.
+ * @param[in] maxsize maximum bytes of memory used by cache, or 0 to
+ * disable cache.
+ * @return none.
+ * If error occurred, lbobj->errnum is set.
+ */
+void linebreak_set_cache(linebreak_t * lbobj, size_t maxsize)
+{
+    struct linebreak_cache_t *cache;
+    size_t nbuckets;
+
+    linebreak_cache_destroy(lbobj->cache);
+    lbobj->cache = NULL;
+    if (maxsize == 0)
+	return;
+
+    for (nbuckets = 64; nbuckets < maxsize / 1024 && nbuckets < 65536;
+	 nbuckets *= 2);
+    if ((cache = SOMBOK_MALLOC(lbobj->allocator,
+			       sizeof(struct linebreak_cache_t))) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
+    memset(cache, 0, sizeof(struct linebreak_cache_t));
+    cache->allocator = lbobj->allocator;
+    if ((cache->buckets = SOMBOK_MALLOC(cache->allocator,
+					sizeof(_entry_t *) * nbuckets)) ==
+	NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	SOMBOK_FREE(cache->allocator, cache);
+	return;
+    }
+    memset(cache->buckets, 0, sizeof(_entry_t *) * nbuckets);
+    cache->nbuckets = nbuckets;
+    cache->maxsize = maxsize;
+    lbobj->cache = cache;
+}
+
+/** Prevent Current Result from Being Cached
+ *
+ * Callback functions may call this so that the paragraph being broken
+ * will not be cached.
+ * @param[in] lbobj linebreak object.
+ * @return none.
+ */
+void linebreak_cache_bypass(linebreak_t * lbobj)
+{
+    if (lbobj != NULL && lbobj->cache != NULL)
+	lbobj->cache->bypass = 1;
+}
+
+/** Get Statistics of Cache
+ *
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[out] hits number of paragraphs found in cache, or NULL.
+ * @param[out] misses number of paragraphs not found in cache, or NULL.
+ * @param[out] size bytes of memory used by cache, or NULL.
+ * @return number of cached paragraphs.  If cache is disabled, 0 is returned
+ * and statistics are 0.
+ */
+size_t linebreak_get_cache_stats(linebreak_t * lbobj, unsigned long *hits,
+				 unsigned long *misses, size_t * size)
+{
+    struct linebreak_cache_t *cache = lbobj->cache;
+
+    if (hits != NULL)
+	*hits = cache ? cache->hits : 0;
+    if (misses != NULL)
+	*misses = cache ? cache->misses : 0;
+    if (size != NULL)
+	*size = cache ? cache->size : 0;
+    return cache ? cache->nentries : 0;
+}
+
+/** Hash of Configuration
+ *
+ * @note this function is for internal use.
+ *
+ * Compute hash of members of linebreak object which affect line breaking.
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @return hash value.
+ */
+unsigned long linebreak_cache_confhash(linebreak_t * lbobj)
+{
+    return linebreak_cache_confhash_colmax(lbobj, lbobj->colmax);
+}
+
+/** Hash of Configuration with Another colmax
+ *
+ * @note this function is for internal use.
+ *
+ * Same as linebreak_cache_confhash() but colmax is given instead of
+ * colmax member.  Object is not modified.
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[in] colmax value used instead of colmax member.
+ * @return hash value.
+ */
+unsigned long linebreak_cache_confhash_colmax(linebreak_t * lbobj,
+					      double colmax)
+{
+    unsigned long h = FNV_INIT;
+
+    h = _hash_bytes(h, &lbobj->charmax, sizeof(lbobj->charmax));
+    h = _hash_bytes(h, &colmax, sizeof(colmax));
+    h = _hash_bytes(h, &lbobj->colmin, sizeof(lbobj->colmin));
+    h = _hash_bytes(h, &lbobj->options, sizeof(lbobj->options));
+    if (lbobj->map != NULL)
+	h = _hash_bytes(h, lbobj->map, sizeof(mapent_t) * lbobj->mapsiz);
+    h = FNV(h, lbobj->mapsiz);
+    h = _hash_text(&lbobj->newline, h);
+    h = FNV(h, lbobj->newline.len);
+    h = _hash_bytes(h, &lbobj->format_func, sizeof(lbobj->format_func));
+    h = _hash_bytes(h, &lbobj->format_data, sizeof(lbobj->format_data));
+    h = _hash_bytes(h, &lbobj->sizing_func, sizeof(lbobj->sizing_func));
+    h = _hash_bytes(h, &lbobj->sizing_data, sizeof(lbobj->sizing_data));
+    h = _hash_bytes(h, &lbobj->urgent_func, sizeof(lbobj->urgent_func));
+    h = _hash_bytes(h, &lbobj->urgent_data, sizeof(lbobj->urgent_data));
+    return h;
+}
+
+/** Look Up Cache
+ *
+ * @note this function is for internal use.
+ *
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[in] text paragraph.
+ * @param[in] kind kind of paragraph determined by caller.
+ * @param[in] confhash hash by linebreak_cache_confhash().
+ * @param[out] nlines number of lines.
+ * @return array of new grapheme cluster strings, or NULL if not found.
+ * If error occurred, NULL is returned as if not found.
+ */
+gcstring_t **linebreak_cache_get(linebreak_t * lbobj, unistr_t * text,
+				 int kind, unsigned long confhash,
+				 size_t * nlines)
+{
+    struct linebreak_cache_t *cache = lbobj->cache;
+    _entry_t *ent;
+    gcstring_t **lines;
+    unsigned long hash;
+    size_t i, len, gclen, *lens;
+    unichar_t *str;
+    gcchar_t *gcstr;
+
+    hash = FNV(_hash_text(text, confhash), kind);
+    for (ent = cache->buckets[hash % cache->nbuckets]; ent != NULL;
+	 ent = ent->hnext)
+	if (ent->hash == hash && ent->confhash == confhash &&
+	    ent->kind == kind && ent->text.len == text->len &&
+	    memcmp(ent->text.str, text->str,
+		   sizeof(unichar_t) * text->len) == 0)
+	    break;
+    cache->bypass = 0;
+    if (ent == NULL) {
+	cache->misses++;
+	return NULL;
+    }
+
+    if ((lines = SOMBOK_MALLOC(sombok_allocator, sizeof(gcstring_t *) *
+			       (ent->nlines + 1))) == NULL)
+	return NULL;
+    str = ent->str;
+    gcstr = ent->gcstr;
+    for (i = 0, lens = ent->lens; i < ent->nlines; i++, lens += 3) {
+	len = lens[0];
+	gclen = lens[1];
+	if ((lines[i] = gcstring_new(NULL, lbobj)) == NULL ||
+	    (len && (lines[i]->str =
+		     SOMBOK_MALLOC(lbobj->allocator,
+				   sizeof(unichar_t) * len)) == NULL) ||
+	    (gclen && (lines[i]->gcstr =
+		       SOMBOK_MALLOC(lbobj->allocator,
+				     sizeof(gcchar_t) * gclen)) == NULL)) {
+	    gcstring_destroy(lines[i]);
+	    while (0 < i)
+		gcstring_destroy(lines[--i]);
+	    SOMBOK_FREE(sombok_allocator, lines);
+	    return NULL;
+	}
+	if (len)
+	    memcpy(lines[i]->str, str, sizeof(unichar_t) * len);
+	lines[i]->len = len;
+	if (gclen)
+	    memcpy(lines[i]->gcstr, gcstr, sizeof(gcchar_t) * gclen);
+	lines[i]->gclen = gclen;
+	lines[i]->pos = lens[2];
+	str += len;
+	gcstr += gclen;
+    }
+    lines[i] = NULL;
+    *nlines = ent->nlines;
+
+    /* Move to head of LRU list. */
+    if (ent->prev != NULL) {
+	ent->prev->next = ent->next;
+	if (ent->next != NULL)
+	    ent->next->prev = ent->prev;
+	else
+	    cache->tail = ent->prev;
+	ent->prev = NULL;
+	ent->next = cache->head;
+	cache->head->prev = ent;
+	cache->head = ent;
+    }
+    cache->hits++;
+    return lines;
+}
+
+/** Store into Cache
+ *
+ * @note this function is for internal use.
+ *
+ * Store copy of broken lines of a paragraph, unless
+ * linebreak_cache_bypass() was called after linebreak_cache_get().
+ * Failure is not an error: Paragraph is just not cached.
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[in] text paragraph.
+ * @param[in] kind kind of paragraph determined by caller.
+ * @param[in] confhash hash by linebreak_cache_confhash().
+ * @param[in] lines array of lines.
+ * @param[in] nlines number of lines.
+ * @return none.
+ */
+void linebreak_cache_put(linebreak_t * lbobj, unistr_t * text, int kind,
+			 unsigned long confhash, gcstring_t ** lines,
+			 size_t nlines)
+{
+    struct linebreak_cache_t *cache = lbobj->cache;
+    _entry_t *ent, **p;
+    size_t i, len = 0, gclen = 0, size;
+    unichar_t *str;
+    gcchar_t *gcstr;
+
+    if (cache->bypass)
+	return;
+
+    for (i = 0; i < nlines; i++) {
+	len += lines[i]->len;
+	gclen += lines[i]->gclen;
+    }
+    size = sizeof(_entry_t) + sizeof(unichar_t) * (text->len + len) +
+	sizeof(gcchar_t) * gclen + sizeof(size_t) * 3 * nlines;
+    if (cache->maxsize < size)
+	return;
+
+    if ((ent = SOMBOK_MALLOC(cache->allocator, sizeof(_entry_t))) == NULL)
+	return;
+    memset(ent, 0, sizeof(_entry_t));
+    if ((text->len &&
+	 (ent->text.str = SOMBOK_MALLOC(cache->allocator, sizeof(unichar_t) *
+					text->len)) == NULL) ||
+	(nlines &&
+	 (ent->lens = SOMBOK_MALLOC(cache->allocator, sizeof(size_t) * 3 *
+				    nlines)) == NULL) ||
+	(len &&
+	 (ent->str = SOMBOK_MALLOC(cache->allocator, sizeof(unichar_t) *
+				   len)) == NULL) ||
+	(gclen &&
+	 (ent->gcstr = SOMBOK_MALLOC(cache->allocator, sizeof(gcchar_t) *
+				     gclen)) == NULL)) {
+	_entry_free(cache, ent);
+	return;
+    }
+    if (text->len)
+	memcpy(ent->text.str, text->str, sizeof(unichar_t) * text->len);
+    ent->text.len = text->len;
+    str = ent->str;
+    gcstr = ent->gcstr;
+    for (i = 0; i < nlines; i++) {
+	if (lines[i]->len)
+	    memcpy(str, lines[i]->str, sizeof(unichar_t) * lines[i]->len);
+	if (lines[i]->gclen)
+	    memcpy(gcstr, lines[i]->gcstr,
+		   sizeof(gcchar_t) * lines[i]->gclen);
+	str += lines[i]->len;
+	gcstr += lines[i]->gclen;
+	ent->lens[i * 3] = lines[i]->len;
+	ent->lens[i * 3 + 1] = lines[i]->gclen;
+	ent->lens[i * 3 + 2] = lines[i]->pos;
+    }
+    ent->nlines = nlines;
+    ent->confhash = confhash;
+    ent->kind = kind;
+    ent->hash = FNV(_hash_text(text, confhash), kind);
+    ent->size = size;
+
+    /* Evict least recently used entries. */
+    while (cache->tail != NULL && cache->maxsize < cache->size + size) {
+	_entry_t *old = cache->tail;
+	_unlink(cache, old);
+	_entry_free(cache, old);
+    }
+
+    p = cache->buckets + ent->hash % cache->nbuckets;
+    ent->hnext = *p;
+    *p = ent;
+    ent->prev = NULL;
+    ent->next = cache->head;
+    if (cache->head != NULL)
+	cache->head->prev = ent;
+    else
+	cache->tail = ent;
+    cache->head = ent;
+    cache->size += size;
+    cache->nentries++;
+}
+
+/*@}*/
@@ -42,6 +42,8 @@ _search_props(linebreak_t * obj, unichar_t c, propval_t * lbcptr,
 
     if (obj->map == NULL || obj->mapsiz == 0)
 	return;
+    if (obj->stats != NULL)
+	obj->stats->map_lookups++;
 
     top = obj->map;
     bot = obj->map + obj->mapsiz - 1;
@@ -235,8 +237,8 @@ propval_t linebreak_search_eawidth(linebreak_t * obj, unichar_t c)
 #define INSERT_CUR(new) \
     do { \
 	mapent_t *m; \
-	if ((m = realloc(map, sizeof(mapent_t) * (mapsiz + 1))) \
-	    == NULL) { \
+	if ((m = SOMBOK_REALLOC(obj->allocator, map, \
+				sizeof(mapent_t) * (mapsiz + 1))) == NULL) { \
 	    obj->errnum = errno ? errno : ENOMEM; \
 	    return; \
 	} \
@@ -285,10 +287,17 @@ _add_prop(linebreak_t * obj, unichar_t beg, unichar_t end,
 
     SET_PROP(&newmap, p);
 
+    /* map of session may be shared. */
+    if (linebreak_unshare(obj) == NULL) {
+	obj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
+
     /* no maps */
     if (obj->map == NULL || obj->mapsiz == 0) {
 	if (obj->map == NULL &&
-	    (obj->map = malloc(sizeof(mapent_t))) == NULL) {
+	    (obj->map = SOMBOK_MALLOC(obj->allocator,
+				      sizeof(mapent_t))) == NULL) {
 	    obj->errnum = errno ? errno : ENOMEM;
 	    return;
 	}
@@ -506,11 +515,18 @@ static const mapent_t
 
 static void _clear_prop(linebreak_t * obj, int idx)
 {
-    mapent_t *map = obj->map, *cur;
-    size_t mapsiz = obj->mapsiz, i;
+    mapent_t *map, *cur;
+    size_t mapsiz, i;
 
-    if (mapsiz == 0)
+    if (obj->mapsiz == 0)
+	return;
+    /* map of session may be shared. */
+    if (linebreak_unshare(obj) == NULL) {
+	obj->errnum = errno ? errno : ENOMEM;
 	return;
+    }
+    map = obj->map;
+    mapsiz = obj->mapsiz;
 
     for (i = 0; i < mapsiz;) {
 	cur = map + i;
@@ -522,7 +538,7 @@ static void _clear_prop(linebreak_t * obj, int idx)
     }
 
     if (mapsiz == 0) {
-	free(obj->map);
+	SOMBOK_FREE(obj->allocator, obj->map);
 	obj->map = NULL;
 	obj->mapsiz = 0;
     } else {
@@ -24,6 +24,14 @@
      (((e) == EA_Z || (e) == EA_ZA || (e) == EA_ZW)? 0: 1)))
 #define IS_EXTENDER(g) \
     ((g) == GB_Extend || (g) == GB_SpacingMark || (g) == GB_Virama)
+/* Count allocation by performance counters of obj.  See stats.c. */
+#define STATS_ALLOC(obj, n, bytes)					\
+    do {								\
+	if ((obj) != NULL && (obj)->stats != NULL) {			\
+	    (obj)->stats->gcstrings += (n);				\
+	    (obj)->stats->gcstring_bytes += (bytes);			\
+	}								\
+    } while (0)
 
 static
 void _gcinfo(linebreak_t * obj, unistr_t * str, size_t pos, gcchar_t * gc)
@@ -202,6 +210,460 @@ void _gcinfo(linebreak_t * obj, unistr_t * str, size_t pos, gcchar_t * gc)
     gc->elbc = elbc;
 }
 
+/*
+ * Segment text consisting of ISO 8859-1 characters, where each character
+ * is a grapheme cluster except CR LF.  Properties are looked up once per
+ * character value.  Returns number of grapheme clusters stored into gc,
+ * or (size_t)-1 if text has other characters or tailored properties
+ * possibly combining characters, or if fast paths are disabled: Then
+ * _gcinfo() shall be used.
+ */
+static
+size_t _gcinfo_latin1(linebreak_t * obj, unistr_t * str, gcchar_t * gc)
+{
+    struct {
+	propval_t lbc, eaw, gcb;
+	unsigned char col;
+    } prop[256];
+    unsigned char known[256];
+    unichar_t c, mask = 0;
+    size_t pos, gclen;
+    propval_t lbc, eaw, gcb, scr;
+
+    if (obj != NULL && (obj->options & LINEBREAK_OPTION_NO_FAST_PATH))
+	return (size_t) - 1;
+    /* Table won't pay for short text. */
+    if (str->len < 32)
+	return (size_t) - 1;
+    for (pos = 0; pos < str->len; pos++)
+	mask |= str->str[pos];
+    if (0xFF < mask)
+	return (size_t) - 1;
+
+    memset(known, 0, sizeof(known));
+    for (pos = 0, gclen = 0; pos < str->len; pos++) {
+	c = str->str[pos];
+	if (!known[c]) {
+	    linebreak_charprop(obj, c, &lbc, &eaw, &gcb, &scr);
+	    switch (gcb) {
+	    case GB_CR:
+	    case GB_LF:
+	    case GB_Control:
+	    case GB_Other:
+	    case GB_OtherLetter:
+		break;
+	    default:
+		return (size_t) - 1;
+	    }
+	    if (lbc != LB_SA)
+		prop[c].lbc = lbc;
+#ifdef USE_LIBTHAI
+	    else if (scr == SC_Thai)
+		prop[c].lbc = lbc;
+#endif				/* USE_LIBTHAI */
+	    else
+		prop[c].lbc = LB_AL;
+	    prop[c].eaw = eaw;
+	    prop[c].gcb = gcb;
+	    prop[c].col = eaw2col(obj, eaw);
+	    known[c] = 1;
+	}
+
+	/* GB3: CR × LF */
+	if (prop[c].gcb == GB_LF && 0 < pos &&
+	    prop[str->str[pos - 1]].gcb == GB_CR &&
+	    gc[gclen - 1].len == 1) {
+	    gc[gclen - 1].len++;
+	    gc[gclen - 1].col += prop[c].col;
+	    continue;
+	}
+	gc[gclen].flag = 0;
+	gc[gclen].idx = pos;
+	gc[gclen].len = 1;
+	gc[gclen].col = prop[c].col;
+	gc[gclen].lbc = prop[c].lbc;
+	gc[gclen].elbc = PROP_UNKNOWN;
+	gclen++;
+    }
+    return gclen;
+}
+
+/*
+ * Check if a pair of ISO 8859-1 characters a and b are never joined into
+ * a grapheme cluster.  Returns 0 if fast paths are disabled.
+ */
+static
+int _latin1_apart(linebreak_t * obj, unichar_t a, unichar_t b)
+{
+    propval_t agcb, bgcb;
+
+    if (obj != NULL && (obj->options & LINEBREAK_OPTION_NO_FAST_PATH))
+	return 0;
+    if (0xFF < a || 0xFF < b)
+	return 0;
+    linebreak_charprop(obj, a, NULL, NULL, &agcb, NULL);
+    linebreak_charprop(obj, b, NULL, NULL, &bgcb, NULL);
+    switch (agcb) {
+    case GB_CR:
+	if (bgcb == GB_LF)
+	    return 0;
+	/* FALLTHROUGH */
+    case GB_LF:
+    case GB_Control:
+    case GB_Other:
+    case GB_OtherLetter:
+	break;
+    default:
+	return 0;
+    }
+    switch (bgcb) {
+    case GB_CR:
+    case GB_LF:
+    case GB_Control:
+    case GB_Other:
+    case GB_OtherLetter:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/*
+ * Decode a character at top of UTF-8 string as sombok_decode_utf8()
+ * without check does.  Byte not starting a well-formed sequence is taken
+ * by its value as char, which is sign-extended where char is signed.
+ * Returns number of bytes.
+ */
+static
+size_t _decode_utf8_char(const char *utf8, size_t utf8len, unichar_t * cp)
+{
+    const unsigned char *u = (const unsigned char *) utf8;
+    size_t len, i;
+
+    if (u[0] < 0x80)
+	return (*cp = u[0]), 1;
+    else if ((u[0] & 0xE0) == 0xC0)
+	len = 2;
+    else if ((u[0] & 0xF0) == 0xE0)
+	len = 3;
+    else if ((u[0] & 0xF8) == 0xF0)
+	len = 4;
+    else if ((u[0] & 0xFC) == 0xF8)
+	len = 5;
+    else if ((u[0] & 0xFE) == 0xFC)
+	len = 6;
+    else
+	return (*cp = (unichar_t) utf8[0]), 1;
+    if (utf8len < len)
+	return (*cp = (unichar_t) utf8[0]), 1;
+    for (i = 1; i < len; i++)
+	if ((u[i] & 0xC0) != 0x80)
+	    return (*cp = (unichar_t) utf8[0]), 1;
+
+    *cp = u[0] & (0x7F >> len);
+    for (i = 1; i < len; i++)
+	*cp = (*cp << 6) | (u[i] & 0x3F);
+    return len;
+}
+
+#define IS_PRINT_ASCII(c) \
+    (0x20 <= (unsigned char)(c) && (unsigned char)(c) <= 0x7E)
+#define IS_PRINT_UNICHAR(c) (0x20 <= (c) && (c) <= 0x7E)
+#define ONES_WORD ((unsigned long) -1 / 0xFF)
+/* Check if any byte of word is not printable ASCII. */
+#define HAS_NONPRINT_WORD(w) \
+    ((((w) - ONES_WORD * 0x20) & ~(w) & ONES_WORD * 0x80) || \
+     ((((w) + ONES_WORD * 0x01) | (w)) & ONES_WORD * 0x80))
+#define COLUMNS_BUFLEN (256)
+
+/*
+ * Count columns of longest prefix of UTF-8 string consisting of whole
+ * grapheme clusters and fitting in maxcols columns.  Returns number of
+ * bytes of prefix, and number of columns is stored into *colsptr.
+ * Text is decoded into a fixed buffer: the last cluster in the buffer is
+ * carried over, since following characters may be joined to it.
+ * Printable ASCII characters followed by printable ASCII are clusters of
+ * one column, unless they are tailored by custom map:  Runs of them are
+ * counted a word at a time without decoding.
+ */
+static
+size_t _columns_utf8(linebreak_t * obj, const char *utf8, size_t utf8len,
+		     size_t maxcols, size_t * colsptr)
+{
+    linebreak_t defobj;
+    unichar_t buf[COLUMNS_BUFLEN];
+    size_t off[COLUMNS_BUFLEN + 1];
+    unistr_t ustr;
+    gcchar_t gc;
+    size_t i = 0, end = 0, n = 0, p, j, cols = 0;
+    unsigned long w;
+    int fast;
+
+    if (obj == NULL) {
+	memset(&defobj, 0, sizeof(linebreak_t));
+	obj = &defobj;
+    }
+    fast = ((obj->map == NULL || obj->mapsiz == 0) &&
+	    !(obj->options & LINEBREAK_OPTION_NO_FAST_PATH));
+    if (utf8 == NULL)
+	utf8len = 0;
+
+    for (;;) {
+	/* Run of printable ASCII. */
+	if (n == 0 && fast) {
+	    for (j = i; j + sizeof(unsigned long) < utf8len; j +=
+		 sizeof(unsigned long)) {
+		memcpy(&w, utf8 + j, sizeof(unsigned long));
+		if (HAS_NONPRINT_WORD(w) ||
+		    !IS_PRINT_ASCII(utf8[j + sizeof(unsigned long)]))
+		    break;
+	    }
+	    for (; j < utf8len && IS_PRINT_ASCII(utf8[j]); j++)
+		if (j + 1 < utf8len && !IS_PRINT_ASCII(utf8[j + 1]))
+		    break;
+	    if (maxcols - cols < j - i) {
+		end = i + (maxcols - cols);
+		cols = maxcols;
+		break;
+	    }
+	    cols += j - i;
+	    end = i = j;
+	}
+
+	/* Decode. */
+	while (n < COLUMNS_BUFLEN && i < utf8len) {
+	    off[n] = i;
+	    i += _decode_utf8_char(utf8 + i, utf8len - i, buf + n);
+	    n++;
+	    if (fast && IS_PRINT_UNICHAR(buf[n - 1]) && i < utf8len &&
+		IS_PRINT_ASCII(utf8[i]))
+		break;
+	}
+	off[n] = i;
+	if (n == 0)
+	    break;
+
+	/* Segment clusters but the last one possibly continued. */
+	ustr.str = buf;
+	ustr.len = n;
+	for (p = 0; p < n; p += gc.len) {
+	    _gcinfo(obj, &ustr, p, &gc);
+	    if (0 < p && p + gc.len == n && i < utf8len)
+		break;
+	    if (maxcols < cols + gc.col)
+		goto done;
+	    cols += gc.col;
+	    end = off[p + gc.len];
+	}
+	memmove(buf, buf + p, sizeof(unichar_t) * (n - p));
+	memmove(off, off + p, sizeof(size_t) * (n - p + 1));
+	n -= p;
+
+	/* Carried over printable ASCII followed by printable ASCII. */
+	if (n == 1 && fast && IS_PRINT_UNICHAR(buf[0]) && i < utf8len &&
+	    IS_PRINT_ASCII(utf8[i])) {
+	    i = off[0];
+	    n = 0;
+	}
+    }
+
+  done:
+    if (colsptr != NULL)
+	*colsptr = cols;
+    return end;
+}
+
+/*
+ * Segment Unicode string into grapheme clusters stored into gc, which
+ * shall have room for str->len clusters.  Returns number of clusters.
+ */
+static
+size_t _segment(linebreak_t * obj, unistr_t * str, gcchar_t * gc)
+{
+    size_t pos, gclen;
+
+    if ((gclen = _gcinfo_latin1(obj, str, gc)) != (size_t) - 1)
+	return gclen;
+    for (pos = 0, gclen = 0; pos < str->len; pos += gc->len, gclen++, gc++) {
+	gc->flag = 0;
+	gc->idx = pos;
+	_gcinfo(obj, str, pos, gc);
+    }
+    return gclen;
+}
+
+/* Initial size of reserved buffers. */
+#define RESERVE_MIN (16)
+
+/*
+ * Make buffers of gcstr have room for len characters and gclen clusters.
+ * If sizp is NULL, buffers are fitted to them.  Otherwise *sizp and
+ * *gcsizp are sizes of buffers, which are grown by doubling and never
+ * shrunk.  Returns 0, or -1 with errno set on error.
+ */
+static
+int _reserve(gcstring_t * gcstr, size_t len, size_t gclen,
+	     size_t * sizp, size_t * gcsizp)
+{
+    const sombok_allocator_t *alloc = SOMBOK_ALLOCATOR_OF(gcstr->lbobj);
+    size_t siz;
+    unichar_t *_u;
+    gcchar_t *_g;
+
+    if (sizp == NULL || *sizp < len) {
+	siz = len;
+	if (sizp != NULL)
+	    for (siz = *sizp ? *sizp : RESERVE_MIN; siz < len; siz *= 2);
+	if ((_u = SOMBOK_REALLOC(alloc, gcstr->str,
+				 sizeof(unichar_t) * siz)) == NULL)
+	    return -1;
+	gcstr->str = _u;
+	if (sizp != NULL)
+	    *sizp = siz;
+    }
+    if (gcsizp == NULL || *gcsizp < gclen) {
+	siz = gclen;
+	if (gcsizp != NULL)
+	    for (siz = *gcsizp ? *gcsizp : RESERVE_MIN; siz < gclen;
+		 siz *= 2);
+	if ((_g = SOMBOK_REALLOC(alloc, gcstr->gcstr,
+				 sizeof(gcchar_t) * siz)) == NULL)
+	    return -1;
+	gcstr->gcstr = _g;
+	if (gcsizp != NULL)
+	    *gcsizp = siz;
+    }
+    return 0;
+}
+
+/* Longest pair of clusters resegmented without allocation. */
+#define JOIN_BUFLEN (32)
+
+/*
+ * Append length clusters of appe from offset to gcstr.  See
+ * gcstring_append_substr().
+ */
+static
+gcstring_t *_append(gcstring_t * gcstr, gcstring_t * appe, size_t offset,
+		    size_t length, size_t * sizp, size_t * gcsizp)
+{
+    gcchar_t *bgc = appe->gcstr + offset, *cgc;
+    unichar_t *bstr;
+    size_t bidx, blen_all, i;
+
+    bidx = bgc[0].idx;
+    if (offset + length < appe->gclen)
+	blen_all = bgc[length].idx - bidx;
+    else
+	blen_all = appe->len - bidx;
+    bstr = appe->str + bidx;
+
+    if (gcstr->gclen) {
+	size_t aidx, alen, blen, newlen, newgclen, cgclen;
+	unsigned char bflag;
+	unistr_t ustr = { NULL, 0 };
+	unichar_t jbuf[JOIN_BUFLEN];
+	gcchar_t jgc[JOIN_BUFLEN];
+	gcstring_t *cstr = NULL;
+
+	aidx = gcstr->gcstr[gcstr->gclen - 1].idx;
+	alen = gcstr->gcstr[gcstr->gclen - 1].len;
+	blen = bgc[0].len;
+	bflag = bgc[0].flag;
+	newlen = gcstr->len + blen_all;
+
+	/* Clusters won't be joined: append them without resegmentation. */
+	if (alen == 1 && blen == 1 && gcstr->lbobj == appe->lbobj &&
+	    _latin1_apart(gcstr->lbobj, gcstr->str[aidx], bstr[0])) {
+	    newgclen = gcstr->gclen + length;
+	    if (_reserve(gcstr, newlen, newgclen, sizp, gcsizp) != 0)
+		return NULL;
+	    memcpy(gcstr->str + gcstr->len, bstr,
+		   sizeof(unichar_t) * blen_all);
+	    for (i = 0; i < length; i++) {
+		gcchar_t *gc = gcstr->gcstr + gcstr->gclen + i;
+
+		*gc = bgc[i];
+		gc->idx = gc->idx - bidx + gcstr->len;
+	    }
+	    gcstr->len = newlen;
+	    gcstr->gclen = newgclen;
+	    return gcstr;
+	}
+
+	/* Resegment the last cluster and the first one appended.  Short
+	 * pair is segmented on stack. */
+	if (alen + blen <= JOIN_BUFLEN && gcstr->lbobj != NULL) {
+	    ustr.str = jbuf;
+	    ustr.len = alen + blen;
+	    memcpy(jbuf, gcstr->str + aidx, sizeof(unichar_t) * alen);
+	    memcpy(jbuf + alen, bstr, sizeof(unichar_t) * blen);
+	    cgclen = _segment(gcstr->lbobj, &ustr, jgc);
+	    cgc = jgc;
+	} else {
+	    if ((ustr.str = SOMBOK_MALLOC(SOMBOK_ALLOCATOR_OF(gcstr->lbobj),
+					  sizeof(unichar_t) * (alen + blen)))
+		== NULL)
+		return NULL;
+	    memcpy(ustr.str, gcstr->str + aidx, sizeof(unichar_t) * alen);
+	    memcpy(ustr.str + alen, bstr, sizeof(unichar_t) * blen);
+	    ustr.len = alen + blen;
+	    if ((cstr = gcstring_new(&ustr, gcstr->lbobj)) == NULL) {
+		SOMBOK_FREE(SOMBOK_ALLOCATOR_OF(gcstr->lbobj), ustr.str);
+		return NULL;
+	    }
+	    cgclen = cstr->gclen;
+	    cgc = cstr->gcstr;
+	}
+
+	newgclen = gcstr->gclen - 1 + cgclen + length - 1;
+	if (_reserve(gcstr, newlen, newgclen, sizp, gcsizp) != 0) {
+	    gcstring_destroy(cstr);
+	    return NULL;
+	}
+	memcpy(gcstr->str + gcstr->len, bstr, sizeof(unichar_t) * blen_all);
+	for (i = 0; i < cgclen; i++) {
+	    gcchar_t *gc = gcstr->gcstr + gcstr->gclen - 1 + i;
+
+	    gc->idx = cgc[i].idx + aidx;
+	    gc->len = cgc[i].len;
+	    gc->col = cgc[i].col;
+	    gc->lbc = cgc[i].lbc;
+	    gc->elbc = cgc[i].elbc;
+	    if (aidx + alen == gc->idx)	/* Restore flag if possible */
+		gc->flag = bflag;
+	}
+	for (i = 1; i < length; i++) {
+	    gcchar_t *gc = gcstr->gcstr + gcstr->gclen - 1 + cgclen + i - 1;
+
+	    gc->idx = bgc[i].idx - bidx + gcstr->len;
+	    gc->len = bgc[i].len;
+	    gc->col = bgc[i].col;
+	    gc->lbc = bgc[i].lbc;
+	    gc->elbc = bgc[i].elbc;
+	    gc->flag = bgc[i].flag;
+	}
+
+	gcstr->len = newlen;
+	gcstr->gclen = newgclen;
+	gcstring_destroy(cstr);
+    } else {
+	if (_reserve(gcstr, blen_all, length, sizp, gcsizp) != 0)
+	    return NULL;
+	memcpy(gcstr->str, bstr, sizeof(unichar_t) * blen_all);
+	gcstr->len = blen_all;
+	for (i = 0; i < length; i++) {
+	    gcstr->gcstr[i] = bgc[i];
+	    gcstr->gcstr[i].idx -= bidx;
+	}
+	gcstr->gclen = length;
+
+	gcstr->pos = 0;
+    }
+
+    return gcstr;
+}
+
 /*
  * Exports
  */
@@ -228,22 +690,27 @@ void _gcinfo(linebreak_t * obj, unistr_t * str, size_t pos, gcchar_t * gc)
 gcstring_t *gcstring_new(unistr_t * unistr, linebreak_t * lbobj)
 {
     gcstring_t *gcstr;
+    linebreak_t *obj;
     size_t len;
 
-    if ((gcstr = malloc(sizeof(gcstring_t))) == NULL)
+    if (lbobj == NULL) {
+	if ((obj = linebreak_new(NULL)) == NULL)
+	    return NULL;
+    } else
+	obj = linebreak_incref(lbobj);
+    if ((gcstr = SOMBOK_MALLOC(obj->allocator, sizeof(gcstring_t))) ==
+	NULL) {
+	linebreak_destroy(obj);
 	return NULL;
+    }
     gcstr->str = NULL;
     gcstr->len = 0;
     gcstr->gcstr = NULL;
     gcstr->gclen = 0;
     gcstr->pos = 0;
-    if (lbobj == NULL) {
-	if ((gcstr->lbobj = linebreak_new(NULL)) == NULL) {
-	    free(gcstr);
-	    return NULL;
-	}
-    } else
-	gcstr->lbobj = linebreak_incref(lbobj);
+    gcstr->lbobj = obj;
+
+    STATS_ALLOC(lbobj, 1, sizeof(gcstring_t));
 
     if (unistr == NULL || unistr->str == NULL || unistr->len == 0)
 	return gcstr;
@@ -251,28 +718,23 @@ gcstring_t *gcstring_new(unistr_t * unistr, linebreak_t * lbobj)
     gcstr->len = len = unistr->len;
 
     if (len) {
-	size_t pos;
-	gcchar_t *gc, *_g;
+	gcchar_t *_g;
 
-	if ((gcstr->gcstr = malloc(sizeof(gcchar_t) * len)) == NULL) {
+	if ((gcstr->gcstr = SOMBOK_MALLOC(obj->allocator,
+					  sizeof(gcchar_t) * len)) == NULL) {
 	    gcstr->str = NULL;
 	    gcstring_destroy(gcstr);
 	    return NULL;
 	}
-	for (pos = 0, gc = gcstr->gcstr;
-	     pos < len;
-	     pos += gc->len, gcstr->gclen++, gc++) {
-	    gc->flag = 0;
-	    gc->idx = pos;
-	    _gcinfo(gcstr->lbobj, unistr, pos, gc);
-	}
-	if ((_g = realloc(gcstr->gcstr, sizeof(gcchar_t) * gcstr->gclen))
-	    == NULL) {
+	gcstr->gclen = _segment(gcstr->lbobj, unistr, gcstr->gcstr);
+	if ((_g = SOMBOK_REALLOC(obj->allocator, gcstr->gcstr,
+				 sizeof(gcchar_t) * gcstr->gclen)) == NULL) {
 	    gcstr->str = NULL;
 	    gcstring_destroy(gcstr);
 	    return NULL;
 	} else
 	    gcstr->gcstr = _g;
+	STATS_ALLOC(lbobj, 0, sizeof(gcchar_t) * gcstr->gclen);
     }
 
     return gcstr;
@@ -292,7 +754,9 @@ gcstring_t *gcstring_newcopy(unistr_t * str, linebreak_t * lbobj)
     unistr_t unistr = { NULL, 0 };
 
     if (str->str && str->len) {
-	if ((unistr.str = malloc(sizeof(unichar_t) * str->len)) == NULL)
+	if ((unistr.str = SOMBOK_MALLOC(SOMBOK_ALLOCATOR_OF(lbobj),
+					sizeof(unichar_t) * str->len)) ==
+	    NULL)
 	    return NULL;
 	memcpy(unistr.str, str->str, sizeof(unichar_t) * str->len);
 	unistr.len = str->len;
@@ -320,8 +784,15 @@ gcstring_t *gcstring_new_from_utf8(char *str, size_t len, int check,
 	errno = EINVAL;
 	return NULL;
     }
-    if (sombok_decode_utf8(&unistr, 0, str, len, check) == NULL)
+    if (sombok_decode_utf8_with_allocator(SOMBOK_ALLOCATOR_OF(lbobj),
+					  &unistr, 0, str, len, check) ==
+	NULL)
 	return NULL;
+    /* empty string won't be taken by gcstring_new(). */
+    if (unistr.len == 0) {
+	SOMBOK_FREE(SOMBOK_ALLOCATOR_OF(lbobj), unistr.str);
+	unistr.str = NULL;
+    }
 
     return gcstring_new(&unistr, lbobj);
 }
@@ -335,12 +806,15 @@ gcstring_t *gcstring_new_from_utf8(char *str, size_t len, int check,
  */
 void gcstring_destroy(gcstring_t * gcstr)
 {
+    const sombok_allocator_t *alloc;
+
     if (gcstr == NULL)
 	return;
-    free(gcstr->str);
-    free(gcstr->gcstr);
+    alloc = SOMBOK_ALLOCATOR_OF(gcstr->lbobj);
+    SOMBOK_FREE(alloc, gcstr->str);
+    SOMBOK_FREE(alloc, gcstr->gcstr);
     linebreak_destroy(gcstr->lbobj);
-    free(gcstr);
+    SOMBOK_FREE(alloc, gcstr);
 }
 
 /** Copy Constructor
@@ -355,26 +829,30 @@ gcstring_t *gcstring_copy(gcstring_t * gcstr)
     gcstring_t *new;
     unichar_t *newstr = NULL;
     gcchar_t *newgcstr = NULL;
+    const sombok_allocator_t *alloc;
 
     if (gcstr == NULL)
 	return (errno = EINVAL), NULL;
 
-    if ((new = malloc(sizeof(gcstring_t))) == NULL)
+    alloc = SOMBOK_ALLOCATOR_OF(gcstr->lbobj);
+    if ((new = SOMBOK_MALLOC(alloc, sizeof(gcstring_t))) == NULL)
 	return NULL;
     memcpy(new, gcstr, sizeof(gcstring_t));
 
     if (gcstr->str && gcstr->len) {
-	if ((newstr = malloc(sizeof(unichar_t) * gcstr->len)) == NULL) {
-	    free(new);
+	if ((newstr = SOMBOK_MALLOC(alloc, sizeof(unichar_t) * gcstr->len))
+	    == NULL) {
+	    SOMBOK_FREE(alloc, new);
 	    return NULL;
 	}
 	memcpy(newstr, gcstr->str, sizeof(unichar_t) * gcstr->len);
     }
     new->str = newstr;
     if (gcstr->gcstr && gcstr->gclen) {
-	if ((newgcstr = malloc(sizeof(gcchar_t) * gcstr->gclen)) == NULL) {
-	    free(new->str);
-	    free(new);
+	if ((newgcstr = SOMBOK_MALLOC(alloc, sizeof(gcchar_t) *
+				      gcstr->gclen)) == NULL) {
+	    SOMBOK_FREE(alloc, new->str);
+	    SOMBOK_FREE(alloc, new);
 	    return NULL;
 	}
 	memcpy(newgcstr, gcstr->gcstr, sizeof(gcchar_t) * gcstr->gclen);
@@ -388,6 +866,9 @@ gcstring_t *gcstring_copy(gcstring_t * gcstr)
     } else
 	new->lbobj = linebreak_incref(gcstr->lbobj);
     new->pos = 0;
+    STATS_ALLOC(new->lbobj, 1, sizeof(gcstring_t) +
+		sizeof(unichar_t) * (newstr ? gcstr->len : 0) +
+		sizeof(gcchar_t) * (newgcstr ? gcstr->gclen : 0));
 
     return new;
 }
@@ -403,91 +884,11 @@ gcstring_t *gcstring_copy(gcstring_t * gcstr)
  */
 gcstring_t *gcstring_append(gcstring_t * gcstr, gcstring_t * appe)
 {
-    unistr_t ustr = { NULL, 0 };
-
     if (gcstr == NULL)
 	return (errno = EINVAL), NULL;
     if (appe == NULL || appe->str == NULL || appe->len == 0)
 	return gcstr;
-    if (gcstr->gclen && appe->gclen) {
-	size_t aidx, alen, blen, newlen, newgclen, i;
-	unsigned char bflag;
-	gcstring_t *cstr;
-	unichar_t *_u;
-	gcchar_t *_g;
-
-	aidx = gcstr->gcstr[gcstr->gclen - 1].idx;
-	alen = gcstr->gcstr[gcstr->gclen - 1].len;
-	blen = appe->gcstr[0].len;
-	bflag = appe->gcstr[0].flag;
-
-	if ((ustr.str = malloc(sizeof(unichar_t) * (alen + blen))) == NULL)
-	    return NULL;
-	memcpy(ustr.str, gcstr->str + aidx, sizeof(unichar_t) * alen);
-	memcpy(ustr.str + alen, appe->str, sizeof(unichar_t) * blen);
-	ustr.len = alen + blen;
-	if ((cstr = gcstring_new(&ustr, gcstr->lbobj)) == NULL) {
-	    free(ustr.str);
-	    return NULL;
-	}
-
-	newlen = gcstr->len + appe->len;
-	newgclen = gcstr->gclen - 1 + cstr->gclen + appe->gclen - 1;
-	if ((_u = realloc(gcstr->str, sizeof(unichar_t) * newlen)) == NULL) {
-	    gcstring_destroy(cstr);
-	    return NULL;
-	} else
-	    gcstr->str = _u;
-	if ((_g = realloc(gcstr->gcstr,
-			  sizeof(gcchar_t) * newgclen)) == NULL) {
-	    gcstring_destroy(cstr);
-	    return NULL;
-	} else
-	    gcstr->gcstr = _g;
-	memcpy(gcstr->str + gcstr->len, appe->str,
-	       sizeof(unichar_t) * appe->len);
-	for (i = 0; i < cstr->gclen; i++) {
-	    gcchar_t *gc = gcstr->gcstr + gcstr->gclen - 1 + i;
-
-	    gc->idx = cstr->gcstr[i].idx + aidx;
-	    gc->len = cstr->gcstr[i].len;
-	    gc->col = cstr->gcstr[i].col;
-	    gc->lbc = cstr->gcstr[i].lbc;
-	    gc->elbc = cstr->gcstr[i].elbc;
-	    if (aidx + alen == gc->idx)	/* Restore flag if possible */
-		gc->flag = bflag;
-	}
-	for (i = 1; i < appe->gclen; i++) {
-	    gcchar_t *gc =
-		gcstr->gcstr + gcstr->gclen - 1 + cstr->gclen + i - 1;
-	    gc->idx = appe->gcstr[i].idx - blen + aidx + cstr->len;
-	    gc->len = appe->gcstr[i].len;
-	    gc->col = appe->gcstr[i].col;
-	    gc->lbc = appe->gcstr[i].lbc;
-	    gc->elbc = appe->gcstr[i].elbc;
-	    gc->flag = appe->gcstr[i].flag;
-	}
-
-	gcstr->len = newlen;
-	gcstr->gclen = newgclen;
-	gcstring_destroy(cstr);
-    } else if (appe->gclen) {
-	if ((gcstr->str = malloc(sizeof(unichar_t) * appe->len)) == NULL)
-	    return NULL;
-	if ((gcstr->gcstr =
-	     malloc(sizeof(gcchar_t) * appe->gclen)) == NULL) {
-	    free(gcstr->str);
-	    return NULL;
-	}
-	memcpy(gcstr->str, appe->str, sizeof(unichar_t) * appe->len);
-	gcstr->len = appe->len;
-	memcpy(gcstr->gcstr, appe->gcstr, sizeof(gcchar_t) * appe->gclen);
-	gcstr->gclen = appe->gclen;
-
-	gcstr->pos = 0;
-    }
-
-    return gcstr;
+    return _append(gcstr, appe, 0, appe->gclen, NULL, NULL);
 }
 
 /** Compare
@@ -526,6 +927,47 @@ size_t gcstring_columns(gcstring_t * gcstr)
     return col;
 }
 
+/** Number of Columns of UTF-8 string
+ *
+ * Returns number of columns of UTF-8 string, same as gcstring_columns()
+ * on grapheme cluster string made by gcstring_new_from_utf8() without
+ * check.  Neither decoded string nor grapheme clusters are allocated.
+ * @param[in] lbobj linebreak object, or NULL for default settings.
+ * @param[in] utf8 UTF-8 string.
+ * @param[in] utf8len length of string.
+ * @return Number of columns.
+ *
+ * @note Introduced by sombok 2.5.
+ */
+size_t sombok_columns_utf8(linebreak_t * lbobj, const char *utf8,
+			   size_t utf8len)
+{
+    size_t cols;
+
+    _columns_utf8(lbobj, utf8, utf8len, (size_t) - 1, &cols);
+    return cols;
+}
+
+/** Truncate UTF-8 string by number of columns
+ *
+ * Returns length of longest prefix of UTF-8 string which consists of
+ * whole grapheme clusters and fits in maxcols columns.  Nothing is
+ * allocated.
+ * @param[in] lbobj linebreak object, or NULL for default settings.
+ * @param[in] utf8 UTF-8 string.
+ * @param[in] utf8len length of string.
+ * @param[in] maxcols maximum number of columns.
+ * @param[out] colsptr pointer to number of columns of prefix, or NULL.
+ * @return Number of bytes of prefix.
+ *
+ * @note Introduced by sombok 2.5.
+ */
+size_t sombok_truncate_utf8(linebreak_t * lbobj, const char *utf8,
+			    size_t utf8len, size_t maxcols, size_t * colsptr)
+{
+    return _columns_utf8(lbobj, utf8, utf8len, maxcols, colsptr);
+}
+
 /** Concatenate
  *
  * Create new grapheme cluster string which is concatination of two strings.
@@ -603,10 +1045,10 @@ void gcstring_shrink(gcstring_t * gcstr, int length)
 	length += gcstr->gclen;
 
     if (length <= 0) {
-	free(gcstr->str);
+	SOMBOK_FREE(SOMBOK_ALLOCATOR_OF(gcstr->lbobj), gcstr->str);
 	gcstr->str = NULL;
 	gcstr->len = 0;
-	free(gcstr->gcstr);
+	SOMBOK_FREE(SOMBOK_ALLOCATOR_OF(gcstr->lbobj), gcstr->gcstr);
 	gcstr->gcstr = NULL;
 	gcstr->gclen = 0;
     } else if (gcstr->gclen <= length)
@@ -669,13 +1111,15 @@ gcstring_t *gcstring_substr(gcstring_t * gcstr, int offset, int length)
 	return NULL;
 
     if (ulength == 0);
-    else if ((new->str = malloc(sizeof(unichar_t) * ulength)) == NULL) {
+    else if ((new->str = SOMBOK_MALLOC(new->lbobj->allocator,
+				       sizeof(unichar_t) * ulength)) == NULL) {
 	gcstring_destroy(new);
 	return NULL;
     }
     if (length == 0);
-    else if ((new->gcstr = malloc(sizeof(gcchar_t) * length)) == NULL) {
-	free(new->str);
+    else if ((new->gcstr = SOMBOK_MALLOC(new->lbobj->allocator,
+					 sizeof(gcchar_t) * length)) ==
+	     NULL) {
 	gcstring_destroy(new);
 	return NULL;
     }
@@ -689,6 +1133,8 @@ gcstring_t *gcstring_substr(gcstring_t * gcstr, int offset, int length)
 	new->gcstr[i].idx -= gcstr->gcstr[offset].idx;
     }
     new->gclen = length;
+    STATS_ALLOC(new->lbobj, 0, sizeof(unichar_t) * ulength +
+		sizeof(gcchar_t) * length);
 
     return new;
 }
@@ -755,6 +1201,79 @@ gcstring_t *gcstring_replace(gcstring_t * gcstr, int offset, int length,
     return gcstr;
 }
 
+/** Append Substring
+ *
+ * @note this function is for internal use.
+ *
+ * Modify grapheme cluster string by appending substring of another
+ * string, as gcstring_append() with gcstring_substr() does, but without
+ * making substring.
+ * @param[in,out] gcstr target grapheme cluster string, must not be NULL.
+ * @param[in] appe grapheme cluster string, must not be NULL.
+ * @param[in] offset Offset of substring.
+ * @param[in] length Length of substring.
+ * offset and length must not be out of range.
+ * @param[in,out] sizp number of characters buffer of gcstr may hold, or
+ * NULL.
+ * @param[in,out] gcsizp number of clusters buffer of gcstr may hold, or
+ * NULL.  If these are given, buffers are grown by doubling and won't be
+ * fitted to content, so that they may be reused.
+ * @return modified gcstr itself.
+ * If error occurred, errno is set then NULL is returned.
+ */
+gcstring_t *gcstring_append_substr(gcstring_t * gcstr, gcstring_t * appe,
+				   size_t offset, size_t length,
+				   size_t * sizp, size_t * gcsizp)
+{
+    if (gcstr == NULL || appe == NULL || appe->gclen < offset + length)
+	return (errno = EINVAL), NULL;
+    if (length == 0)
+	return gcstr;
+    return _append(gcstr, appe, offset, length, sizp, gcsizp);
+}
+
+/** Resegment
+ *
+ * @note this function is for internal use.
+ *
+ * Segment characters of grapheme cluster string into grapheme clusters
+ * again.  Flags of clusters are cleared.
+ * @param[in,out] gcstr grapheme cluster string, must not be NULL.  Its
+ * lbobj member must not be NULL.
+ * @param[in,out] gcsizp number of clusters buffer of gcstr may hold, or
+ * NULL.  See gcstring_append_substr().
+ * @return modified gcstr itself.
+ * If error occurred, errno is set then NULL is returned.
+ */
+gcstring_t *gcstring_resegment(gcstring_t * gcstr, size_t * gcsizp)
+{
+    unistr_t unistr;
+    size_t siz;
+    gcchar_t *_g;
+
+    if (gcstr == NULL || gcstr->lbobj == NULL)
+	return (errno = EINVAL), NULL;
+    gcstr->gclen = 0;
+    gcstr->pos = 0;
+    if (gcstr->len == 0)
+	return gcstr;
+
+    /* buffer of characters is left as it is. */
+    siz = gcstr->len;
+    if (_reserve(gcstr, gcstr->len, gcstr->len, &siz, gcsizp) != 0)
+	return NULL;
+    unistr.str = gcstr->str;
+    unistr.len = gcstr->len;
+    gcstr->gclen = _segment(gcstr->lbobj, &unistr, gcstr->gcstr);
+    if (gcsizp == NULL) {
+	if ((_g = SOMBOK_REALLOC(gcstr->lbobj->allocator, gcstr->gcstr,
+				 sizeof(gcchar_t) * gcstr->gclen)) == NULL)
+	    return NULL;
+	gcstr->gcstr = _g;
+    }
+    return gcstr;
+}
+
 /** Get Line Breaking Class of grapheme base
  *
  * Get UAX #14 line breaking class of grapheme base.
@@ -13,6 +13,18 @@
 #include "sombok_constants.h"
 #include "sombok.h"
 
+#ifdef HAVE_SYNC_BUILTINS
+#define REFCOUNT_INC(obj) __sync_add_and_fetch(&((obj)->refcount), 1UL)
+#define REFCOUNT_DEC(obj) __sync_sub_and_fetch(&((obj)->refcount), 1UL)
+#define SESSIONS_INC(obj) __sync_add_and_fetch(&((obj)->sessions), 1UL)
+#define SESSIONS_DEC(obj) __sync_sub_and_fetch(&((obj)->sessions), 1UL)
+#else
+#define REFCOUNT_INC(obj) ((obj)->refcount += 1UL)
+#define REFCOUNT_DEC(obj) ((obj)->refcount -= 1UL)
+#define SESSIONS_INC(obj) ((obj)->sessions += 1UL)
+#define SESSIONS_DEC(obj) ((obj)->sessions -= 1UL)
+#endif				/* HAVE_SYNC_BUILTINS */
+
 /** @defgroup linebreak linebreak
  * @brief Handle linebreak object.
  *
@@ -22,15 +34,37 @@
  *
  * Creates new linebreak object.
  * Reference count of it will be set to 1.
+ * Default allocator is used.  See sombok_set_allocator().
  * @param[in] ref_func function to handle reference count of external objects,
  * or NULL.
  * @return New linebreak object.
  * If error occurred, errno is set then NULL is returned.
  */
 linebreak_t *linebreak_new(linebreak_ref_func_t ref_func)
+{
+    return linebreak_new_with_allocator(ref_func, NULL);
+}
+
+/** Constructor with Allocator
+ *
+ * Creates new linebreak object using allocator.
+ * Reference count of it will be set to 1.
+ * @param[in] ref_func function to handle reference count of external objects,
+ * or NULL.
+ * @param[in] alloc allocator, or NULL to use default allocator.  It
+ * shall not be released while the object or its strings and results are
+ * alive.
+ * @return New linebreak object.
+ * If error occurred, errno is set then NULL is returned.
+ */
+linebreak_t *linebreak_new_with_allocator(linebreak_ref_func_t ref_func,
+					  const sombok_allocator_t * alloc)
 {
     linebreak_t *obj;
-    if ((obj = malloc(sizeof(linebreak_t))) == NULL)
+
+    if (alloc == NULL)
+	alloc = sombok_allocator;
+    if ((obj = SOMBOK_MALLOC(alloc, sizeof(linebreak_t))) == NULL)
 	return NULL;
     memset(obj, 0, sizeof(linebreak_t));
 
@@ -38,20 +72,144 @@ linebreak_t *linebreak_new(linebreak_ref_func_t ref_func)
     obj->options = LINEBREAK_OPTION_COMPLEX_BREAKING;
 #endif				/* USE_LIBTHAI */
     obj->ref_func = ref_func;
+    obj->allocator = alloc;
+    obj->refcount = 1UL;
+    return obj;
+}
+
+/** Session Constructor
+ *
+ * Creates new linebreak object sharing configuration with another object.
+ * Public members are copied, while custom property map, newline, prep_func
+ * and prep_data are shared with config.  Internal state is initialized.
+ * Reference count of config is increased and will be decreased when the
+ * session is destroyed.
+ *
+ * Sessions of one configuration may be used by distinct threads at the same
+ * time.  Configuration object is frozen while any sessions of it exist:
+ * Setters called on it fail and set its errnum to EBUSY.  Setters called
+ * on a session make private copy of shared members in advance.
+ * See also linebreak_unshare().
+ * Allocator of config is used.
+ * @param[in] config linebreak object, must not be NULL.
+ * @return New linebreak object.
+ * If error occurred, errno is set then NULL is returned.
+ */
+linebreak_t *linebreak_session_new(linebreak_t * config)
+{
+    if (config == NULL)
+	return (errno = EINVAL), NULL;
+    return linebreak_session_new_with_allocator(config, config->allocator);
+}
+
+/** Session Constructor with Allocator
+ *
+ * Same as linebreak_session_new() but the session, its internal state,
+ * private copy of configuration and its strings and results are allocated
+ * by alloc.  Shared configuration is still owned by config.
+ * @param[in] config linebreak object, must not be NULL.
+ * @param[in] alloc allocator, or NULL to use default allocator.
+ * @return New linebreak object.
+ * If error occurred, errno is set then NULL is returned.
+ */
+linebreak_t *linebreak_session_new_with_allocator(linebreak_t * config,
+						  const sombok_allocator_t *
+						  alloc)
+{
+    linebreak_t *obj;
+
+    if (config == NULL)
+	return (errno = EINVAL), NULL;
+    if (alloc == NULL)
+	alloc = sombok_allocator;
+    if ((obj = SOMBOK_MALLOC(alloc, sizeof(linebreak_t))) == NULL)
+	return NULL;
+    memcpy(obj, config, sizeof(linebreak_t));
+    obj->allocator = alloc;
+
+    obj->state = LINEBREAK_STATE_NONE;
+    obj->bufstr.str = NULL;
+    obj->bufstr.len = 0;
+    obj->bufspc.str = NULL;
+    obj->bufspc.len = 0;
+    obj->bufcols = 0.0;
+    obj->unread.str = NULL;
+    obj->unread.len = 0;
+    obj->errnum = 0;
+
+    obj->cache = NULL;
+    obj->scratch = NULL;
+    /* counters are private, enabled if configuration's ones are. */
+    if (config->stats != NULL &&
+	(obj->stats = SOMBOK_MALLOC(alloc, sizeof(linebreak_stats_t))) !=
+	NULL)
+	memset(obj->stats, 0, sizeof(linebreak_stats_t));
+    else
+	obj->stats = NULL;
+
+    if (config->config != NULL)
+	obj->config = linebreak_incref(config->config);
+    else
+	obj->config = linebreak_incref(config);
+    SESSIONS_INC(obj->config);
+    obj->sessions = 0UL;
     obj->refcount = 1UL;
     return obj;
 }
 
+/** Make Private Configuration of Session
+ *
+ * @note this function is for internal use.
+ *
+ * If obj is a session, copy members shared with configuration object so
+ * that they may be modified, then release configuration object.
+ * Otherwise, check that obj may be modified.
+ * @param[in] obj linebreak object, must not be NULL.
+ * @return linebreak object itself.
+ * If obj is configuration of any sessions, errno is set to EBUSY then NULL
+ * is returned.
+ * If error occurred, errno is set then NULL is returned.
+ */
+linebreak_t *linebreak_unshare(linebreak_t * obj)
+{
+    linebreak_t *newobj, *config;
+
+    if (obj->config == NULL) {
+	if (obj->sessions != 0UL)
+	    return (errno = EBUSY), NULL;
+	return obj;
+    }
+    if ((newobj = linebreak_copy(obj)) == NULL)
+	return NULL;
+
+    /* take over members of the copy, except internal state. */
+    obj->map = newobj->map;
+    obj->newline.str = newobj->newline.str;
+    obj->prep_func = newobj->prep_func;
+    obj->prep_data = newobj->prep_data;
+    SOMBOK_FREE(obj->allocator, newobj->bufstr.str);
+    SOMBOK_FREE(obj->allocator, newobj->bufspc.str);
+    SOMBOK_FREE(obj->allocator, newobj->unread.str);
+    SOMBOK_FREE(obj->allocator, newobj);
+
+    config = obj->config;
+    obj->config = NULL;
+    SESSIONS_DEC(config);
+    linebreak_destroy(config);
+    return obj;
+}
+
 /** Increase Reference Count
  *
  * Increse reference count of linebreak object.
+ * Reference count is updated atomically if the platform supports it.
  * @param[in] obj linebreak object, must not be NULL.
  * @return linebreak object itself.
  * If error occurred, errno is set then NULL is returned.
  */
 linebreak_t *linebreak_incref(linebreak_t * obj)
 {
-    obj->refcount += 1UL;
+    REFCOUNT_INC(obj);
     return obj;
 }
 
@@ -71,16 +229,19 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
     linebreak_t *newobj;
     mapent_t *newmap;
     unichar_t *newstr;
+    const sombok_allocator_t *alloc;
 
     if (obj == NULL)
 	return (errno = EINVAL), NULL;
-    if ((newobj = malloc(sizeof(linebreak_t))) == NULL)
+    alloc = obj->allocator;
+    if ((newobj = SOMBOK_MALLOC(alloc, sizeof(linebreak_t))) == NULL)
 	return NULL;
     memcpy(newobj, obj, sizeof(linebreak_t));
 
     if (obj->map != NULL && obj->mapsiz) {
-	if ((newmap = malloc(sizeof(mapent_t) * obj->mapsiz)) == NULL) {
-	    free(newobj);
+	if ((newmap = SOMBOK_MALLOC(alloc, sizeof(mapent_t) * obj->mapsiz))
+	    == NULL) {
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newmap, obj->map, sizeof(mapent_t) * obj->mapsiz);
@@ -89,10 +250,10 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 	newobj->map = NULL;
 
     if (obj->newline.str != NULL && obj->newline.len) {
-	if ((newstr =
-	     malloc(sizeof(unichar_t) * obj->newline.len)) == NULL) {
-	    free(newobj->map);
-	    free(newobj);
+	if ((newstr = SOMBOK_MALLOC(alloc, sizeof(unichar_t) *
+				    obj->newline.len)) == NULL) {
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newstr, obj->newline.str,
@@ -102,10 +263,11 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 	newobj->newline.str = NULL;
 
     if (obj->bufstr.str != NULL && obj->bufstr.len) {
-	if ((newstr = malloc(sizeof(unichar_t) * obj->bufstr.len)) == NULL) {
-	    free(newobj->map);
-	    free(newobj->newline.str);
-	    free(newobj);
+	if ((newstr = SOMBOK_MALLOC(alloc, sizeof(unichar_t) *
+				    obj->bufstr.len)) == NULL) {
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj->newline.str);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newstr, obj->bufstr.str,
@@ -115,11 +277,12 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 	newobj->bufstr.str = NULL;
 
     if (obj->bufspc.str != NULL && obj->bufspc.len) {
-	if ((newstr = malloc(sizeof(unichar_t) * obj->bufspc.len)) == NULL) {
-	    free(newobj->map);
-	    free(newobj->newline.str);
-	    free(newobj->bufstr.str);
-	    free(newobj);
+	if ((newstr = SOMBOK_MALLOC(alloc, sizeof(unichar_t) *
+				    obj->bufspc.len)) == NULL) {
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj->newline.str);
+	    SOMBOK_FREE(alloc, newobj->bufstr.str);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newstr, obj->bufspc.str,
@@ -129,12 +292,13 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 	newobj->bufspc.str = NULL;
 
     if (obj->unread.str != NULL && obj->unread.len) {
-	if ((newstr = malloc(sizeof(unichar_t) * obj->unread.len)) == NULL) {
-	    free(newobj->map);
-	    free(newobj->newline.str);
-	    free(newobj->bufstr.str);
-	    free(newobj->bufspc.str);
-	    free(newobj);
+	if ((newstr = SOMBOK_MALLOC(alloc, sizeof(unichar_t) *
+				    obj->unread.len)) == NULL) {
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj->newline.str);
+	    SOMBOK_FREE(alloc, newobj->bufstr.str);
+	    SOMBOK_FREE(alloc, newobj->bufspc.str);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newstr, obj->unread.str,
@@ -147,26 +311,27 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 	size_t i;
 	for (i = 0; obj->prep_func[i] != NULL; i++);
 	if ((newobj->prep_func =
-	     malloc(sizeof(linebreak_prep_func_t) * (i + 1)))
+	     SOMBOK_MALLOC(alloc, sizeof(linebreak_prep_func_t) * (i + 1)))
 	    == NULL) {
-	    free(newobj->map);
-	    free(newobj->newline.str);
-	    free(newobj->bufstr.str);
-	    free(newobj->bufspc.str);
-	    free(newobj->unread.str);
-	    free(newobj);
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj->newline.str);
+	    SOMBOK_FREE(alloc, newobj->bufstr.str);
+	    SOMBOK_FREE(alloc, newobj->bufspc.str);
+	    SOMBOK_FREE(alloc, newobj->unread.str);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	memcpy(newobj->prep_func, obj->prep_func,
 	       sizeof(linebreak_prep_func_t) * (i + 1));
-	if ((newobj->prep_data = malloc(sizeof(void *) * (i + 1))) == NULL) {
-	    free(newobj->map);
-	    free(newobj->newline.str);
-	    free(newobj->bufstr.str);
-	    free(newobj->bufspc.str);
-	    free(newobj->unread.str);
-	    free(newobj->prep_func);
-	    free(newobj);
+	if ((newobj->prep_data = SOMBOK_MALLOC(alloc, sizeof(void *) *
+					       (i + 1))) == NULL) {
+	    SOMBOK_FREE(alloc, newobj->map);
+	    SOMBOK_FREE(alloc, newobj->newline.str);
+	    SOMBOK_FREE(alloc, newobj->bufstr.str);
+	    SOMBOK_FREE(alloc, newobj->bufspc.str);
+	    SOMBOK_FREE(alloc, newobj->unread.str);
+	    SOMBOK_FREE(alloc, newobj->prep_func);
+	    SOMBOK_FREE(alloc, newobj);
 	    return NULL;
 	}
 	if (obj->prep_data == NULL)
@@ -200,6 +365,11 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
 				 +1);
     }
 
+    newobj->config = NULL;
+    newobj->sessions = 0UL;
+    newobj->cache = NULL;
+    newobj->stats = NULL;
+    newobj->scratch = NULL;
     newobj->refcount = 1UL;
     return newobj;
 }
@@ -211,6 +381,8 @@ linebreak_t *linebreak_copy(linebreak_t * obj)
  * object and then, if ref_func member of object was not NULL,
  * it will be executed to decrease reference count of prep_data, format_data,
  * sizing_data, urgent_data and stash members.
+ * If obj was a session, reference count of its configuration object will
+ * be decreased instead.
  * @param[in] obj linebreak object.
  * @return none.
  * If obj was NULL, do nothing.
@@ -219,13 +391,22 @@ void linebreak_destroy(linebreak_t * obj)
 {
     if (obj == NULL)
 	return;
-    if ((obj->refcount -= 1UL))
+    if (REFCOUNT_DEC(obj))
+	return;
+    SOMBOK_FREE(obj->allocator, obj->bufstr.str);
+    SOMBOK_FREE(obj->allocator, obj->bufspc.str);
+    SOMBOK_FREE(obj->allocator, obj->unread.str);
+    linebreak_cache_destroy(obj->cache);
+    linebreak_scratch_destroy(obj->scratch);
+    SOMBOK_FREE(obj->allocator, obj->stats);
+    if (obj->config != NULL) {
+	SESSIONS_DEC(obj->config);
+	linebreak_destroy(obj->config);
+	SOMBOK_FREE(obj->allocator, obj);
 	return;
-    free(obj->map);
-    free(obj->newline.str);
-    free(obj->bufstr.str);
-    free(obj->bufspc.str);
-    free(obj->unread.str);
+    }
+    SOMBOK_FREE(obj->allocator, obj->map);
+    SOMBOK_FREE(obj->allocator, obj->newline.str);
     if (obj->ref_func != NULL) {
 	if (obj->stash != NULL)
 	    (*obj->ref_func) (obj->stash, LINEBREAK_REF_STASH, -1);
@@ -245,9 +426,9 @@ void linebreak_destroy(linebreak_t * obj)
 	if (obj->user_data != NULL)
 	    (*obj->ref_func) (obj->user_data, LINEBREAK_REF_USER, -1);
     }
-    free(obj->prep_func);
-    free(obj->prep_data);
-    free(obj);
+    SOMBOK_FREE(obj->allocator, obj->prep_func);
+    SOMBOK_FREE(obj->allocator, obj->prep_data);
+    SOMBOK_FREE(obj->allocator, obj);
 }
 
 /** Setter: Update newline member
@@ -263,8 +444,14 @@ void linebreak_set_newline(linebreak_t * lbobj, unistr_t * newline)
     unichar_t *str;
     size_t len;
 
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
+
     if (newline != NULL && newline->str != NULL && newline->len != 0) {
-	if ((str = malloc(sizeof(unichar_t) * newline->len)) == NULL) {
+	if ((str = SOMBOK_MALLOC(lbobj->allocator,
+				 sizeof(unichar_t) * newline->len)) == NULL) {
 	    lbobj->errnum = errno ? errno : ENOMEM;
 	    return;
 	}
@@ -274,7 +461,7 @@ void linebreak_set_newline(linebreak_t * lbobj, unistr_t * newline)
 	str = NULL;
 	len = 0;
     }
-    free(lbobj->newline.str);
+    SOMBOK_FREE(lbobj->allocator, lbobj->newline.str);
     lbobj->newline.str = str;
     lbobj->newline.len = len;
 }
@@ -289,6 +476,10 @@ void linebreak_set_newline(linebreak_t * lbobj, unistr_t * newline)
  */
 void linebreak_set_stash(linebreak_t * lbobj, void *stash)
 {
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
     if (lbobj->ref_func != NULL) {
 	if (stash != NULL)
 	    (*(lbobj->ref_func)) (stash, LINEBREAK_REF_STASH, +1);
@@ -311,6 +502,10 @@ void linebreak_set_format(linebreak_t * lbobj,
 			  linebreak_format_func_t format_func,
 			  void *format_data)
 {
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
     if (lbobj->ref_func != NULL) {
 	if (format_data != NULL)
 	    (*(lbobj->ref_func)) (format_data, LINEBREAK_REF_FORMAT, +1);
@@ -339,16 +534,21 @@ void linebreak_add_prep(linebreak_t * lbobj,
     linebreak_prep_func_t *p;
     void **q;
 
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
+
     if (prep_func == NULL) {
 	if (lbobj->prep_data != NULL) {
 	    for (i = 0; lbobj->prep_func[i] != NULL; i++)
 		if (lbobj->prep_data[i] != NULL)
 		    (*lbobj->ref_func) (lbobj->prep_data[i],
 					LINEBREAK_REF_PREP, -1);
-	    free(lbobj->prep_data);
+	    SOMBOK_FREE(lbobj->allocator, lbobj->prep_data);
 	    lbobj->prep_data = NULL;
 	}
-	free(lbobj->prep_func);
+	SOMBOK_FREE(lbobj->allocator, lbobj->prep_func);
 	lbobj->prep_func = NULL;
 	return;
     }
@@ -358,9 +558,8 @@ void linebreak_add_prep(linebreak_t * lbobj,
     else
 	for (i = 0; lbobj->prep_func[i] != NULL; i++);
 
-    if ((p =
-	 realloc(lbobj->prep_func,
-		 sizeof(linebreak_prep_func_t) * (i + 2)))
+    if ((p = SOMBOK_REALLOC(lbobj->allocator, lbobj->prep_func,
+			    sizeof(linebreak_prep_func_t) * (i + 2)))
 	== NULL) {
 	lbobj->errnum = errno;
 	return;
@@ -368,7 +567,8 @@ void linebreak_add_prep(linebreak_t * lbobj,
     p[i] = NULL;
     lbobj->prep_func = p;
 
-    if ((q = realloc(lbobj->prep_data, sizeof(void *) * (i + 2))) == NULL) {
+    if ((q = SOMBOK_REALLOC(lbobj->allocator, lbobj->prep_data,
+			    sizeof(void *) * (i + 2))) == NULL) {
 	lbobj->errnum = errno;
 	return;
     }
@@ -395,6 +595,10 @@ void linebreak_set_sizing(linebreak_t * lbobj,
 			  linebreak_sizing_func_t sizing_func,
 			  void *sizing_data)
 {
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
     if (lbobj->ref_func != NULL) {
 	if (sizing_data != NULL)
 	    (*(lbobj->ref_func)) (sizing_data, LINEBREAK_REF_SIZING, +1);
@@ -419,6 +623,10 @@ void linebreak_set_urgent(linebreak_t * lbobj,
 			  linebreak_urgent_func_t urgent_func,
 			  void *urgent_data)
 {
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
     if (lbobj->ref_func != NULL) {
 	if (urgent_data != NULL)
 	    (*(lbobj->ref_func)) (urgent_data, LINEBREAK_REF_URGENT, +1);
@@ -444,6 +652,10 @@ void linebreak_set_user(linebreak_t * lbobj,
 			linebreak_obs_prep_func_t user_func,
 			void *user_data)
 {
+    if (linebreak_unshare(lbobj) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return;
+    }
     if (lbobj->ref_func != NULL) {
 	if (user_data != NULL)
 	    (*(lbobj->ref_func)) (user_data, LINEBREAK_REF_USER, +1);
@@ -467,13 +679,13 @@ void linebreak_reset(linebreak_t * lbobj)
 {
     if (lbobj == NULL)
 	return;
-    free(lbobj->unread.str);
+    SOMBOK_FREE(lbobj->allocator, lbobj->unread.str);
     lbobj->unread.str = NULL;
     lbobj->unread.len = 0;
-    free(lbobj->bufstr.str);
+    SOMBOK_FREE(lbobj->allocator, lbobj->bufstr.str);
     lbobj->bufstr.str = NULL;
     lbobj->bufstr.len = 0;
-    free(lbobj->bufspc.str);
+    SOMBOK_FREE(lbobj->allocator, lbobj->bufspc.str);
     lbobj->bufspc.str = NULL;
     lbobj->bufspc.len = 0;
     lbobj->bufcols = 0.0;
@@ -481,6 +693,200 @@ void linebreak_reset(linebreak_t * lbobj)
     lbobj->errnum = 0;
 }
 
+/*
+ * Serialized state: "LBS" and format version, then state, bufcols,
+ * bufstr, bufspc and unread.  Integers are unsigned LEB128 (state is
+ * zigzag-encoded).  bufcols is IEEE 754 double in big endian.  Each
+ * string is its length followed by characters.
+ */
+#define STATE_MAGIC "LBS\001"
+#define STATE_MAGIC_LEN (4)
+
+static
+size_t _varint_put(unsigned char *p, unsigned long v)
+{
+    size_t n = 0;
+
+    do {
+	if (p != NULL)
+	    p[n] = (unsigned char) ((v & 0x7F) | ((0x7F < v) ? 0x80 : 0));
+	n++;
+	v >>= 7;
+    } while (v);
+    return n;
+}
+
+static
+int _varint_get(unsigned char **pp, unsigned char *end, unsigned long *vp)
+{
+    unsigned long v = 0;
+    int shift = 0;
+
+    while (*pp < end && shift < (int) sizeof(unsigned long) * 8) {
+	v |= (unsigned long) (**pp & 0x7F) << shift;
+	if (!(*((*pp)++) & 0x80)) {
+	    *vp = v;
+	    return 0;
+	}
+	shift += 7;
+    }
+    return -1;
+}
+
+static
+size_t _unistr_put(unsigned char *p, unistr_t * unistr)
+{
+    size_t i, n;
+
+    n = _varint_put(p, (unsigned long) unistr->len);
+    for (i = 0; i < unistr->len; i++)
+	n += _varint_put((p == NULL) ? NULL : p + n,
+			 (unsigned long) unistr->str[i]);
+    return n;
+}
+
+static
+int _unistr_get(const sombok_allocator_t * alloc, unsigned char **pp,
+		unsigned char *end, unistr_t * unistr)
+{
+    unsigned long len, c;
+    size_t i;
+
+    unistr->str = NULL;
+    unistr->len = 0;
+    /* each character takes at least one byte. */
+    if (_varint_get(pp, end, &len) != 0 || (unsigned long) (end - *pp) < len)
+	return (errno = EINVAL), -1;
+    if (len == 0)
+	return 0;
+    if ((unistr->str = SOMBOK_MALLOC(alloc, sizeof(unichar_t) * len)) == NULL)
+	return -1;
+    for (i = 0; i < len; i++) {
+	if (_varint_get(pp, end, &c) != 0) {
+	    SOMBOK_FREE(alloc, unistr->str);
+	    unistr->str = NULL;
+	    return (errno = EINVAL), -1;
+	}
+	unistr->str[i] = (unichar_t) c;
+    }
+    unistr->len = len;
+    return 0;
+}
+
+/** Save State
+ *
+ * Serialize internal state of linebreak object set by
+ * linebreak_break_partial(), so that breaking may be resumed by
+ * linebreak_state_restore(), possibly on another process.
+ * Configuration such as options and callbacks is not saved.
+ * @param[in] lbobj linebreak object.
+ * @param[out] lenp length of result.
+ * @return New binary data, which should be freed by
+ * sombok_free(lbobj->allocator, data).
+ * If error occurred, lbobj->errnum is set then NULL is returned.
+ */
+char *linebreak_state_save(linebreak_t * lbobj, size_t * lenp)
+{
+    unsigned char *buf, *p;
+    unsigned long state;
+    size_t len;
+    union {
+	double d;
+	unsigned char c[sizeof(double)];
+    } cols;
+    int i, big_endian = 1;
+
+    state = (lbobj->state < 0) ? ((unsigned long) -lbobj->state * 2 - 1) :
+	(unsigned long) lbobj->state * 2;
+
+    len = STATE_MAGIC_LEN + _varint_put(NULL, state) + 8 +
+	_unistr_put(NULL, &lbobj->bufstr) + _unistr_put(NULL, &lbobj->bufspc)
+	+ _unistr_put(NULL, &lbobj->unread);
+    if ((buf = SOMBOK_MALLOC(lbobj->allocator, len)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+
+    p = buf;
+    memcpy(p, STATE_MAGIC, STATE_MAGIC_LEN);
+    p += STATE_MAGIC_LEN;
+    p += _varint_put(p, state);
+    cols.d = lbobj->bufcols;
+    big_endian = *(unsigned char *) &big_endian == 0;
+    for (i = 0; i < 8; i++)
+	*p++ = cols.c[big_endian ? i : 7 - i];
+    p += _unistr_put(p, &lbobj->bufstr);
+    p += _unistr_put(p, &lbobj->bufspc);
+    p += _unistr_put(p, &lbobj->unread);
+
+    if (lenp != NULL)
+	*lenp = len;
+    return (char *) buf;
+}
+
+/** Restore State
+ *
+ * Restore internal state of linebreak object saved by
+ * linebreak_state_save().  lbobj should be configured in the same way
+ * as the object state was saved from.
+ * @param[in] lbobj linebreak object.
+ * @param[in] data binary data.
+ * @param[in] len length of data.
+ * @return 0.
+ * If data was malformed, lbobj->errnum is set to EINVAL then -1 is
+ * returned, and state of lbobj is not modified.  If other error occurred,
+ * lbobj->errnum is set then -1 is returned.
+ */
+int linebreak_state_restore(linebreak_t * lbobj, char *data, size_t len)
+{
+    unsigned char *p = (unsigned char *) data, *end, c[8];
+    unsigned long state;
+    unistr_t bufstr, bufspc, unread;
+    union {
+	double d;
+	unsigned char c[sizeof(double)];
+    } cols;
+    int i, big_endian = 1;
+
+    errno = 0;
+    if (data == NULL || len < STATE_MAGIC_LEN + 8 ||
+	memcmp(p, STATE_MAGIC, STATE_MAGIC_LEN) != 0) {
+	lbobj->errnum = EINVAL;
+	return -1;
+    }
+    end = p + len;
+    p += STATE_MAGIC_LEN;
+    if (_varint_get(&p, end, &state) != 0 || end - p < 8 ||
+	LINEBREAK_STATE_MAX * 2 < state) {
+	lbobj->errnum = EINVAL;
+	return -1;
+    }
+    memcpy(c, p, 8);
+    p += 8;
+    big_endian = *(unsigned char *) &big_endian == 0;
+    for (i = 0; i < 8; i++)
+	cols.c[big_endian ? i : 7 - i] = c[i];
+
+    bufspc.str = unread.str = NULL;
+    if (_unistr_get(lbobj->allocator, &p, end, &bufstr) != 0 ||
+	_unistr_get(lbobj->allocator, &p, end, &bufspc) != 0 ||
+	_unistr_get(lbobj->allocator, &p, end, &unread) != 0 || p != end) {
+	lbobj->errnum = errno ? errno : EINVAL;
+	SOMBOK_FREE(lbobj->allocator, bufstr.str);
+	SOMBOK_FREE(lbobj->allocator, bufspc.str);
+	SOMBOK_FREE(lbobj->allocator, unread.str);
+	return -1;
+    }
+
+    linebreak_reset(lbobj);
+    lbobj->state = (state & 1) ? -(int) ((state + 1) / 2) : (int) (state / 2);
+    lbobj->bufcols = cols.d;
+    lbobj->bufstr = bufstr;
+    lbobj->bufspc = bufspc;
+    lbobj->unread = unread;
+    return 0;
+}
+
 /** Get breaking rule between two classes
  *
  * From given two line breaking classes, get breaking rule determined by
@@ -49,7 +49,8 @@ void linebreak_southeastasian_flagbreak(gcstring_t * gcstr)
     len = gcstr->len;
 
     /* Copy string to temp buffer so that abuse of external module avoided. */
-    if ((buf = malloc(sizeof(wchar_t) * (len + 1))) == NULL)
+    if ((buf = SOMBOK_MALLOC(((linebreak_t *) gcstr->lbobj)->allocator,
+			     sizeof(wchar_t) * (len + 1))) == NULL)
 	return;
 #ifdef SOMBOK_UNICHAR_T_IS_WCHAR_T
     memcpy(buf, gcstr->str, sizeof(wchar_t) * len);
@@ -102,6 +103,6 @@ void linebreak_southeastasian_flagbreak(gcstring_t * gcstr)
 	}
     }
 
-    free(buf);
+    SOMBOK_FREE(((linebreak_t *) gcstr->lbobj)->allocator, buf);
 #endif /* USE_LIBTHAI */
 }
@@ -0,0 +1,139 @@
+/*
+ * stats.c - performance counters of linebreak object.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+#include "sombok.h"
+#if defined(HAVE_CLOCK_GETTIME)
+#    include <time.h>
+#elif defined(HAVE_GETTIMEOFDAY)
+#    include <sys/time.h>
+#else
+#    include <time.h>
+#endif
+
+/** @defgroup linebreak_stats stats
+ * @brief Performance counters of linebreak object
+ *
+ * If enabled, each linebreak object accumulates numbers of processed
+ * characters, output lines, callback invocations and so on, and time
+ * spent in each phase of line breaking.  Counting costs little, but
+ * timing costs a few system calls for each chunk of text.
+ *
+ * Sessions (see linebreak_session_new()) have their own counters, which
+ * are enabled if those of configuration object are.  Counters of sessions
+ * used by linebreak_break_parallel() are added to those of the object
+ * given to it.
+ *@{*/
+
+/** Enable or Disable Performance Counters
+ *
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[in] enable If non-zero, counters are enabled and cleared.
+ * Otherwise they are disabled.
+ * @return 0.  If error occurred, lbobj->errnum is set then -1 is returned.
+ */
+int linebreak_set_stats(linebreak_t * lbobj, int enable)
+{
+    if (!enable) {
+	SOMBOK_FREE(lbobj->allocator, lbobj->stats);
+	lbobj->stats = NULL;
+	return 0;
+    }
+    if (lbobj->stats == NULL &&
+	(lbobj->stats = SOMBOK_MALLOC(lbobj->allocator,
+				      sizeof(linebreak_stats_t))) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return -1;
+    }
+    memset(lbobj->stats, 0, sizeof(linebreak_stats_t));
+    return 0;
+}
+
+/** Get Performance Counters
+ *
+ * @param[in] lbobj linebreak object, must not be NULL.
+ * @param[out] stats buffer to store counters, must not be NULL.
+ * @return 1 if counters are enabled.  Otherwise 0 is returned and
+ * counters are 0.
+ */
+int linebreak_get_stats(linebreak_t * lbobj, linebreak_stats_t * stats)
+{
+    if (lbobj->stats == NULL) {
+	memset(stats, 0, sizeof(linebreak_stats_t));
+	return 0;
+    }
+    memcpy(stats, lbobj->stats, sizeof(linebreak_stats_t));
+    return 1;
+}
+
+/** Add Performance Counters
+ *
+ * @note this function is for internal use.
+ *
+ * @param[in,out] stats counters to be added to, or NULL.
+ * @param[in] other counters to be added, or NULL.
+ * @return none.
+ */
+void linebreak_stats_add(linebreak_stats_t * stats,
+			 linebreak_stats_t * other)
+{
+    if (stats == NULL || other == NULL)
+	return;
+    stats->chars += other->chars;
+    stats->clusters += other->clusters;
+    stats->lines += other->lines;
+    stats->lines_mandatory += other->lines_mandatory;
+    stats->lines_arbitrary += other->lines_arbitrary;
+    stats->lines_urgent += other->lines_urgent;
+    stats->calls_format += other->calls_format;
+    stats->calls_sizing += other->calls_sizing;
+    stats->calls_urgent += other->calls_urgent;
+    stats->calls_prep += other->calls_prep;
+    stats->gcstrings += other->gcstrings;
+    stats->gcstring_bytes += other->gcstring_bytes;
+    stats->map_lookups += other->map_lookups;
+    stats->scanned += other->scanned;
+    stats->moved += other->moved;
+    stats->time_prep += other->time_prep;
+    stats->time_sea += other->time_sea;
+    stats->time_lb21a += other->time_lb21a;
+    stats->time_lb25 += other->time_lb25;
+    stats->time_main += other->time_main;
+    stats->time_format += other->time_format;
+}
+
+/** Current Time
+ *
+ * @note this function is for internal use.
+ *
+ * @return time in seconds from an arbitrary origin, preferably by
+ * monotonic clock.
+ */
+double linebreak_stats_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+    return 0.0;
+#elif defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) == 0)
+	return (double) tv.tv_sec + (double) tv.tv_usec * 1e-6;
+    return 0.0;
+#else
+    return (double) clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
+
+/*@}*/
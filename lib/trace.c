@@ -0,0 +1,104 @@
+/*
+ * trace.c - tracing hooks.
+ *
+ * Copyright (C) 2009-2012 by Hatuka*nezumi - IKEDA Soji.
+ *
+ * This file is part of the Sombok Package.  This program is free
+ * software; you can redistribute it and/or modify it under the terms of
+ * either the GNU General Public License or the Artistic License, as
+ * specified in the README file.
+ *
+ */
+
+#include "sombok.h"
+#include <stdio.h>
+#ifdef USE_PTHREAD
+#    include <pthread.h>
+#endif				/* USE_PTHREAD */
+
+/** @defgroup sombok_trace trace
+ * @brief Tracing hooks
+ *
+ * If a hook is installed, it is called at begin and end of each phase of
+ * line breaking (prep, sea, lb21a, lb25), of each call of format, sizing
+ * and urgent breaking callbacks (format, sizing, urgent), and of UTF-8
+ * conversion (decode_utf8, encode_utf8), as hook(data, name, phase),
+ * where phase is 'B' at begin and 'E' at end.  Hook may be called by
+ * multiple threads at the same time.
+ *
+ * Hooks are compiled only if trace support is enabled by configure
+ * (it is disabled by --disable-trace option).
+ *@{*/
+
+/** Installed hook, or NULL. */
+sombok_trace_func_t sombok_trace_func = NULL;
+/** Data argument of hook. */
+void *sombok_trace_data = NULL;
+
+/** Install Tracing Hook
+ *
+ * @param[in] func hook function, or NULL to remove hook.
+ * @param[in] data data argument of hook.
+ * @return 0.  If trace support is disabled, errno is set to ENOSYS then -1
+ * is returned.
+ */
+int sombok_set_trace(sombok_trace_func_t func, void *data)
+{
+#ifdef USE_TRACE
+    sombok_trace_data = data;
+    sombok_trace_func = func;
+    return 0;
+#else
+    if (func == NULL)
+	return 0;
+    errno = ENOSYS;
+    return -1;
+#endif				/* USE_TRACE */
+}
+
+/** Call Tracing Hook
+ *
+ * @note this function is for internal use.  Use SOMBOK_TRACE() macro.
+ *
+ * errno is preserved.
+ * @param[in] name name of event.
+ * @param[in] phase 'B' or 'E'.
+ * @return none.
+ */
+void sombok_trace_event(const char *name, int phase)
+{
+    sombok_trace_func_t func = sombok_trace_func;
+    int errnum = errno;
+
+    if (func != NULL)
+	(*func) (sombok_trace_data, name, phase);
+    errno = errnum;
+}
+
+/** Built-in Hook Writing Chrome Trace Events
+ *
+ * Writes each event as an element of JSON array in Trace Event Format
+ * used by chrome://tracing and so on, followed by comma.  Caller should
+ * write "[" before the first event, and may write the last element and
+ * "]" after the hook was removed.
+ * @param[in] data FILE pointer.
+ * @param[in] name name of event.
+ * @param[in] phase 'B' or 'E'.
+ * @return none.
+ */
+void sombok_trace_chrome(void *data, const char *name, int phase)
+{
+    unsigned long tid;
+
+#ifdef USE_PTHREAD
+    tid = (unsigned long) pthread_self();
+#else
+    tid = 1UL;
+#endif				/* USE_PTHREAD */
+    fprintf((FILE *) data,
+	    "{\"name\":\"%s\",\"cat\":\"sombok\",\"ph\":\"%c\","
+	    "\"ts\":%.3f,\"pid\":1,\"tid\":%lu},\n",
+	    name, phase, linebreak_stats_clock() * 1e6, tid);
+}
+
+/*@}*/
@@ -19,25 +19,10 @@
  *
  *@{*/
 
-/** Decode UTF-8 string to Unicode string
- *
- * @param[out] unistr Unicode string, must not be NULL.
- * @param[in] maxchars maximum number of characters to be decoded.
- * 0 means infinite
- * @param[in] utf8 source UTF-8 string
- * @param[in] utf8len length of string
- * @param[in] check 0: no check; 1: check malformed sequence; 2: check
- * surrogate too; 3: check codes beyond Unicode too
- *
- * @returns Unicode string.
- * If unistr->str was NULL or maxchars was 0 (infinite), required buffer will
- * be (re-)allocated.
- * If error occurred, NULL is returned and errno is set.
- *
- * @note unistr->str must not point to static memory.
- */
-unistr_t *sombok_decode_utf8(unistr_t *unistr, size_t maxchars,
-			     const char *utf8, size_t utf8len, int check)
+static
+unistr_t *_decode_utf8(const sombok_allocator_t * alloc, unistr_t *unistr,
+		       size_t maxchars, const char *utf8, size_t utf8len,
+		       int check)
 {
     size_t i, unilen;
     unichar_t unichar, *uni;
@@ -171,12 +156,13 @@ unistr_t *sombok_decode_utf8(unistr_t *unistr, size_t maxchars,
 
 	if (pass == 1) {
 	    if (uni == NULL) {
-		if ((uni = malloc(sizeof(unichar_t) * (unilen + 1))) == NULL)
+		if ((uni = SOMBOK_MALLOC(alloc, sizeof(unichar_t) *
+					 (unilen + 1))) == NULL)
 		    return NULL;
 		uni[unilen] = 0;
 	    } else if (maxchars == 0) {
-		if ((uni = realloc(uni,
-				   sizeof(unichar_t) * (unilen + 1))) == NULL)
+		if ((uni = SOMBOK_REALLOC(alloc, uni, sizeof(unichar_t) *
+					  (unilen + 1))) == NULL)
 		    return NULL;
 		uni[unilen] = 0;
 	    } else if (unilen < maxchars)
@@ -189,22 +175,53 @@ unistr_t *sombok_decode_utf8(unistr_t *unistr, size_t maxchars,
     return unistr;
 }
 
-/** Encode Unicode string to UTF-8 string
+/** Decode UTF-8 string to Unicode string
  *
- * @param[out] utf8 string buffer, may be NULL.
- * @param[out] utf8lenp pointer to length of buffer, may be NULL.
- * @param[in] maxbytes maximum number of bytes to be encoded.  0 means infinite
- * @param[in] unistr source Unicode string, must not be NULL.
+ * @param[out] unistr Unicode string, must not be NULL.
+ * @param[in] maxchars maximum number of characters to be decoded.
+ * 0 means infinite
+ * @param[in] utf8 source UTF-8 string
+ * @param[in] utf8len length of string
+ * @param[in] check 0: no check; 1: check malformed sequence; 2: check
+ * surrogate too; 3: check codes beyond Unicode too
  *
- * @returns string buffer.
- * If utf8 was NULL or maxbytes was 0 (infinite), required buffer will be
- * (re-)allocated.
+ * @returns Unicode string.
+ * If unistr->str was NULL or maxchars was 0 (infinite), required buffer will
+ * be (re-)allocated.
  * If error occurred, NULL is returned and errno is set.
  *
- * @note utf8 must not point to static memory.
+ * @note unistr->str must not point to static memory.
  */
-char *sombok_encode_utf8(char *utf8, size_t *utf8lenp, size_t maxbytes,
-			 unistr_t *unistr)
+unistr_t *sombok_decode_utf8(unistr_t *unistr, size_t maxchars,
+			     const char *utf8, size_t utf8len, int check)
+{
+    return sombok_decode_utf8_with_allocator(sombok_allocator, unistr,
+					     maxchars, utf8, utf8len, check);
+}
+
+/** Decode UTF-8 string to Unicode string by specified allocator
+ *
+ * Same as sombok_decode_utf8() except that buffer is (re-)allocated by
+ * allocator alloc.
+ * @param[in] alloc allocator, or NULL to use malloc(3) and so on.
+ * @note This function was introduced by release 2.5.0.
+ */
+unistr_t *sombok_decode_utf8_with_allocator(const sombok_allocator_t *
+					    alloc, unistr_t *unistr,
+					    size_t maxchars, const char *utf8,
+					    size_t utf8len, int check)
+{
+    unistr_t *ret;
+
+    SOMBOK_TRACE("decode_utf8", 'B');
+    ret = _decode_utf8(alloc, unistr, maxchars, utf8, utf8len, check);
+    SOMBOK_TRACE("decode_utf8", 'E');
+    return ret;
+}
+
+static
+char *_encode_utf8(const sombok_allocator_t * alloc, char *utf8,
+		   size_t *utf8lenp, size_t maxbytes, unistr_t *unistr)
 {
     size_t i, utf8len, unilen;
     unichar_t unichar;
@@ -302,12 +319,13 @@ char *sombok_encode_utf8(char *utf8, size_t *utf8lenp, size_t maxbytes,
 
 	if (pass == 1) {
 	    if (utf8 == NULL) {
-		if ((utf8 = malloc(sizeof(char) * (utf8len + 1))) == NULL)
+		if ((utf8 = SOMBOK_MALLOC(alloc, sizeof(char) *
+					  (utf8len + 1))) == NULL)
 		    return NULL;
 		utf8[utf8len] = '\0';
 	    } else if (maxbytes == 0) {
-		if ((utf8 = realloc(utf8,
-				    sizeof(char) * (utf8len + 1))) == NULL)
+		if ((utf8 = SOMBOK_REALLOC(alloc, utf8, sizeof(char) *
+					   (utf8len + 1))) == NULL)
 		    return NULL;
 		utf8[utf8len] = '\0';
 	    } else if (utf8len < maxbytes)
@@ -319,3 +337,43 @@ char *sombok_encode_utf8(char *utf8, size_t *utf8lenp, size_t maxbytes,
 
     return utf8;
 }
+
+/** Encode Unicode string to UTF-8 string
+ *
+ * @param[out] utf8 string buffer, may be NULL.
+ * @param[out] utf8lenp pointer to length of buffer, may be NULL.
+ * @param[in] maxbytes maximum number of bytes to be encoded.  0 means infinite
+ * @param[in] unistr source Unicode string, must not be NULL.
+ *
+ * @returns string buffer.
+ * If utf8 was NULL or maxbytes was 0 (infinite), required buffer will be
+ * (re-)allocated.
+ * If error occurred, NULL is returned and errno is set.
+ *
+ * @note utf8 must not point to static memory.
+ */
+char *sombok_encode_utf8(char *utf8, size_t *utf8lenp, size_t maxbytes,
+			 unistr_t *unistr)
+{
+    return sombok_encode_utf8_with_allocator(sombok_allocator, utf8,
+					     utf8lenp, maxbytes, unistr);
+}
+
+/** Encode Unicode string to UTF-8 string by specified allocator
+ *
+ * Same as sombok_encode_utf8() except that buffer is (re-)allocated by
+ * allocator alloc.
+ * @param[in] alloc allocator, or NULL to use malloc(3) and so on.
+ * @note This function was introduced by release 2.5.0.
+ */
+char *sombok_encode_utf8_with_allocator(const sombok_allocator_t * alloc,
+					char *utf8, size_t *utf8lenp,
+					size_t maxbytes, unistr_t *unistr)
+{
+    char *ret;
+
+    SOMBOK_TRACE("encode_utf8", 'B');
+    ret = _encode_utf8(alloc, utf8, utf8lenp, maxbytes, unistr);
+    SOMBOK_TRACE("encode_utf8", 'E');
+    return ret;
+}
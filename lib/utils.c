@@ -359,23 +359,17 @@ gcstring_t *linebreak_prep_URIBREAK(linebreak_t * lbobj, void *data,
 /** Built-in Sizing callback
  *
  * Built-in Sizing callback based on UAX #11.
+ * Columns of spc and str are summed up without concatenating them,
+ * assuming str begins at grapheme cluster boundary.
  */
 double linebreak_sizing_UAX11(linebreak_t * obj, double len,
 			      gcstring_t * pre, gcstring_t * spc,
 			      gcstring_t * str)
 {
-    gcstring_t *spcstr;
-
-    if ((!spc || !spc->str || !spc->len) &&
-	(!str || !str->str || !str->len))
-	return len;
-
-    if (!spc || !spc->str)
-	spcstr = gcstring_copy(str);
-    else if ((spcstr = gcstring_concat(spc, str)) == NULL)
-	return -1.0;
-    len += (double) gcstring_columns(spcstr);
-    gcstring_destroy(spcstr);
+    if (spc != NULL && spc->str != NULL)
+	len += (double) gcstring_columns(spc);
+    if (str != NULL && str->str != NULL)
+	len += (double) gcstring_columns(str);
     return len;
 }
 
@@ -533,59 +527,107 @@ gcstring_t *linebreak_urgent_ABORT(linebreak_t * lbobj, gcstring_t * str)
     return NULL;
 }
 
+/*
+ * Check if n grapheme clusters of str from pos fit in colmax columns.
+ * Returns 1 or 0, or -1 on error.
+ */
+static
+int _force_fits(linebreak_t * lbobj, gcstring_t * str, size_t pos,
+		size_t n)
+{
+    gcstring_t *t, empty = { NULL, 0, NULL, 0, 0, lbobj };
+    double cols;
+
+    if ((t = gcstring_substr(str, pos, n)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return -1;
+    }
+    cols = (*(lbobj->sizing_func)) (lbobj, 0.0, &empty, &empty, t);
+    gcstring_destroy(t);
+    if (cols < 0.0 && lbobj->errnum)
+	return -1;
+    return !(lbobj->colmax < cols);
+}
+
+/*
+ * Count grapheme clusters of str from pos fitting in colmax columns.
+ * Returns (size_t)-1 on error.
+ */
+static
+size_t _force_fit(linebreak_t * lbobj, gcstring_t * str, size_t pos)
+{
+    size_t rest = str->gclen - pos, lo, hi, n;
+    double cols;
+    int r;
+
+    /* Sizes by built-in sizing are summed up cluster by cluster. */
+    if (lbobj->sizing_func == NULL ||
+	lbobj->sizing_func == linebreak_sizing_UAX11) {
+	for (cols = 0.0, n = 0; n < rest; n++) {
+	    if (lbobj->sizing_func == NULL)
+		cols += 1.0;
+	    else
+		cols += (double) str->gcstr[pos + n].col;
+	    if (lbobj->colmax < cols)
+		break;
+	}
+	return n;
+    }
+
+    /*
+     * Otherwise gallop then bisect, assuming that size given by sizing
+     * callback won't decrease as string grows.
+     */
+    lo = 0;
+    hi = 1;
+    while ((r = _force_fits(lbobj, str, pos, hi)) == 1) {
+	lo = hi;
+	if (rest <= lo)
+	    return lo;
+	hi = (rest < lo * 2) ? rest : lo * 2;
+    }
+    if (r < 0)
+	return (size_t) - 1;
+    /* lo clusters fit but hi clusters don't. */
+    while (lo + 1 < hi) {
+	n = lo + (hi - lo) / 2;
+	if ((r = _force_fits(lbobj, str, pos, n)) < 0)
+	    return (size_t) - 1;
+	else if (r)
+	    lo = n;
+	else
+	    hi = n;
+    }
+    return lo;
+}
+
 /** Built-in urgent brealing callback
  *
  * Force breaking lines.
+ * Breaking positions are flagged on a copy of text in one pass.
  */
 gcstring_t *linebreak_urgent_FORCE(linebreak_t * lbobj, gcstring_t * str)
 {
-    gcstring_t *result, *s, empty = { NULL, 0, NULL, 0, 0, lbobj };
+    gcstring_t *result;
+    size_t pos, n;
 
     if (!str || !str->len)
 	return gcstring_new(NULL, lbobj);
 
-    result = gcstring_new(NULL, lbobj);
-    s = gcstring_copy(str);
-    while (1) {
-	size_t i;
-	gcstring_t *t;
-	double cols;
-
-	for (i = 0; i < s->gclen; i++) {
-	    t = gcstring_substr(s, 0, i + 1);
-	    if (lbobj->sizing_func != NULL)
-		cols =
-		    (*(lbobj->sizing_func)) (lbobj, 0.0, &empty, &empty,
-					     t);
-	    else
-		cols = (double) t->gclen;
-	    gcstring_destroy(t);
-
-	    if (lbobj->colmax < cols)
-		break;
+    if ((result = gcstring_copy(str)) == NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return NULL;
+    }
+    for (pos = 0; pos < result->gclen; pos += n) {
+	if ((n = _force_fit(lbobj, result, pos)) == (size_t) - 1) {
+	    gcstring_destroy(result);
+	    return NULL;
 	}
-	if (0 < i) {
-	    t = gcstring_substr(s, 0, i);
-	    if (t->gclen) {
-		t->gcstr[0].flag = LINEBREAK_FLAG_ALLOW_BEFORE;
-		gcstring_append(result, t);
-	    }
-	    gcstring_destroy(t);
-	    t = gcstring_substr(s, i, s->gclen - i);
-	    gcstring_destroy(s);
-	    s = t;
-
-	    if (!s->gclen)
-		break;
-	} else {
-	    if (s->gclen) {
-		s->gcstr[0].flag = LINEBREAK_FLAG_ALLOW_BEFORE;
-		gcstring_append(result, s);
-	    }
+	result->gcstr[pos].flag = LINEBREAK_FLAG_ALLOW_BEFORE;
+	/* the rest is too wide: not break any more. */
+	if (n == 0)
 	    break;
-	}
     }
-    gcstring_destroy(s);
     return result;
 }
 
@@ -2,164 +2,423 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#define _MYMALLOC_H_
+#define MYMALLOC_NOWRAP
 #include "sombok.h"
+#ifdef USE_PTHREAD
+#    include <pthread.h>
+#endif				/* USE_PTHREAD */
 
-#define INFOLEN (128)
-#define ALLOCMAX (8191)
-static void *alloclist[ALLOCMAX + 1];
-static size_t allocindex = 0;
-static int allocserial = 0;
+/*
+ * Allocation profiler.
+ *
+ * Each block is preceded by a header recording its size and the call site
+ * which allocated it.  Live blocks are found by a hash table keyed by
+ * address, and statistics are accumulated for each call site.
+ *
+ * If environment variable MYMALLOC_PROFILE is set, profile is written at
+ * exit to the file it names (or to standard error, if it is empty or "-").
+ * Profile may also be written at any time by MYdump().  Blocks not freed
+ * at exit are reported to standard error.
+ */
+
+#define HISTLEN (32)
+#define SITEHASHSIZ (1021)
+
+typedef struct mysite_t {
+    struct mysite_t *next;
+    const char *file;
+    int line;
+    const char *op;
+    char token[64];
+    unsigned long allocs, reallocs, frees;
+    size_t bytes, live, peak;
+    unsigned long hist[HISTLEN];
+} mysite_t;
+
+typedef struct myblock_t {
+    struct myblock_t *next;
+    mysite_t *site;
+    size_t size;
+    unsigned long serial;
+} myblock_t;
+
+/* Header size keeping alignment of blocks. */
+#define HDRSIZ ((sizeof(myblock_t) + 15) & ~((size_t) 15))
+#define BLOCK2PTR(blk) ((void *) ((char *) (blk) + HDRSIZ))
+
+static myblock_t **blocks = NULL;
+static size_t blockhashsiz = 0;
+static mysite_t *sites[SITEHASHSIZ];
+static mymalloc_stats_t total;
+static unsigned long totalhist[HISTLEN];
+static unsigned long allocserial = 0;
 static int atexit_set = 0;
+#ifdef USE_PTHREAD
+static pthread_mutex_t mylock = PTHREAD_MUTEX_INITIALIZER;
+#    define LOCK() pthread_mutex_lock(&mylock)
+#    define UNLOCK() pthread_mutex_unlock(&mylock)
+#else
+#    define LOCK()
+#    define UNLOCK()
+#endif				/* USE_PTHREAD */
 
 static
-int MYcmp(char **x, char **y)
+size_t ptrhash(void *ptr, size_t siz)
 {
-    if (*x == NULL) {
-	if (*y == NULL)
-	    return 0;
-	else
-	    return 1;
-    } else if (*y == NULL)
-	return -1;
-    return strcmp(*x, *y);
+    return ((size_t) ptr >> 4) % siz;
+}
+
+static
+int histindex(size_t size)
+{
+    int i;
+
+    for (i = 0; 1 < size && i < HISTLEN - 1; i++)
+	size >>= 1;
+    return i;
+}
+
+static
+mysite_t *getsite(const char *file, int line, const char *op,
+		  const char *token1, const char *token2)
+{
+    size_t h = (size_t) line;
+    const char *p;
+    mysite_t *site;
+
+    for (p = file; *p; p++)
+	h = h * 31 + (unsigned char) *p;
+    h %= SITEHASHSIZ;
+    for (site = sites[h]; site != NULL; site = site->next)
+	if (site->line == line && strcmp(site->file, file) == 0 &&
+	    strcmp(site->op, op) == 0)
+	    return site;
+
+    if ((site = calloc(1, sizeof(mysite_t))) == NULL)
+	return NULL;
+    site->file = file;
+    site->line = line;
+    site->op = op;
+    if (token2 == NULL)
+	snprintf(site->token, sizeof(site->token), "%s", token1);
+    else
+	snprintf(site->token, sizeof(site->token), "%s, %s", token1,
+		 token2);
+    site->next = sites[h];
+    sites[h] = site;
+    return site;
+}
+
+static
+int addblock(myblock_t * blk)
+{
+    myblock_t **newblocks, *b, *next;
+    size_t i, h, newsiz;
+
+    if (blockhashsiz <= total.blocks) {
+	newsiz = blockhashsiz ? blockhashsiz * 2 + 1 : 8191;
+	if ((newblocks = calloc(newsiz, sizeof(myblock_t *))) == NULL)
+	    return -1;
+	for (i = 0; i < blockhashsiz; i++)
+	    for (b = blocks[i]; b != NULL; b = next) {
+		next = b->next;
+		h = ptrhash(BLOCK2PTR(b), newsiz);
+		b->next = newblocks[h];
+		newblocks[h] = b;
+	    }
+	free(blocks);
+	blocks = newblocks;
+	blockhashsiz = newsiz;
+    }
+    h = ptrhash(BLOCK2PTR(blk), blockhashsiz);
+    blk->next = blocks[h];
+    blocks[h] = blk;
+    total.blocks++;
+    return 0;
+}
+
+/* Unlink block from hash table.  Returns NULL if it is not a live block. */
+static
+myblock_t *delblock(void *ptr)
+{
+    myblock_t **bp;
+    myblock_t *blk;
+
+    if (blockhashsiz == 0)
+	return NULL;
+    for (bp = &blocks[ptrhash(ptr, blockhashsiz)]; *bp != NULL;
+	 bp = &(*bp)->next)
+	if (BLOCK2PTR(*bp) == ptr) {
+	    blk = *bp;
+	    *bp = blk->next;
+	    total.blocks--;
+	    return blk;
+	}
+    return NULL;
+}
+
+static
+void account_alloc(myblock_t * blk, size_t size)
+{
+    mysite_t *site = blk->site;
+    int i = histindex(size);
+
+    blk->size = size;
+    blk->serial = allocserial++;
+    total.bytes += size;
+    total.live += size;
+    if (total.peak < total.live)
+	total.peak = total.live;
+    totalhist[i]++;
+    if (site != NULL) {
+	site->bytes += size;
+	site->live += size;
+	if (site->peak < site->live)
+	    site->peak = site->live;
+	site->hist[i]++;
+    }
+}
+
+static
+void account_free(myblock_t * blk)
+{
+    total.live -= blk->size;
+    if (blk->site != NULL)
+	blk->site->live -= blk->size;
+}
+
+static
+void printsite(FILE * fp, mysite_t * site)
+{
+    int i;
+    char sep = '\t';
+
+    fprintf(fp, "%s:%d\t%s(%s)\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu",
+	    site->file, site->line, site->op, site->token, site->allocs,
+	    site->reallocs, site->frees, (unsigned long) site->bytes,
+	    (unsigned long) site->live, (unsigned long) site->peak);
+    for (i = 0; i < HISTLEN; i++)
+	if (site->hist[i]) {
+	    fprintf(fp, "%c%lu:%lu", sep, i ? (1UL << i) : 0UL,
+		    site->hist[i]);
+	    sep = ',';
+	}
+    fputc('\n', fp);
+}
+
+static
+int MYsitecmp(const void *x, const void *y)
+{
+    size_t a = (*(mysite_t **) x)->bytes, b = (*(mysite_t **) y)->bytes;
+
+    return (a < b) ? 1 : (b < a) ? -1 : 0;
+}
+
+/** Write allocation profile.
+ *
+ * Writes totals, then statistics of each call site in descending order of
+ * allocated bytes, as tab-separated values: call site, function and its
+ * arguments, numbers of allocations, reallocations and frees, allocated
+ * bytes, live bytes, peak live bytes and size histogram.  Histogram is
+ * pairs of lower bound of size class (power of 2) and number of blocks.
+ */
+void MYdump(FILE * fp)
+{
+    mysite_t **list, *site;
+    size_t i, n = 0;
+
+    LOCK();
+    for (i = 0; i < SITEHASHSIZ; i++)
+	for (site = sites[i]; site != NULL; site = site->next)
+	    n++;
+    if ((list = malloc(sizeof(mysite_t *) * (n + 1))) == NULL) {
+	UNLOCK();
+	return;
+    }
+    n = 0;
+    for (i = 0; i < SITEHASHSIZ; i++)
+	for (site = sites[i]; site != NULL; site = site->next)
+	    list[n++] = site;
+    qsort(list, n, sizeof(mysite_t *), MYsitecmp);
+
+    fprintf(fp, "# allocs %lu reallocs %lu frees %lu bytes %lu "
+	    "live %lu (%lu blocks) peak %lu\n", total.allocs,
+	    total.reallocs, total.frees, (unsigned long) total.bytes,
+	    (unsigned long) total.live, (unsigned long) total.blocks,
+	    (unsigned long) total.peak);
+    fprintf(fp, "# histogram");
+    for (i = 0; i < HISTLEN; i++)
+	if (totalhist[i])
+	    fprintf(fp, " %lu:%lu", i ? (1UL << i) : 0UL, totalhist[i]);
+    fprintf(fp, "\n#site\tcall\tallocs\treallocs\tfrees\tbytes\tlive\t"
+	    "peak\thistogram\n");
+    for (i = 0; i < n; i++)
+	printsite(fp, list[i]);
+    fflush(fp);
+    UNLOCK();
+    free(list);
+}
+
+/** Get total statistics of allocation. */
+void MYgetstats(mymalloc_stats_t * stats)
+{
+    LOCK();
+    memcpy(stats, &total, sizeof(mymalloc_stats_t));
+    UNLOCK();
 }
 
 void MYatexit(void)
 {
     size_t i;
+    myblock_t *blk;
     void *realbuf;
+    char *path;
+    FILE *fp;
 
-    qsort(alloclist, allocindex, sizeof(void *), (int (*)())MYcmp);
-
-    for (i = 0; i < allocindex; i++) {
-	if (alloclist[i] == NULL)
-	    break;
-
-	realbuf = alloclist[i] + INFOLEN * 2;
-	fprintf(stderr, "================================\n*%s\n",
-		(char *)alloclist[i]);
-	if (strstr(alloclist[i], "gcstring_t *") == NULL &&
-	    strstr(alloclist[i], "gcstring_t") != NULL)
-	    fprintf(stderr, "    str:[%016lx];  len:%d\n"
-		    "  gcstr:[%016lx];gclen:%d\n"
-		    "  lbobj:[%016lx]\n",
-		    ((gcstring_t *) realbuf)->str,
-		    ((gcstring_t *) realbuf)->len,
-		    ((gcstring_t *) realbuf)->gcstr,
-		    ((gcstring_t *) realbuf)->gclen,
-		    ((gcstring_t *) realbuf)->lbobj);
-	else if (strstr(alloclist[i], "unistr_t") != NULL)
-	    fprintf(stderr, "    str:[%016lx];  len:%d\n",
-		    ((unistr_t *) realbuf)->str,
-		    ((unistr_t *) realbuf)->len);
-	else if (strstr(alloclist[i], "linebreak_t") != NULL)
-	    fprintf(stderr, " refcnt:%d\n"
-		    "newline:[%016lx];  len:%d\n",
-		    ((linebreak_t *) realbuf)->refcount,
-		    ((linebreak_t *) realbuf)->newline.str,
-		    ((linebreak_t *) realbuf)->newline.len);
-
-	if (((char *) alloclist[i])[INFOLEN])
-	    fprintf(stderr, ">%s\n", (char *) (alloclist[i] + INFOLEN));
+    if ((path = getenv("MYMALLOC_PROFILE")) != NULL) {
+	if (path[0] == '\0' || strcmp(path, "-") == 0)
+	    MYdump(stderr);
+	else if ((fp = fopen(path, "a")) != NULL) {
+	    MYdump(fp);
+	    fclose(fp);
+	}
     }
+
+    for (i = 0; i < blockhashsiz; i++)
+	for (blk = blocks[i]; blk != NULL; blk = blk->next) {
+	    realbuf = BLOCK2PTR(blk);
+	    fprintf(stderr, "================================\n"
+		    "*%6lu[%p] %s:%d %s(%s) %lu bytes\n", blk->serial,
+		    realbuf, blk->site ? blk->site->file : "?",
+		    blk->site ? blk->site->line : 0,
+		    blk->site ? blk->site->op : "?",
+		    blk->site ? blk->site->token : "?",
+		    (unsigned long) blk->size);
+	    if (blk->site == NULL)
+		continue;
+	    if (strstr(blk->site->token, "gcstring_t *") == NULL &&
+		strstr(blk->site->token, "gcstring_t") != NULL)
+		fprintf(stderr, "    str:[%p];  len:%lu\n"
+			"  gcstr:[%p];gclen:%lu\n"
+			"  lbobj:[%p]\n",
+			(void *) ((gcstring_t *) realbuf)->str,
+			(unsigned long) ((gcstring_t *) realbuf)->len,
+			(void *) ((gcstring_t *) realbuf)->gcstr,
+			(unsigned long) ((gcstring_t *) realbuf)->gclen,
+			(void *) ((gcstring_t *) realbuf)->lbobj);
+	    else if (strstr(blk->site->token, "unistr_t") != NULL)
+		fprintf(stderr, "    str:[%p];  len:%lu\n",
+			(void *) ((unistr_t *) realbuf)->str,
+			(unsigned long) ((unistr_t *) realbuf)->len);
+	    else if (strstr(blk->site->token, "linebreak_t") != NULL)
+		fprintf(stderr, " refcnt:%lu\n"
+			"newline:[%p];  len:%lu\n",
+			(unsigned long) ((linebreak_t *) realbuf)->refcount,
+			(void *) ((linebreak_t *) realbuf)->newline.str,
+			(unsigned long) ((linebreak_t *) realbuf)->newline.
+			len);
+	}
 }
 
 void MYfree(void *buf, char *file, int line, char *token)
 {
-    size_t i;
+    myblock_t *blk;
 
     if (buf == NULL)
 	return;
 
-    for (i = 0; i < allocindex && (buf - INFOLEN * 2) != alloclist[i];
-	 i++);
-    if (allocindex <= i) {
-	fprintf(stderr, "WARN[%016lx] %s:%d double free(%s)\n", buf, file,
+    LOCK();
+    if ((blk = delblock(buf)) == NULL) {
+	UNLOCK();
+	fprintf(stderr, "WARN[%p] %s:%d double free(%s)\n", buf, file,
 		line, token);
 	return;
     }
-
-    free(buf - INFOLEN * 2);
-    alloclist[i] = NULL;
+    account_free(blk);
+    total.frees++;
+    if (blk->site != NULL)
+	blk->site->frees++;
+    UNLOCK();
+    free(blk);
 }
 
-void *MYmalloc(size_t size, const char *file, int line, char *token)
+void *MYmalloc(size_t size, char *file, int line, char *token)
 {
-    void *mem;
-    size_t i;
-
-    if (!atexit_set && atexit(MYatexit) == 0)
-	atexit_set = 1;
+    myblock_t *blk;
 
     if (size == 0)
 	fprintf(stderr, "WARN[                ] %s:%d malloc(%s=0)\n",
 		file, line, token);
 
-    if ((mem = malloc(size + INFOLEN * 2)) == NULL)
+    if ((blk = malloc(size + HDRSIZ)) == NULL)
 	return NULL;
 
-    snprintf(mem, (INFOLEN - 1), "%6d[%016lx] %s:%d malloc(%s)",
-	     allocserial++, mem + INFOLEN * 2, file, line, token);
-    ((char *) mem)[INFOLEN] = '\0';
-
-    for (i = 0; alloclist[i] != NULL && i < allocindex; i++);
-    if (allocindex <= i)
-	i = allocindex++;
-    alloclist[i] = mem;
-    return mem + INFOLEN * 2;
+    LOCK();
+    if (!atexit_set && atexit(MYatexit) == 0)
+	atexit_set = 1;
+    if (addblock(blk) != 0) {
+	UNLOCK();
+	free(blk);
+	return NULL;
+    }
+    blk->site = getsite(file, line, "malloc", token, NULL);
+    account_alloc(blk, size);
+    total.allocs++;
+    if (blk->site != NULL)
+	blk->site->allocs++;
+    UNLOCK();
+    return BLOCK2PTR(blk);
 }
 
-void *MYrealloc(void *buf, size_t size, const char *file, int line,
+void *MYrealloc(void *buf, size_t size, char *file, int line,
 		char *token1, char *token2)
 {
-    void *mem;
-    size_t i;
+    myblock_t *blk, *newblk;
 
     if (size == 0) {
-	fprintf(stderr, "WARN[%016lx] %s:%d realloc(%s, %s = 0)\n", buf,
+	fprintf(stderr, "WARN[%p] %s:%d realloc(%s, %s = 0)\n", buf,
 		file, line, token1, token2);
 	MYfree(buf, "", 0, "");
 	return NULL;
     }
-    if (buf == NULL) {
-	if ((mem = malloc(size + INFOLEN * 2)) == NULL)
-	    return NULL;
-
-	snprintf(mem, (INFOLEN - 1), "%6d[%016lx] %s:%d realloc(%s, %s)",
-		 allocserial++, mem + INFOLEN * 2, file, line, token1,
-		 token2);
-	((char *) mem)[INFOLEN] = '\0';
 
-	for (i = 0; alloclist[i] != NULL && i < allocindex; i++);
-	if (allocindex <= i)
-	    i = allocindex++;
-	alloclist[i] = mem;
-	return mem + INFOLEN * 2;
+    LOCK();
+    if (!atexit_set && atexit(MYatexit) == 0)
+	atexit_set = 1;
+    if (buf == NULL)
+	blk = NULL;
+    else if ((blk = delblock(buf)) == NULL) {
+	UNLOCK();
+	fprintf(stderr, "WARN[%p] %s:%d realloc(%s, %s) of unknown block\n",
+		buf, file, line, token1, token2);
+	errno = EINVAL;
+	return NULL;
     }
-
-    for (i = 0; i < allocindex && (buf - INFOLEN * 2) != alloclist[i];
-	 i++);
-
-    if ((mem = realloc(buf - INFOLEN * 2, size + INFOLEN * 2)) == NULL)
+    if ((newblk = realloc(blk, size + HDRSIZ)) == NULL) {
+	if (blk != NULL)
+	    addblock(blk);
+	UNLOCK();
 	return NULL;
-
-    if (i < allocindex) {
-	snprintf(mem + INFOLEN, (INFOLEN - 1),
-		 "%6d[%016lx] %s:%d realloc(%s, %s)",
-		 allocserial++, mem + INFOLEN * 2, file, line, token1,
-		 token2);
-	alloclist[i] = mem;
-    } else {
-	snprintf(mem, (INFOLEN - 1), "%6d[%016lx] %s:%d realloc(%s, %s)",
-		 allocserial++, mem + INFOLEN * 2, file, line, token1,
-		 token2);
-	((char *) mem)[INFOLEN] = '\0';
-
-	for (i = 0; alloclist[i] != NULL && i < allocindex; i++);
-	if (allocindex <= i)
-	    i = allocindex++;
-	alloclist[i] = mem;
     }
-    return mem + INFOLEN * 2;
+    if (blk != NULL)
+	account_free(newblk);
+    if (addblock(newblk) != 0) {
+	/* Block is lost from tracking. */
+	UNLOCK();
+	return BLOCK2PTR(newblk);
+    }
+    newblk->site = getsite(file, line, "realloc", token1, token2);
+    account_alloc(newblk, size);
+    if (blk == NULL)
+	total.allocs++;
+    else
+	total.reallocs++;
+    if (newblk->site != NULL) {
+	if (blk == NULL)
+	    newblk->site->allocs++;
+	else
+	    newblk->site->reallocs++;
+    }
+    UNLOCK();
+    return BLOCK2PTR(newblk);
 }
@@ -1,13 +1,25 @@
 #ifndef _MYMALLOC_H_
 
+#include <stdio.h>
+
+/* Total statistics of allocation. */
+typedef struct {
+    unsigned long allocs, reallocs, frees;
+    size_t bytes, live, peak, blocks;
+} mymalloc_stats_t;
+
 extern void *MYmalloc(size_t, char *, int, char *);
 extern void *MYrealloc(void *, size_t, char *, int, char *, char *);
 extern void MYfree(void *, char *, int, char *);
+extern void MYdump(FILE *);
+extern void MYgetstats(mymalloc_stats_t *);
 
+#ifndef MYMALLOC_NOWRAP
 #define malloc(buf) MYmalloc((buf), __FILE__, __LINE__, #buf)
 #define realloc(buf, size) \
     MYrealloc((buf), (size), __FILE__, __LINE__, #buf, #size)
 #define free(buf) MYfree((buf), __FILE__, __LINE__, #buf)
+#endif /* MYMALLOC_NOWRAP */
 
 #define _MYMALLOC_H_
 #endif /* _MYMALLOC_H_ */
@@ -200,15 +200,53 @@ gcstring_t *format_SHELL(linebreak_t * lbobj, linebreak_state_t state,
     return ret;
 }
 
+static
+int write_line(linebreak_t * lbobj, void *data, gcstring_t * line)
+{
+    size_t len;
+
+    if (line->str == NULL)
+	return 0;
+    if ((encbuf = sombok_encode_utf8(encbuf, &len, 0, (unistr_t *) line))
+	== NULL) {
+	lbobj->errnum = errno ? errno : ENOMEM;
+	return -1;
+    }
+    fwrite(encbuf, sizeof(char), len, (FILE *) data);
+    return 0;
+}
+
+static
+void print_stats(linebreak_t * lbobj, FILE * fp)
+{
+    linebreak_stats_t st;
+
+    if (!linebreak_get_stats(lbobj, &st))
+	return;
+    fprintf(fp, "chars: %lu\nclusters: %lu\n", st.chars, st.clusters);
+    fprintf(fp, "lines: %lu (mandatory %lu, arbitrary %lu, urgent %lu)\n",
+	    st.lines, st.lines_mandatory, st.lines_arbitrary,
+	    st.lines_urgent);
+    fprintf(fp, "calls: format %lu, sizing %lu, urgent %lu, prep %lu\n",
+	    st.calls_format, st.calls_sizing, st.calls_urgent,
+	    st.calls_prep);
+    fprintf(fp, "gcstrings: %lu (%lu bytes)\nmap lookups: %lu\n",
+	    st.gcstrings, st.gcstring_bytes, st.map_lookups);
+    fprintf(fp, "scanned: %lu\nmoved: %lu\n", st.scanned, st.moved);
+    fprintf(fp, "time: prep %.6f, sea %.6f, lb21a %.6f, lb25 %.6f, "
+	    "main %.6f, format %.6f\n", st.time_prep, st.time_sea,
+	    st.time_lb21a, st.time_lb25, st.time_main, st.time_format);
+}
+
 int main(int argc, char **argv)
 {
     linebreak_t *lbobj;
     size_t i, j, len;
     gcstring_t **lines;
     char *outfile = NULL;
-    FILE *ifp, *ofp;
-    int errnum;
-    unistr_t newline;
+    FILE *ifp, *ofp, *tfp = NULL;
+    int errnum, nthreads = 1;
+    unistr_t newline, whole = { NULL, 0 };
 
     lbobj = linebreak_new(NULL);
 
@@ -231,7 +269,25 @@ int main(int argc, char **argv)
 		lbobj->colmin = atof(argv[++i]);
 	    else if (strcmp(argv[i] + 2, "charmax") == 0)
 		lbobj->charmax = atol(argv[++i]);
-	    else if (strcmp(argv[i] + 2, "newline") == 0 && i + 1 < argc) {
+	    else if (strcmp(argv[i] + 2, "threads") == 0 && i + 1 < argc)
+		nthreads = atoi(argv[++i]);
+	    else if (strcmp(argv[i] + 2, "cache") == 0 && i + 1 < argc)
+		linebreak_set_cache(lbobj, (size_t) atol(argv[++i]));
+	    else if (strcmp(argv[i] + 2, "stats") == 0)
+		linebreak_set_stats(lbobj, 1);
+	    else if (strcmp(argv[i] + 2, "trace") == 0 && i + 1 < argc) {
+		i++;
+		if (tfp != NULL)
+		    fclose(tfp);
+		if ((tfp = fopen(argv[i], "w")) == NULL ||
+		    sombok_set_trace(sombok_trace_chrome, tfp) != 0) {
+		    errnum = errno;
+		    perror(argv[i]);
+		    linebreak_destroy(lbobj);
+		    exit(errnum);
+		}
+		fputs("[\n", tfp);
+	    } else if (strcmp(argv[i] + 2, "newline") == 0 && i + 1 < argc) {
 		i++;
 		if (parse_string(argv[i], strlen(argv[i])) == NULL) {
 		    errnum = errno;
@@ -268,6 +324,8 @@ int main(int argc, char **argv)
 		lbobj->options |= LINEBREAK_OPTION_VIRAMA_AS_JOINER;
 	    else if (strcmp(argv[i] + 2, "no-virama-as-joiner") == 0)
 		lbobj->options &= ~LINEBREAK_OPTION_VIRAMA_AS_JOINER;
+	    else if (strcmp(argv[i] + 2, "no-fast-path") == 0)
+		lbobj->options |= LINEBREAK_OPTION_NO_FAST_PATH;
 	    else if (strcmp(argv[i] + 2, "format-func") == 0 &&
 		       i + 1 < argc) {
 		i++;
@@ -438,6 +496,10 @@ int main(int argc, char **argv)
 	    break;
     }
 
+    /* format_SHELL uses static buffers. */
+    if (lbobj->format_func == format_SHELL)
+	nthreads = 1;
+
     if (outfile == NULL)
 	ofp = stdout;
     else if ((ofp = fopen(outfile, "wb")) == NULL) {
@@ -464,7 +526,14 @@ int main(int argc, char **argv)
 	    exit(errnum);
 	}
 
-	lines = linebreak_break(lbobj, &unistr);
+	if (1 < nthreads) {
+	    lines = linebreak_break_parallel(lbobj, &unistr, nthreads);
+	    for (j = 0; lines != NULL && lines[j] != NULL &&
+		 lbobj->errnum == 0; j++)
+		write_line(lbobj, ofp, lines[j]);
+	    linebreak_free_result(lines, 1);
+	} else
+	    linebreak_break_to_sink(lbobj, &unistr, write_line, ofp);
 	if (lbobj->errnum == LINEBREAK_ELONG) {
 	    fprintf(stderr, "Excessive line was found\n");
 	    free(unistr.str);
@@ -476,22 +545,6 @@ int main(int argc, char **argv)
 	    linebreak_destroy(lbobj);
 	    exit(errnum);
 	}
-
-	for (j = 0; lines[j] != NULL; j++) {
-	    if (lines[j]->str != NULL) {
-		if ((encbuf = sombok_encode_utf8(encbuf, &len, 0,
-						 (unistr_t *)(lines[j])))
-		    == NULL) {
-		    errnum = errno;
-		    perror("encode_utf8");
-		    linebreak_destroy(lbobj);
-		    exit(errnum);
-		}
-		fwrite(encbuf, sizeof(char), len, ofp);
-	    }
-	    gcstring_destroy(lines[j]);
-	}
-	free(lines);
     } else {
 	for (; i < argc; i++) {
 	    if (argv[i][0] == '-' && argv[i][1] == '\0')
@@ -520,7 +573,27 @@ int main(int argc, char **argv)
 	    }
 	    fclose(ifp);
 
-	    lines = linebreak_break_partial(lbobj, &unistr);
+	    /* Inputs are broken at once by threads. */
+	    if (1 < nthreads) {
+		unichar_t *_u;
+
+		if (unistr.len == 0)
+		    continue;
+		if ((_u = realloc(whole.str, sizeof(unichar_t) *
+				  (whole.len + unistr.len))) == NULL) {
+		    errnum = errno;
+		    perror("realloc");
+		    linebreak_destroy(lbobj);
+		    exit(errnum);
+		}
+		whole.str = _u;
+		memcpy(whole.str + whole.len, unistr.str,
+		       sizeof(unichar_t) * unistr.len);
+		whole.len += unistr.len;
+		continue;
+	    }
+
+	    linebreak_break_partial_to_sink(lbobj, &unistr, write_line, ofp);
 	    if (lbobj->errnum == LINEBREAK_ELONG) {
 		fprintf(stderr, "Excessive line was found\n");
 		free(unistr.str);
@@ -532,24 +605,16 @@ int main(int argc, char **argv)
 		linebreak_destroy(lbobj);
 		exit(errnum);
 	    }
-
-	    for (j = 0; lines[j] != NULL; j++) {
-		if (lines[j]->str != NULL) {
-		    if ((encbuf = sombok_encode_utf8(encbuf, &len, 0,
-						     (unistr_t *)(lines[j])))
-			== NULL) {
-			errnum = errno;
-			perror("encode_utf8");
-			linebreak_destroy(lbobj);
-			exit(errnum);
-		    }
-		    fwrite(encbuf, sizeof(char), len, ofp);
-		}
-		gcstring_destroy(lines[j]);
-	    }
-	    free(lines);
 	}
-	lines = linebreak_break_partial(lbobj, NULL);
+	if (1 < nthreads) {
+	    lines = linebreak_break_parallel(lbobj, &whole, nthreads);
+	    free(whole.str);
+	    for (j = 0; lines != NULL && lines[j] != NULL &&
+		 lbobj->errnum == 0; j++)
+		write_line(lbobj, ofp, lines[j]);
+	    linebreak_free_result(lines, 1);
+	} else
+	    linebreak_break_partial_to_sink(lbobj, NULL, write_line, ofp);
 	if (lbobj->errnum == LINEBREAK_ELONG) {
 	    fprintf(stderr, "Excessive line was found\n");
 	    free(unistr.str);
@@ -561,25 +626,17 @@ int main(int argc, char **argv)
 	    linebreak_destroy(lbobj);
 	    exit(errnum);
 	}
-
-	for (j = 0; lines[j] != NULL; j++) {
-	    if (lines[j]->str != NULL) {
-		if ((encbuf = sombok_encode_utf8(encbuf, &len, 0,
-						 (unistr_t *)(lines[j])))
-		    == NULL) {
-		    errnum = errno;
-		    perror("encode_utf8");
-		    linebreak_destroy(lbobj);
-		    exit(errnum);
-		}
-		fwrite(encbuf, sizeof(char), len, ofp);
-	    }
-	    gcstring_destroy(lines[j]);
-	}
-	free(lines);
     }
 
     fclose(ofp);
+    print_stats(lbobj, stderr);
+    if (tfp != NULL) {
+	/* Each event is followed by comma: close array by metadata. */
+	sombok_set_trace(NULL, NULL);
+	fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+	      "\"args\":{\"name\":\"sombok\"}}]\n", tfp);
+	fclose(tfp);
+    }
     free(encbuf);
     free(unistr.str);
     linebreak_destroy(lbobj);
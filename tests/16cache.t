@@ -0,0 +1,11 @@
+#! /bin/sh
+
+. tests/lb.sh
+
+plan 5
+
+for lang in fr ja ko ru zh; do
+    dotest $lang $lang --cache 1048576
+done
+
+check_result
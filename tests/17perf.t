@@ -0,0 +1,12 @@
+#! /bin/sh
+#
+# Performance regression check.  This is run by "make check PERF_CHECK=yes".
+# Counters are compared with tests/perf.baseline, which may be updated by
+# "./bench/bench -C > tests/perf.baseline".
+
+if [ "$PERF_CHECK" != "yes" ]; then
+    echo "Skipped.  Set PERF_CHECK=yes to run."
+    exit 77
+fi
+
+./bench/bench -C -b tests/perf.baseline
@@ -0,0 +1,7 @@
+#! /bin/sh
+#
+# Differential check of optimized paths against reference line breaking.
+# Memory allocated by library is also counted.
+# More cases may be run by "make fuzz FUZZ_FLAGS='-n 100000'".
+
+./bench/fuzz -n 300 -a